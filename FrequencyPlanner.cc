@@ -0,0 +1,474 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+#include "FrequencyPlanner.h"
+#include <cmath>
+#include <thread>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define PLANNER_AVX2
+#include <immintrin.h>
+#endif
+
+
+FrequencyPlanner::FrequencyPlanner(const config &c)
+    :
+    cfg(c),
+    epdf_num(uint64_t(c.reference) * (c.double_ref ? 2 : 1)),
+    epdf_den(uint64_t(c.half_ref ? 2 : 1) * (c.r > 1 ? c.r : 1))
+{
+}
+
+//----------//
+// Planning //
+//----------//
+bool
+FrequencyPlanner::plan(uint64_t frequency, tuning &t) const
+{
+    if(epdf_num == 0) return false;
+    if((cfg.mode == CHANNEL_SPACING) && (cfg.chan_spacing == 0)) return false;
+
+    // Smallest output divider that puts the VCO above its minimum
+    uint64_t vco_min = uint64_t(cfg.vco_min) * 1000000;
+    uint32_t dbf = 1;
+    while((frequency * dbf <= vco_min) && (dbf < 16))
+    {
+        dbf *= 2;
+    }
+    uint64_t vco = frequency * dbf;
+
+    // ncount = floor(vco / EPDF)
+    uint64_t scaled = vco * epdf_den;
+    uint64_t ncount = scaled / epdf_num;
+    uint64_t remainder = scaled - ncount * epdf_num;
+    uint64_t frac;
+    uint64_t mod;
+    if(cfg.mode == BEST_APPROXIMATION)
+    {
+        // frac / mod closest to remainder / EPDF
+        best_fraction(remainder, epdf_num, 0x0fff, frac, mod);
+    }
+    else
+    {
+        // mod = round(EPDF / chan_spacing)
+        uint64_t spacing_den = epdf_den * cfg.chan_spacing;
+        mod = (2 * epdf_num + spacing_den) / (2 * spacing_den);
+        if(mod == 0) mod = 1;
+
+        // frac = round(mod * remainder / EPDF)
+        frac = (2 * mod * remainder + epdf_num) / (2 * epdf_num);
+    }
+    if(frac == mod)
+    {
+        ++ncount;
+        frac = 0;
+    }
+
+    // Reduce frac/mod to simplest fraction
+    if(frac == 0)
+    {
+        mod = 1;
+    }
+    else
+    {
+        uint64_t div = gcd(frac, mod);
+        frac /= div;
+        mod /= div;
+    }
+
+    if((ncount > 0xffff) || (mod > 0x0fff)) return false;
+    t.ncount = ncount;
+    t.frac = frac;
+    t.mod = mod;
+    t.dbf = dbf;
+    t.actual = output(t.ncount, t.frac, t.mod, t.dbf);
+    return true;
+}
+
+//----------------//
+// Batch Planning //
+//----------------//
+
+// The batch results are produced either by plan() or by the AVX2 kernel,
+// which has to match it bit for bit. The AVX2 kernel works in double
+// precision, where every integer involved is exact as long as the scaled
+// VCO frequency stays below 2^52.
+static const double EXACT_LIMIT = 4503599627370496.0;
+
+size_t
+FrequencyPlanner::plan(const uint64_t *frequency, size_t count,
+                       batch &out) const
+{
+    out.ncount.resize(count);
+    out.frac.resize(count);
+    out.mod.resize(count);
+    out.dbf.resize(count);
+    out.actual.resize(count);
+    out.error.resize(count);
+    out.valid.resize(count);
+
+#ifdef PLANNER_AVX2
+    uint64_t mod = 0;
+    if((cfg.mode == CHANNEL_SPACING) && (cfg.chan_spacing != 0) &&
+       (epdf_num != 0))
+    {
+        uint64_t spacing_den = epdf_den * cfg.chan_spacing;
+        mod = (2 * epdf_num + spacing_den) / (2 * spacing_den);
+        if(mod == 0) mod = 1;
+    }
+    bool exact = (mod != 0) && (mod <= 0x0fff) &&
+                 (double(epdf_num) * (2 * mod + 1) < EXACT_LIMIT);
+    for(size_t i = 0; exact && (i < count); ++i)
+    {
+        exact = (double(frequency[i]) * 16 * epdf_den < EXACT_LIMIT);
+    }
+    if(exact && __builtin_cpu_supports("avx2"))
+    {
+        // frac/mod in lowest terms for every frac, including the carry
+        std::vector<uint32_t> reduced_frac(mod + 1);
+        std::vector<uint32_t> reduced_mod(mod + 1);
+        reduced_frac[0] = 0;
+        reduced_mod[0] = 1;
+        for(uint64_t f = 1; f <= mod; ++f)
+        {
+            uint64_t div = gcd(f, mod);
+            reduced_frac[f] = f / div;
+            reduced_mod[f] = mod / div;
+        }
+        size_t done = count & ~size_t(3);
+        size_t valid = plan_avx2(frequency, done, out, &reduced_frac[0],
+                                 &reduced_mod[0], mod);
+        return valid + plan_scalar(frequency, done, count, out);
+    }
+#endif
+    return plan_scalar(frequency, 0, count, out);
+}
+
+size_t
+FrequencyPlanner::plan_scalar(const uint64_t *frequency, size_t begin,
+                              size_t count, batch &out) const
+{
+    double epdf = double(epdf_num) / double(epdf_den);
+    size_t valid = 0;
+    for(size_t i = begin; i < count; ++i)
+    {
+        tuning t;
+        out.valid[i] = plan(frequency[i], t);
+        if(!out.valid[i]) continue;
+        ++valid;
+        out.ncount[i] = t.ncount;
+        out.frac[i] = t.frac;
+        out.mod[i] = t.mod;
+        out.dbf[i] = t.dbf;
+        out.actual[i] = ((double(t.ncount) * t.mod + t.frac) * epdf /
+                         (double(t.mod) * t.dbf));
+        out.error[i] = out.actual[i] - double(frequency[i]);
+    }
+    return valid;
+}
+
+#ifdef PLANNER_AVX2
+// floor(num / den) for non-negative integer-valued doubles below 2^52,
+// corrected for rounding in the division
+__attribute__((target("avx2")))
+static inline __m256d
+floor_div(__m256d num, __m256d den, __m256d &rem)
+{
+    __m256d q = _mm256_floor_pd(_mm256_div_pd(num, den));
+    __m256d r = _mm256_sub_pd(num, _mm256_mul_pd(q, den));
+    __m256d one = _mm256_set1_pd(1.0);
+    __m256d under = _mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_LT_OQ);
+    q = _mm256_sub_pd(q, _mm256_and_pd(under, one));
+    r = _mm256_add_pd(r, _mm256_and_pd(under, den));
+    __m256d over = _mm256_cmp_pd(r, den, _CMP_GE_OQ);
+    q = _mm256_add_pd(q, _mm256_and_pd(over, one));
+    r = _mm256_sub_pd(r, _mm256_and_pd(over, den));
+    rem = r;
+    return q;
+}
+
+__attribute__((target("avx2")))
+size_t
+FrequencyPlanner::plan_avx2(const uint64_t *frequency, size_t count,
+                            batch &out, const uint32_t *reduced_frac,
+                            const uint32_t *reduced_mod, uint32_t mod) const
+{
+    const __m256d vco_min = _mm256_set1_pd(double(cfg.vco_min) * 1000000);
+    const __m256d den = _mm256_set1_pd(double(epdf_den));
+    const __m256d num = _mm256_set1_pd(double(epdf_num));
+    const __m256d num2 = _mm256_set1_pd(2.0 * double(epdf_num));
+    const __m256d mod2 = _mm256_set1_pd(2.0 * mod);
+    const __m256d modv = _mm256_set1_pd(double(mod));
+    const __m256d epdf = _mm256_set1_pd(double(epdf_num) / double(epdf_den));
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d max_ncount = _mm256_set1_pd(double(0xffff));
+    // 2^52, for converting integers below it to double
+    const __m256i magic_bits = _mm256_set1_epi64x(0x4330000000000000LL);
+    const __m256d magic = _mm256_set1_pd(4503599627370496.0);
+
+    size_t valid = 0;
+    for(size_t i = 0; i < count; i += 4)
+    {
+        __m256i bits = _mm256_loadu_si256((const __m256i *)&frequency[i]);
+        __m256d f = _mm256_sub_pd(
+            _mm256_castsi256_pd(_mm256_or_si256(bits, magic_bits)), magic);
+
+        // Smallest output divider that puts the VCO above its minimum
+        __m256d dbf = one;
+        for(int k = 0; k < 4; ++k)
+        {
+            __m256d low = _mm256_cmp_pd(_mm256_mul_pd(f, dbf), vco_min,
+                                        _CMP_LE_OQ);
+            dbf = _mm256_add_pd(dbf, _mm256_and_pd(low, dbf));
+        }
+
+        // ncount = floor(vco / EPDF), frac = round(mod * remainder / EPDF)
+        __m256d scaled = _mm256_mul_pd(_mm256_mul_pd(f, dbf), den);
+        __m256d remainder;
+        __m256d ncount = floor_div(scaled, num, remainder);
+        __m256d unused;
+        __m256d frac = floor_div(
+            _mm256_add_pd(_mm256_mul_pd(mod2, remainder), num), num2, unused);
+        __m256d carry = _mm256_cmp_pd(frac, modv, _CMP_EQ_OQ);
+        ncount = _mm256_add_pd(ncount, _mm256_and_pd(carry, one));
+        frac = _mm256_andnot_pd(carry, frac);
+        __m256d fits = _mm256_cmp_pd(ncount, max_ncount, _CMP_LE_OQ);
+
+        // Reduce frac/mod to simplest fraction
+        __m128i fi = _mm256_cvttpd_epi32(frac);
+        __m128i rf = _mm_i32gather_epi32((const int *)reduced_frac, fi, 4);
+        __m128i rm = _mm_i32gather_epi32((const int *)reduced_mod, fi, 4);
+        __m256d rfd = _mm256_cvtepi32_pd(rf);
+        __m256d rmd = _mm256_cvtepi32_pd(rm);
+
+        __m256d actual = _mm256_div_pd(
+            _mm256_mul_pd(_mm256_add_pd(_mm256_mul_pd(ncount, rmd), rfd),
+                          epdf),
+            _mm256_mul_pd(rmd, dbf));
+
+        _mm_storeu_si128((__m128i *)&out.ncount[i],
+                         _mm256_cvttpd_epi32(ncount));
+        _mm_storeu_si128((__m128i *)&out.frac[i], rf);
+        _mm_storeu_si128((__m128i *)&out.mod[i], rm);
+        _mm_storeu_si128((__m128i *)&out.dbf[i], _mm256_cvttpd_epi32(dbf));
+        _mm256_storeu_pd(&out.actual[i], actual);
+        _mm256_storeu_pd(&out.error[i], _mm256_sub_pd(actual, f));
+        int mask = _mm256_movemask_pd(fits);
+        for(int k = 0; k < 4; ++k)
+        {
+            out.valid[i + k] = (mask >> k) & 1;
+        }
+        valid += __builtin_popcount(mask);
+    }
+    return valid;
+}
+#endif
+
+//----------------//
+// Coverage Sweep //
+//----------------//
+size_t
+FrequencyPlanner::sweep(uint64_t start, uint64_t stop, uint64_t step,
+                        uint16_t vco_max, unsigned threads,
+                        coverage &out) const
+{
+    if(step == 0) step = 1;
+    size_t count = (stop >= start) ? size_t((stop - start) / step + 1) : 0;
+    out.start = start;
+    out.step = step;
+    out.error.assign(count, 0.0);
+    out.dbf.assign(count, 0);
+    out.gaps.clear();
+    out.boundaries.clear();
+    out.boundary_dbf.clear();
+    out.max_error = 0.0;
+    out.rms_error = 0.0;
+    out.reachable = 0;
+
+    if(threads == 0) threads = std::thread::hardware_concurrency();
+    if(threads == 0) threads = 1;
+    if(threads > count) threads = count ? count : 1;
+    std::vector<std::thread> workers;
+    for(unsigned i = 1; i < threads; ++i)
+    {
+        workers.push_back(std::thread(&FrequencyPlanner::sweep_range, this,
+                                      count * i / threads,
+                                      count * (i + 1) / threads,
+                                      vco_max, std::ref(out)));
+    }
+    sweep_range(0, count / threads, vco_max, out);
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+
+    // Summarize the runs of unreachable frequencies and of each divider
+    double sum = 0.0;
+    for(size_t i = 0; i < count; ++i)
+    {
+        uint64_t f = start + i * step;
+        uint8_t dbf = out.dbf[i];
+        bool new_run = (i == 0) || (dbf != out.dbf[i - 1]);
+        if(dbf == 0)
+        {
+            if(new_run)
+            {
+                out.gaps.push_back(span());
+                out.gaps.back().first = f;
+            }
+            out.gaps.back().last = f;
+            continue;
+        }
+        if(new_run)
+        {
+            out.boundaries.push_back(span());
+            out.boundaries.back().first = f;
+            out.boundary_dbf.push_back(dbf);
+        }
+        out.boundaries.back().last = f;
+        double error = std::fabs(out.error[i]);
+        if(error > out.max_error) out.max_error = error;
+        sum += error * error;
+        ++out.reachable;
+    }
+    if(out.reachable) out.rms_error = std::sqrt(sum / out.reachable);
+    return out.reachable;
+}
+
+void
+FrequencyPlanner::sweep_range(size_t begin, size_t end, uint16_t vco_max,
+                              coverage &out) const
+{
+    const size_t BLOCK = 4096;
+    uint64_t vco_low = uint64_t(cfg.vco_min) * 1000000;
+    uint64_t vco_high = uint64_t(vco_max) * 1000000;
+    std::vector<uint64_t> frequency;
+    batch b;
+    for(size_t i = begin; i < end; i += BLOCK)
+    {
+        size_t n = (end - i < BLOCK) ? end - i : BLOCK;
+        frequency.resize(n);
+        for(size_t k = 0; k < n; ++k)
+        {
+            frequency[k] = out.start + (i + k) * out.step;
+        }
+        plan(&frequency[0], n, b);
+        for(size_t k = 0; k < n; ++k)
+        {
+            uint64_t vco = frequency[k] * b.dbf[k];
+            if(!b.valid[k] || (vco <= vco_low) || (vco > vco_high)) continue;
+            out.dbf[i + k] = b.dbf[k];
+            out.error[i + k] = b.error[k];
+        }
+    }
+}
+
+FrequencyPlanner::rational
+FrequencyPlanner::output(uint32_t ncount, uint32_t frac, uint32_t mod,
+                         uint32_t dbf) const
+{
+    // (ncount + frac / mod) * EPDF / dbf
+    rational f;
+    if(mod == 0) mod = 1;
+    f.num = (uint64_t(ncount) * mod + frac) * epdf_num;
+    f.den = uint64_t(mod) * epdf_den * dbf;
+    uint64_t div = gcd(f.num, f.den);
+    if(div > 1)
+    {
+        f.num /= div;
+        f.den /= div;
+    }
+    return f;
+}
+
+void
+FrequencyPlanner::best_fraction(uint64_t num, uint64_t den, uint64_t max_den,
+                                uint64_t &frac, uint64_t &mod)
+{
+    uint64_t div = gcd(num, den);
+    if(div > 1)
+    {
+        num /= div;
+        den /= div;
+    }
+    if(den <= max_den)
+    {
+        frac = num;
+        mod = den;
+        return;
+    }
+
+    // Walk the convergents p1/q1 of num/den until the next denominator
+    // would exceed max_den
+    uint64_t p0 = 0, q0 = 1, p1 = 1, q1 = 0;
+    uint64_t n = num, d = den;
+    while(d != 0)
+    {
+        uint64_t a = n / d;
+        uint64_t q2 = q0 + a * q1;
+        if(q2 > max_den) break;
+        uint64_t p2 = p0 + a * p1;
+        p0 = p1;
+        q0 = q1;
+        p1 = p2;
+        q1 = q2;
+        uint64_t t = n - a * d;
+        n = d;
+        d = t;
+    }
+
+    // The best approximation is either the last convergent or the largest
+    // semiconvergent between it and the one before
+    uint64_t k = (max_den - q0) / q1;
+    uint64_t sp = p0 + k * p1;
+    uint64_t sq = q0 + k * q1;
+
+    // Compare |p1/q1 - num/den| with |sp/sq - num/den| by cross
+    // multiplication
+    uint64_t e1 = (p1 * den > num * q1) ? p1 * den - num * q1
+                                        : num * q1 - p1 * den;
+    uint64_t e2 = (sp * den > num * sq) ? sp * den - num * sq
+                                        : num * sq - sp * den;
+    if(e2 * q1 < e1 * sq)
+    {
+        frac = sp;
+        mod = sq;
+    }
+    else
+    {
+        frac = p1;
+        mod = q1;
+    }
+}
+
+uint64_t
+FrequencyPlanner::gcd(uint64_t a, uint64_t b)
+{
+    while(b != 0)
+    {
+        uint64_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
@@ -0,0 +1,289 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+#ifndef FREQUENCYPLANNER_H
+#define FREQUENCYPLANNER_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * Exact frequency arithmetic for the Valon 5007 synthesizers.
+ * 
+ * Frequencies are integers in Hz and the EPDF is kept as the exact ratio
+ * \f$reference\times doubler/(halver\times R)\f$, so the same request always
+ * produces the same register values and the output frequency they give is
+ * known exactly. See ValonSynth \ref calculations for the relationships
+ * between the values.
+ * 
+ * In CHANNEL_SPACING mode mod is chosen from the channel spacing, frac is the
+ * nearest fraction of the EPDF to the remainder of the VCO frequency, and
+ * frac/mod is reduced to lowest terms. In BEST_APPROXIMATION mode the channel
+ * spacing is ignored and frac/mod is the fraction with a 12-bit modulus that
+ * comes closest to the remainder, found from its continued fraction
+ * expansion.
+ **/
+class FrequencyPlanner
+{
+public:
+    /**
+     * How frac and mod are chosen.
+     **/
+    enum solver { CHANNEL_SPACING, BEST_APPROXIMATION };
+
+    /**
+     * An exact non-negative rational number of Hz.
+     **/
+    struct rational
+    {
+        uint64_t num;
+        uint64_t den;
+    };
+
+    /**
+     * The synthesizer settings that the output frequency depends on.
+     **/
+    struct config
+    {
+        /**
+         * Reference frequency in Hz.
+         **/
+        uint32_t reference;
+
+        /**
+         * The reference frequency doubler is active.
+         **/
+        bool double_ref;
+
+        /**
+         * The reference frequency halver is active.
+         **/
+        bool half_ref;
+
+        /**
+         * The reference frequency divider value. 0 is treated as 1.
+         **/
+        uint32_t r;
+
+        /**
+         * Minimum VCO frequency in MHz, used to choose the output divider.
+         **/
+        uint16_t vco_min;
+
+        /**
+         * Channel spacing in Hz. Unused in BEST_APPROXIMATION mode.
+         **/
+        uint32_t chan_spacing;
+
+        /**
+         * How frac and mod are chosen.
+         **/
+        solver mode;
+    };
+
+    /**
+     * Register values for one output frequency.
+     **/
+    struct tuning
+    {
+        uint32_t ncount;
+        uint32_t frac;
+        uint32_t mod;
+        uint32_t dbf;
+
+        /**
+         * The output frequency these values produce.
+         **/
+        rational actual;
+    };
+
+    /**
+     * Register values for many output frequencies, one array per field.
+     * Entry i of each array belongs to the i'th requested frequency.
+     **/
+    struct batch
+    {
+        std::vector<uint32_t> ncount;
+        std::vector<uint32_t> frac;
+        std::vector<uint32_t> mod;
+        std::vector<uint32_t> dbf;
+
+        /**
+         * The output frequency in Hz, rounded to double precision.
+         **/
+        std::vector<double> actual;
+
+        /**
+         * actual minus the requested frequency, in Hz.
+         **/
+        std::vector<double> error;
+
+        /**
+         * Nonzero where the values fit the register fields. The other
+         * fields are unspecified where this is zero.
+         **/
+        std::vector<uint8_t> valid;
+    };
+
+    /**
+     * A closed range of output frequencies in Hz.
+     **/
+    struct span
+    {
+        uint64_t first;
+        uint64_t last;
+    };
+
+    /**
+     * Tuning error and reachability over an evenly spaced set of output
+     * frequencies, as produced by sweep().
+     **/
+    struct coverage
+    {
+        uint64_t start;
+        uint64_t step;
+
+        /**
+         * Tuning error in Hz at start + i * step. Zero where unreachable.
+         **/
+        std::vector<double> error;
+
+        /**
+         * Output divider at start + i * step, or 0 where the frequency is
+         * unreachable: the VCO would fall outside its range or the values
+         * would not fit the register fields.
+         **/
+        std::vector<uint8_t> dbf;
+
+        /**
+         * Runs of unreachable frequencies.
+         **/
+        std::vector<span> gaps;
+
+        /**
+         * Runs of reachable frequencies sharing an output divider, one per
+         * entry of boundary_dbf.
+         **/
+        std::vector<span> boundaries;
+        std::vector<uint8_t> boundary_dbf;
+
+        double max_error;
+        double rms_error;
+        size_t reachable;
+    };
+
+    /**
+     * Constructor.
+     * @param[in] cfg The settings to plan against.
+     **/
+    FrequencyPlanner(const config &cfg);
+
+    /**
+     * Compute the register values for an output frequency.
+     * @param[in] frequency The desired output frequency in Hz.
+     * @param[out] t Receives the register values and the actual frequency.
+     * @return True if the values fit the register fields.
+     **/
+    bool plan(uint64_t frequency, tuning &t) const;
+
+    /**
+     * Compute the register values for many output frequencies. The integer
+     * results are identical to plan(). In CHANNEL_SPACING mode this uses
+     * AVX2 when the processor supports it.
+     * @param[in] frequency The desired output frequencies in Hz.
+     * @param[in] count The number of frequencies.
+     * @param[out] out Receives the results, resized to count.
+     * @return The number of frequencies whose values fit the register fields.
+     **/
+    size_t plan(const uint64_t *frequency, size_t count, batch &out) const;
+
+    /**
+     * Plan every step'th frequency from start to stop, splitting the work
+     * across threads, and summarize the tuning error and coverage.
+     * @param[in] start, stop The output frequencies to sweep in Hz.
+     * @param[in] step The distance between frequencies in Hz.
+     * @param[in] vco_max The maximum VCO frequency in MHz.
+     * @param[in] threads The number of threads; 0 uses one per core.
+     * @param[out] out Receives the map and summary.
+     * @return The number of reachable frequencies.
+     **/
+    size_t sweep(uint64_t start, uint64_t stop, uint64_t step,
+                 uint16_t vco_max, unsigned threads, coverage &out) const;
+
+    /**
+     * Compute the exact output frequency for a set of register values.
+     * @param[in] ncount, frac, mod, dbf The register values.
+     * @return The output frequency in Hz.
+     **/
+    rational output(uint32_t ncount, uint32_t frac, uint32_t mod,
+                    uint32_t dbf) const;
+
+    /**
+     * Convert an exact frequency to floating point.
+     * @param[in] f The frequency in Hz.
+     * @return The frequency in Hz.
+     **/
+    static double to_hz(const rational &f);
+
+    /**
+     * Find the fraction closest to num/den whose denominator does not exceed
+     * max_den. The result is in lowest terms and may equal 1/1.
+     * @param[in] num, den The ratio to approximate, with num < den.
+     * @param[in] max_den The largest denominator allowed.
+     * @param[out] frac, mod Receive the numerator and denominator.
+     **/
+    static void best_fraction(uint64_t num, uint64_t den, uint64_t max_den,
+                              uint64_t &frac, uint64_t &mod);
+
+    /**
+     * Greatest common divisor, used to keep ratios in lowest terms.
+     **/
+    static uint64_t gcd(uint64_t a, uint64_t b);
+
+private:
+    // Batch kernels, processing entries [begin, count)
+    size_t plan_scalar(const uint64_t *frequency, size_t begin, size_t count,
+                       batch &out) const;
+    size_t plan_avx2(const uint64_t *frequency, size_t count, batch &out,
+                     const uint32_t *reduced_frac,
+                     const uint32_t *reduced_mod, uint32_t mod) const;
+
+    // Sweep worker, filling in entries [begin, end) of out
+    void sweep_range(size_t begin, size_t end, uint16_t vco_max,
+                     coverage &out) const;
+
+    config cfg;
+
+    // EPDF = epdf_num / epdf_den Hz
+    uint64_t epdf_num;
+    uint64_t epdf_den;
+};
+
+inline double
+FrequencyPlanner::to_hz(const FrequencyPlanner::rational &f)
+{
+    return double(f.num) / double(f.den);
+}
+
+#endif//FREQUENCYPLANNER_H
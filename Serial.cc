@@ -22,7 +22,9 @@
 
 
 #include "Serial.h"
+#include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #if defined(VXWORKS)
 #include <iostream.h>
@@ -54,7 +56,11 @@ Serial::Serial(const char *port) : the_serial_port(0),
                                    the_number_of_stop_bits(1),
                                    the_hardware_flow_control_flag(0),
                                    the_software_flow_control_flag(0),
-                                   the_input_mode(Serial::raw)
+                                   the_input_mode(Serial::raw),
+                                   the_trace(0),
+                                   the_trace_time(0),
+                                   the_error_handler(0),
+                                   the_error_context(0)
 {
     if (open_serial_port(port) == 0)
     {
@@ -70,9 +76,142 @@ Serial::Serial(const char *port) : the_serial_port(0),
 }
 
 
+Serial::Serial() : the_serial_port(-1),
+                   the_baud_rate(9600),
+                   the_parity(Serial::none),
+                   the_number_of_data_bits(8),
+                   the_number_of_stop_bits(1),
+                   the_hardware_flow_control_flag(0),
+                   the_software_flow_control_flag(0),
+                   the_input_mode(Serial::raw),
+                   the_trace(0),
+                   the_trace_time(0),
+                   the_error_handler(0),
+                   the_error_context(0)
+{
+}
+
+
 Serial::~Serial()
 {
-    close(the_serial_port);
+    set_trace(0);
+    if (the_serial_port >= 0)
+        close(the_serial_port);
+}
+
+
+bool Serial::serial_is_open()
+{
+    if (the_serial_port < 0)
+        return false;
+    else
+        return true;
+}
+
+
+// Messages for report_error, in the order of error_codes.
+static const char *const error_messages[] =
+{
+    "Cannot open serial port",
+    "Cannot set parity",
+    "Cannot set baud rate",
+    "Cannot set data bits",
+    "Cannot set stop bits",
+    "Cannot set hardware flow control",
+    "Cannot set software flow control",
+    "Cannot set raw input mode",
+    "Cannot set canonical input mode",
+    "Cannot set other flags",
+    "Cannot set exclusive access",
+    "Cannot set non-blocking access",
+    "Cannot open trace file"
+};
+
+
+void Serial::report_error(const error_codes &code)
+{
+    int error_number = errno;
+    if (the_error_handler)
+        the_error_handler(the_error_context, code, error_number);
+    else
+        cerr << error_messages[code] << endl;
+}
+
+
+// Monotonic time in microseconds.
+static int64_t trace_clock()
+{
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t(now.tv_sec) * 1000000 + now.tv_nsec / 1000);
+}
+
+
+int Serial::set_trace(const char *path)
+{
+    if (the_trace)
+    {
+        fclose(the_trace);
+        the_trace = 0;
+    }
+    if (path == 0)
+        return (0);
+
+    the_trace = fopen(path, "wb");
+    if (the_trace == 0)
+    {
+        // TBF: Error message
+        report_error(trace_failed);
+        return (-1);
+    }
+    static const unsigned char header[5] = {'V', 'T', 'R', 'C', 1};
+    fwrite(header, 1, sizeof(header), the_trace);
+    the_trace_time = trace_clock();
+    return (0);
+}
+
+
+int Serial::traced_write(const unsigned char *output_buffer,
+                         const int &number_of_bytes)
+{
+    int64_t start = trace_clock();
+    int result = serial_write(output_buffer, number_of_bytes);
+    trace_record('W', start, number_of_bytes, output_buffer, result);
+    return (result);
+}
+
+
+int Serial::traced_read(unsigned char *input_buffer,
+                        const int &number_of_bytes, const int timeout_usec)
+{
+    int64_t start = trace_clock();
+    int result = serial_read(input_buffer, number_of_bytes, timeout_usec);
+    trace_record('R', start, number_of_bytes, input_buffer, result);
+    return (result);
+}
+
+
+void Serial::trace_record(const char kind, const int64_t &start,
+                          const int &requested, const unsigned char *data,
+                          const int &length)
+{
+    // kind, start (us after the previous record), duration (us),
+    // requested and transferred byte counts, big-endian, then the bytes
+    uint32_t offset = uint32_t(start - the_trace_time);
+    uint32_t duration = uint32_t(trace_clock() - start);
+    uint16_t count = uint16_t(length > 0 ? length : 0);
+    unsigned char head[13] = {
+        (unsigned char)kind,
+        (unsigned char)(offset >> 24), (unsigned char)(offset >> 16),
+        (unsigned char)(offset >> 8), (unsigned char)offset,
+        (unsigned char)(duration >> 24), (unsigned char)(duration >> 16),
+        (unsigned char)(duration >> 8), (unsigned char)duration,
+        (unsigned char)(requested >> 8), (unsigned char)requested,
+        (unsigned char)(count >> 8), (unsigned char)count
+    };
+    fwrite(head, 1, sizeof(head), the_trace);
+    fwrite(data, 1, count, the_trace);
+    the_trace_time = start;
 }
 
 
@@ -200,7 +339,7 @@ int Serial::open_serial_port(const char *port_name)
     if (the_serial_port < 0)
     {
         // TBF: Error message
-        cerr << "Cannot open serial port" << endl;
+        report_error(open_failed);
         return (-1);
     }
     else
@@ -227,7 +366,7 @@ int Serial::update_parity(const Serial::parity_choices &parity)
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set parity" << endl;
+        report_error(parity_failed);
         return (-1);
     }
 
@@ -255,7 +394,7 @@ int Serial::update_parity(const Serial::parity_choices &parity)
     if (tcsetattr(the_serial_port, TCSADRAIN, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set parity" << endl;
+        report_error(parity_failed);
         return (-1);
     }
 
@@ -285,7 +424,7 @@ int Serial::update_baud_rate(const int &baud_rate)
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set baud rate" << endl;
+        report_error(baud_rate_failed);
         return (-1);
     }
  
@@ -332,7 +471,7 @@ int Serial::update_baud_rate(const int &baud_rate)
     if (tcsetattr(the_serial_port, TCSADRAIN, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set baud rate" << endl;
+        report_error(baud_rate_failed);
         return (-1);
     }
 
@@ -349,7 +488,7 @@ int Serial::update_baud_rate(const int &baud_rate)
     if (ioctl(the_serial_port, FIOBAUDRATE, the_baud_rate) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set baud rate" << endl;
+        report_error(baud_rate_failed);
         return (-1);
     }
 
@@ -368,7 +507,7 @@ int Serial::update_data_bits(const int &data_bits)
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set data bits" << endl;
+        report_error(data_bits_failed);
         return (-1);
     }
 
@@ -397,7 +536,7 @@ int Serial::update_data_bits(const int &data_bits)
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set data bits" << endl;
+        report_error(data_bits_failed);
         return (-1);
     }
 
@@ -427,7 +566,7 @@ int Serial::update_stop_bits(const int &stop_bits)
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set stop bits" << endl;
+        report_error(stop_bits_failed);
         return (-1);
     }
 
@@ -448,7 +587,7 @@ int Serial::update_stop_bits(const int &stop_bits)
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set stop bits" << endl;
+        report_error(stop_bits_failed);
         return (-1);
     }
 
@@ -478,7 +617,7 @@ int Serial::update_hardware_flow_control(const int &hardware_flow_control)
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set hardware flow control" << endl;
+        report_error(hardware_flow_control_failed);
         return (-1);
     }
 
@@ -494,7 +633,7 @@ int Serial::update_hardware_flow_control(const int &hardware_flow_control)
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set hardware flow control" << endl;
+        report_error(hardware_flow_control_failed);
         return (-1);
     }
 
@@ -524,7 +663,7 @@ int Serial::update_software_flow_control(int const &software_flow_control)
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set software flow control" << endl;
+        report_error(software_flow_control_failed);
         return (-1);
     }
 
@@ -540,7 +679,7 @@ int Serial::update_software_flow_control(int const &software_flow_control)
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set software flow control" << endl;
+        report_error(software_flow_control_failed);
         return (-1);
     }
 
@@ -559,7 +698,7 @@ int Serial::update_software_flow_control(const int &software_flow_control)
         if (ioctl(the_serial_port, FIOSETOPTIONS, OPT_TANDEM) < 0)
         {
             // TBF: Error message
-            cerr << "Cannot set software flow control" << endl;
+            report_error(software_flow_control_failed);
             return (-1);
         }
     }
@@ -592,7 +731,7 @@ int Serial::set_raw_input_mode()
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set raw input mode" << endl;
+        report_error(raw_input_mode_failed);
         return (-1);
     }
 
@@ -606,7 +745,7 @@ int Serial::set_raw_input_mode()
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set raw input mode" << endl;
+        report_error(raw_input_mode_failed);
         return (-1);
     }
 
@@ -621,7 +760,7 @@ int Serial::set_raw_input_mode()
     if (ioctl(the_serial_port, FIOSETOPTIONS, OPT_RAW) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set raw input mode" << endl;
+        report_error(raw_input_mode_failed);
         return (-1);
     }
 
@@ -638,7 +777,7 @@ int Serial::set_canonical_input_mode()
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set canonical input mode" << endl;
+        report_error(canonical_input_mode_failed);
         return (-1);
     }
 
@@ -650,7 +789,7 @@ int Serial::set_canonical_input_mode()
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set canonical input mode" << endl;
+        report_error(canonical_input_mode_failed);
         return (-1);
     }
 
@@ -665,7 +804,7 @@ int Serial::set_canonical_input_mode()
     if (ioctl(the_serial_port, FIOSETOPTIONS, OPT_LINE) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set canonical input mode" << endl;
+        report_error(canonical_input_mode_failed);
         return (-1);
     }
 
@@ -682,7 +821,7 @@ int Serial::set_other_flags()
     if (tcgetattr(the_serial_port, &the_termios) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set other flags" << endl;
+        report_error(other_flags_failed);
         return (-1);
     }
 
@@ -711,7 +850,7 @@ int Serial::set_other_flags()
     if (tcsetattr(the_serial_port, TCSAFLUSH, &the_termios) != 0)
     {
         // TBF: Error message
-        cerr << "Cannot set other flags" << endl;
+        report_error(other_flags_failed);
         return (-1);
     }
 
@@ -727,10 +866,74 @@ int Serial::set_other_flags()
     if (ioctl(the_serial_port, FIOSETOPTIONS, OPT_CRMOD) < 0)
     {
         // TBF: Error message
-        cerr << "Cannot set other flags" << endl;
+        report_error(other_flags_failed);
         return (-1);
     }
 
     return (0);
 }
 #endif
+
+
+#if defined (SOLARIS) || defined (LINUX)
+int Serial::update_exclusive(const int &exclusive)
+{
+    if (ioctl(the_serial_port, exclusive ? TIOCEXCL : TIOCNXCL) < 0)
+    {
+        // TBF: Error message
+        report_error(exclusive_failed);
+        return (-1);
+    }
+
+    return (0);
+}
+#endif
+
+
+#if defined(VXWORKS)
+int Serial::update_exclusive(const int &)
+{
+    // Exclusive access is not supported.
+    return (0);
+}
+#endif
+
+
+#if defined (SOLARIS) || defined (LINUX)
+int Serial::update_nonblocking(const int &nonblocking)
+{
+    int flags = fcntl(the_serial_port, F_GETFL);
+    if (flags >= 0)
+    {
+        flags = nonblocking ? (flags | O_NONBLOCK) : (flags & ~O_NONBLOCK);
+        flags = fcntl(the_serial_port, F_SETFL, flags);
+    }
+    if (flags < 0)
+    {
+        // TBF: Error message
+        report_error(nonblocking_failed);
+        return (-1);
+    }
+
+    return (0);
+}
+#endif
+
+
+#if defined(VXWORKS)
+int Serial::update_nonblocking(const int &)
+{
+    // Non-blocking access is not supported.
+    return (-1);
+}
+#endif
+
+
+int Serial::serial_flush_input()
+{
+#if defined (SOLARIS) || defined (LINUX)
+    return (tcflush(the_serial_port, TCIFLUSH));
+#else
+    return (ioctl(the_serial_port, FIORFLUSH, 0));
+#endif
+}
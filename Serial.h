@@ -24,6 +24,8 @@
 #ifndef YGOR_SERIAL_H
 #define YGOR_SERIAL_H
 
+#include <stdint.h>
+#include <stdio.h>
 
 // <summary>
 // This class provides a vehicle for serial communication on the vxWorks, 
@@ -86,6 +88,20 @@ public:
     enum parity_choices {odd, even, none};
     enum input_choices  {raw, canonical};
 
+    // The failures reported through set_error_handler.  Each corresponds
+    // to one of the messages written to cerr when no handler is set.
+    enum error_codes {open_failed, parity_failed, baud_rate_failed,
+                      data_bits_failed, stop_bits_failed,
+                      hardware_flow_control_failed,
+                      software_flow_control_failed, raw_input_mode_failed,
+                      canonical_input_mode_failed, other_flags_failed,
+                      exclusive_failed, nonblocking_failed, trace_failed};
+
+    // Called with the context given to set_error_handler, the failure and
+    // the errno at the time.
+    typedef void (*error_handler)(void *context, error_codes code,
+                                  int error_number);
+
     // Default configuration is 9600 baud, 8N1, no hardware or software
     // flow control, and raw input.  Call the member functions below to
     // modify the default configuration.
@@ -154,10 +170,46 @@ public:
     // the entire line of characters, including '/n', are sent/received.
     // Returns 0 on success, -1 on failure.
     int set_input_mode(const Serial::input_choices &input_mode);
+
+    // set_exclusive accepts either 0 = Shared access or 1 = Exclusive
+    // access.  While exclusive access is set, further opens of the port
+    // fail with EBUSY.  Returns 0 on success, -1 on failure.
+    int set_exclusive(const int &exclusive);
+
+    // set_nonblocking accepts either 0 = Blocking or 1 = Non-blocking
+    // access to the underlying descriptor, for callers that drive it
+    // from their own event loop.  Returns 0 on success, -1 on failure.
+    int set_nonblocking(const int &nonblocking);
+
+    // set_trace records every write and read made through this port to
+    // the named file: the bytes, when each call began and how long it
+    // took.  Any earlier trace is closed; NULL stops recording.  The file
+    // format is described in SerialReplay.h.  Returns 0 on success, -1 on
+    // failure.
+    int set_trace(const char *path);
+
+    // flush_input discards bytes that have been received but not read.
+    // Returns 0 on success, -1 on failure.
+    int flush_input();
     // </group>
 
+    // set_error_handler sends later failures to handler instead of
+    // writing a message to cerr, so that a thread which must not block
+    // never enters iostream.  NULL restores the messages.  Failures while
+    // the constructor opens the port are always written to cerr.
+    void set_error_handler(error_handler handler, void *context);
+
     bool is_open();
 
+    // The underlying descriptor, for use with poll or select.  -1 if the
+    // port is not open.
+    int descriptor() const;
+
+protected:
+    // For transports that stand in for a port.  Nothing is opened and
+    // is_open returns false unless serial_is_open is overridden.
+    Serial();
+
 private:
     // Forbidden operations
     // <group>
@@ -175,6 +227,24 @@ private:
     int the_hardware_flow_control_flag;
     int the_software_flow_control_flag;
     input_choices the_input_mode;
+    FILE *the_trace;
+    int64_t the_trace_time;
+    error_handler the_error_handler;
+    void *the_error_context;
+    // </group>
+
+    // Hands a failure to the error handler, or writes its message to cerr.
+    void report_error(const error_codes &code);
+
+    // Recording of traffic for set_trace.
+    // <group>
+    int traced_write(const unsigned char *output_buffer,
+                     const int &number_of_bytes);
+    int traced_read(unsigned char *input_buffer, const int &number_of_bytes,
+                    const int timeout_usec);
+    void trace_record(const char kind, const int64_t &start,
+                      const int &requested, const unsigned char *data,
+                      const int &length);
     // </group>
 
     // These member functions set up parameters for the serial port over 
@@ -204,6 +274,10 @@ private:
     virtual int update_software_flow_control(const int
                                              &software_flow_control);
     virtual int update_input_mode(const input_choices &input_mode);
+    virtual int update_exclusive(const int &exclusive);
+    virtual int update_nonblocking(const int &nonblocking);
+    virtual bool serial_is_open();
+    virtual int serial_flush_input();
     // </group>
 };
 
@@ -211,6 +285,8 @@ private:
 inline int Serial::write(const unsigned char *output_buffer,
                          const int &number_of_bytes)
 {
+    if (the_trace)
+        return (traced_write(output_buffer, number_of_bytes));
     return (serial_write(output_buffer, number_of_bytes));
 }
 
@@ -218,6 +294,8 @@ inline int Serial::write(const unsigned char *output_buffer,
 inline int Serial::read(unsigned char *input_buffer, const int &number_of_bytes, 
                         const int tmo_usec)
 {
+    if (the_trace)
+        return (traced_read(input_buffer, number_of_bytes, tmo_usec));
     return (serial_read(input_buffer, number_of_bytes, tmo_usec));
 }
 
@@ -265,12 +343,39 @@ inline int Serial::set_input_mode(const input_choices &input_mode)
     return (update_input_mode(input_mode));
 }
 
+inline int Serial::set_exclusive(const int &exclusive)
+{
+    return (update_exclusive(exclusive));
+}
+
+inline int Serial::set_nonblocking(const int &nonblocking)
+{
+    return (update_nonblocking(nonblocking));
+}
+
+
+inline int Serial::flush_input()
+{
+    return (serial_flush_input());
+}
+
+
+inline void Serial::set_error_handler(error_handler handler, void *context)
+{
+    the_error_handler = handler;
+    the_error_context = context;
+}
+
+
 inline bool Serial::is_open()
 {
-    if (the_serial_port < 0)
-        return false;
-    else
-        return true;
+    return (serial_is_open());
+}
+
+
+inline int Serial::descriptor() const
+{
+    return (the_serial_port);
 }
 
 #endif
@@ -0,0 +1,210 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "SerialReplay.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+SerialReplay::SerialReplay(const char *path, bool pace_calls)
+    :
+    next(0),
+    offset(0),
+    loaded(false),
+    paced(pace_calls),
+    skips(0),
+    mismatches(0)
+{
+    loaded = load(path, records);
+}
+
+bool
+SerialReplay::load(const char *path, std::vector<record> &records)
+{
+    records.clear();
+    FILE *f = fopen(path, "rb");
+    if(f == NULL) return false;
+    uint8_t header[5];
+    bool ok = ((fread(header, 1, sizeof(header), f) == sizeof(header)) &&
+               (memcmp(header, "VTRC", 4) == 0) && (header[4] == 1));
+    uint8_t head[13];
+    while(ok && (fread(head, 1, sizeof(head), f) == sizeof(head)))
+    {
+        record r;
+        r.kind = char(head[0]);
+        r.start = (uint32_t(head[1]) << 24) | (uint32_t(head[2]) << 16) |
+                  (uint32_t(head[3]) << 8) | head[4];
+        r.duration = (uint32_t(head[5]) << 24) | (uint32_t(head[6]) << 16) |
+                     (uint32_t(head[7]) << 8) | head[8];
+        r.requested = uint16_t((head[9] << 8) | head[10]);
+        r.data.resize((head[11] << 8) | head[12]);
+        ok = ((r.kind == 'W') || (r.kind == 'R')) &&
+             (fread(r.data.data(), 1, r.data.size(), f) == r.data.size());
+        if(ok) records.push_back(r);
+    }
+    fclose(f);
+    return ok;
+}
+
+//----------//
+// Playback //
+//----------//
+int
+SerialReplay::serial_write(const unsigned char *output_buffer,
+                           const int &number_of_bytes)
+{
+    for(size_t i = next; i < records.size(); ++i)
+    {
+        const record &r = records[i];
+        if((r.kind == 'W') && (r.data.size() == size_t(number_of_bytes)) &&
+           (memcmp(r.data.data(), output_buffer, r.data.size()) == 0))
+        {
+            skips += i - next;
+            next = i + 1;
+            offset = 0;
+            pace(r);
+            return number_of_bytes;
+        }
+    }
+    // Stay in step with the trace by taking the place of the next write
+    ++mismatches;
+    offset = 0;
+    while((next < records.size()) && (records[next].kind != 'W')) ++next;
+    if(next < records.size()) ++next;
+    return number_of_bytes;
+}
+
+int
+SerialReplay::serial_read(unsigned char *input_buffer,
+                          const int &number_of_bytes, const int)
+{
+    // Replies may have been recorded in smaller or larger pieces than they
+    // are now asked for, so carry on from where the last read stopped
+    size_t n = 0;
+    while((n < size_t(number_of_bytes)) && (next < records.size()) &&
+          (records[next].kind == 'R'))
+    {
+        const record &r = records[next];
+        // An empty record is a read that timed out, and ends this one
+        if(r.data.empty())
+        {
+            if(n == 0)
+            {
+                ++next;
+                pace(r);
+            }
+            break;
+        }
+        if(offset == 0) pace(r);
+        size_t count = std::min(r.data.size() - offset,
+                                size_t(number_of_bytes) - n);
+        memcpy(input_buffer + n, r.data.data() + offset, count);
+        n += count;
+        offset += count;
+        if(offset == r.data.size())
+        {
+            ++next;
+            offset = 0;
+        }
+    }
+    return int(n);
+}
+
+void
+SerialReplay::pace(const record &r)
+{
+    if(paced) usleep(r.duration);
+}
+
+//---------------//
+// Configuration //
+//---------------//
+int
+SerialReplay::update_parity(const parity_choices &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_baud_rate(const int &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_data_bits(const int &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_stop_bits(const int &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_hardware_flow_control(const int &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_software_flow_control(const int &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_input_mode(const input_choices &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_exclusive(const int &)
+{
+    return 0;
+}
+
+int
+SerialReplay::update_nonblocking(const int &)
+{
+    return -1;
+}
+
+bool
+SerialReplay::serial_is_open()
+{
+    return loaded;
+}
+
+int
+SerialReplay::serial_flush_input()
+{
+    return 0;
+}
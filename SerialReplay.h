@@ -0,0 +1,155 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef SERIALREPLAY_H
+#define SERIALREPLAY_H
+
+#include "Serial.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+/**
+ * A stand-in for a serial port that plays back a trace recorded with
+ * Serial::set_trace(), so that a session can be rerun against library
+ * changes without the hardware.
+ *
+ * A trace file starts with the five bytes "VTRC" and a format version
+ * (1), followed by one record per write or read call:
+ *
+ * <pre>
+ *   kind(1) start(4) duration(4) requested(2) length(2) data(length)
+ * </pre>
+ *
+ * \c kind is 'W' or 'R'. \c start is the time the call began, in
+ * microseconds after the previous record began (or after recording
+ * started). \c duration is how long the call took in microseconds; for a
+ * write this includes draining the output, for a read it is the wait for
+ * the reply. \c requested is the byte count asked for and \c length the
+ * count actually transferred. Multi-byte values are big-endian.
+ *
+ * Each write is matched against the next recorded write with the same
+ * bytes. Recorded exchanges passed over to find it are counted as skipped,
+ * which is what a change that drops a redundant query looks like; a write
+ * with no match is counted as a mismatch. Each read returns bytes from
+ * the read records that follow, carrying on from where the last read
+ * stopped and across consecutive read records until it is satisfied; it
+ * returns nothing if the next record is a write.
+ **/
+class SerialReplay : public Serial
+{
+public:
+    /**
+     * One recorded call.
+     **/
+    struct record
+    {
+        char kind;
+        uint32_t start;
+        uint32_t duration;
+        uint16_t requested;
+        std::vector<uint8_t> data;
+    };
+
+    /**
+     * Load a trace; check is_open() afterwards.
+     * @param[in] path The trace file.
+     * @param[in] paced If true, each call takes as long as it did when it
+     *                  was recorded.
+     **/
+    explicit SerialReplay(const char *path, bool paced = false);
+
+    /**
+     * Read a whole trace file.
+     * @param[in] path The trace file.
+     * @param[out] records Receives the records.
+     * @return False if the file cannot be read or is not a trace.
+     **/
+    static bool load(const char *path, std::vector<record> &records);
+
+    /**
+     * Recorded calls passed over to match a write.
+     **/
+    size_t skipped() const;
+
+    /**
+     * Writes that matched no recorded write.
+     **/
+    size_t mismatched() const;
+
+    /**
+     * Recorded calls not yet played back.
+     **/
+    size_t remaining() const;
+
+private:
+    virtual int serial_write(const unsigned char *output_buffer,
+                             const int &number_of_bytes);
+    virtual int serial_read(unsigned char *input_buffer,
+                            const int &number_of_bytes,
+                            const int timeout_usec);
+    virtual int update_parity(const parity_choices &);
+    virtual int update_baud_rate(const int &);
+    virtual int update_data_bits(const int &);
+    virtual int update_stop_bits(const int &);
+    virtual int update_hardware_flow_control(const int &);
+    virtual int update_software_flow_control(const int &);
+    virtual int update_input_mode(const input_choices &);
+    virtual int update_exclusive(const int &);
+    virtual int update_nonblocking(const int &);
+    virtual bool serial_is_open();
+    virtual int serial_flush_input();
+
+    void pace(const record &r);
+
+    std::vector<record> records;
+    size_t next;
+    size_t offset;  // Bytes of records[next] already read
+    bool loaded;
+    bool paced;
+    size_t skips;
+    size_t mismatches;
+};
+
+inline size_t
+SerialReplay::skipped() const
+{
+    return skips;
+}
+
+inline size_t
+SerialReplay::mismatched() const
+{
+    return mismatches;
+}
+
+inline size_t
+SerialReplay::remaining() const
+{
+    return records.size() - next;
+}
+
+#endif//SERIALREPLAY_H
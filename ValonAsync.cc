@@ -0,0 +1,535 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "ValonAsync.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace ValonAsync
+{
+
+//------//
+// Loop //
+//------//
+void
+loop::wait::await_suspend(std::coroutine_handle<> h)
+{
+    waiter entry = { this, h };
+    owner.waiting.push_back(entry);
+}
+
+void
+loop::spawn(task<void> t)
+{
+    std::coroutine_handle<> h = t.h;
+    tasks.push_back(std::move(t));
+    h.resume();
+}
+
+void
+loop::post(std::coroutine_handle<> h)
+{
+    ready.push_back(h);
+}
+
+loop::wait
+loop::readable(int fd, int64_t deadline)
+{
+    wait w = { *this, fd, POLLIN, deadline, false };
+    return w;
+}
+
+loop::wait
+loop::writable(int fd, int64_t deadline)
+{
+    wait w = { *this, fd, POLLOUT, deadline, false };
+    return w;
+}
+
+loop::wait
+loop::sleep(int usec)
+{
+    wait w = { *this, -1, 0, now() + int64_t(usec) * 1000, false };
+    return w;
+}
+
+int64_t
+loop::now()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+void
+loop::run()
+{
+    std::vector<pollfd> fds;
+    std::vector<waiter> due;
+    for(;;)
+    {
+        while(!ready.empty())
+        {
+            std::coroutine_handle<> h = ready.front();
+            ready.pop_front();
+            h.resume();
+        }
+        tasks.erase(std::remove_if(tasks.begin(), tasks.end(),
+                                   [](const task<void> &t)
+                                   { return t.h.done(); }),
+                    tasks.end());
+        if(tasks.empty() || waiting.empty()) return;
+
+        // Sleep until the first descriptor is ready or deadline passes
+        int64_t first = waiting[0].w->deadline;
+        fds.clear();
+        for(size_t i = 0; i < waiting.size(); ++i)
+        {
+            const wait &w = *waiting[i].w;
+            first = std::min(first, w.deadline);
+            pollfd p = { w.fd, w.events, 0 };
+            fds.push_back(p);
+        }
+        int64_t remaining = first - now();
+        int timeout_ms = (remaining <= 0) ? 0 : int((remaining + 999999) / 1000000);
+        if((poll(fds.data(), fds.size(), timeout_ms) < 0) && (errno != EINTR))
+        {
+            return;
+        }
+
+        // Take everything that is due off the list before resuming any of
+        // it, since resumed coroutines add new waiters
+        int64_t t = now();
+        due.clear();
+        size_t kept = 0;
+        for(size_t i = 0; i < waiting.size(); ++i)
+        {
+            wait &w = *waiting[i].w;
+            w.ready = (w.fd >= 0) && (fds[i].revents != 0);
+            if(w.ready || (w.deadline <= t)) due.push_back(waiting[i]);
+            else waiting[kept++] = waiting[i];
+        }
+        waiting.resize(kept);
+        for(size_t i = 0; i < due.size(); ++i)
+        {
+            due[i].h.resume();
+        }
+    }
+}
+
+//-------------//
+// Synthesizer //
+//-------------//
+synthesizer::synthesizer(loop &lp, const char *port)
+    :
+    l(lp),
+    s(port),
+    timeout(200000),
+    retries(2),
+    busy(false)
+{
+    if(s.is_open()) s.set_nonblocking(1);
+}
+
+bool
+synthesizer::exclusive::await_ready()
+{
+    if(owner.busy) return false;
+    owner.busy = true;
+    return true;
+}
+
+void
+synthesizer::exclusive::await_suspend(std::coroutine_handle<> h)
+{
+    owner.queued.push_back(h);
+}
+
+void
+synthesizer::release()
+{
+    // Hand the port straight to the next exchange in line
+    if(queued.empty())
+    {
+        busy = false;
+        return;
+    }
+    l.post(queued.front());
+    queued.pop_front();
+}
+
+task<bool>
+synthesizer::exchange(const uint8_t *request, size_t request_size,
+                      uint8_t *reply, size_t reply_size, acceptor accept)
+{
+    co_await exclusive{*this};
+
+    // Discard anything left over from an earlier exchange
+    drain();
+
+    bool ok = false;
+    for(int i = 0; ; ++i)
+    {
+        ok = (co_await attempt(request, request_size, reply, reply_size) &&
+              accept(reply));
+        if(ok || (i >= retries) || !co_await resync()) break;
+    }
+    release();
+    co_return ok;
+}
+
+task<bool>
+synthesizer::attempt(const uint8_t *request, size_t request_size,
+                     uint8_t *reply, size_t reply_size)
+{
+    int fd = s.descriptor();
+    int64_t deadline = loop::now() + int64_t(timeout) * 1000;
+    bool ok = true;
+    size_t done = 0;
+    while(ok && (done < request_size))
+    {
+        ssize_t n = ::write(fd, &request[done], request_size - done);
+        if(n > 0) done += n;
+        else if((n < 0) && (errno != EAGAIN) && (errno != EINTR)) ok = false;
+        else if(loop::now() >= deadline) ok = false;
+        else ok = co_await l.writable(fd, deadline);
+    }
+
+    // The reply timeout runs from the end of the request
+    deadline = loop::now() + int64_t(timeout) * 1000;
+    done = 0;
+    while(ok && (done < reply_size))
+    {
+        ssize_t n = ::read(fd, &reply[done], reply_size - done);
+        if(n > 0) done += n;
+        else if((n < 0) && (errno != EAGAIN) && (errno != EINTR)) ok = false;
+        else if(loop::now() >= deadline) ok = false;
+        else ok = co_await l.readable(fd, deadline);
+    }
+    co_return ok;
+}
+
+task<bool>
+synthesizer::resync()
+{
+    typedef ValonFrame::read_reference ref;
+    int fd = s.descriptor();
+    for(int i = 0; i < RESYNC_ATTEMPTS; ++i)
+    {
+        // Let the rest of any late or overlong reply arrive, then discard
+        // it along with anything else waiting
+        while(co_await l.readable(fd, loop::now() +
+                                      int64_t(RESYNC_QUIET_USEC) * 1000) &&
+              drain())
+        {
+        }
+        s.flush_input();
+
+        // A reference read has a known length and a checksum that spans
+        // several bytes, so a good one shows the replies are in step
+        ref::request_frame request = ref::request();
+        ref::reply_frame reply;
+        if(co_await attempt(request.data(), request.size(),
+                            reply.data(), reply.size()) &&
+           ref::verify(reply))
+        {
+            co_return true;
+        }
+    }
+    co_return false;
+}
+
+bool
+synthesizer::drain()
+{
+    uint8_t stale[64];
+    bool any = false;
+    while(::read(s.descriptor(), stale, sizeof(stale)) > 0) any = true;
+    return any;
+}
+
+template<class Query>
+task<bool>
+synthesizer::query(typename Query::reply_frame &reply, uint8_t synth)
+{
+    typename Query::request_frame request = Query::request(synth);
+    co_return co_await exchange(request.data(), request.size(),
+                                reply.data(), reply.size(),
+                                [](const uint8_t *bytes)
+                                {
+                                    typename Query::reply_frame r;
+                                    memcpy(r.data(), bytes, r.size());
+                                    return Query::verify(r);
+                                });
+}
+
+template<class Command>
+task<bool>
+synthesizer::command(const typename Command::payload &data, uint8_t synth)
+{
+    typename Command::frame frame = Command::encode(data, synth);
+    uint8_t reply = ValonFrame::NACK;
+    co_return co_await exchange(frame.data(), frame.size(), &reply, 1,
+                                [](const uint8_t *bytes)
+                                {
+                                    return bytes[0] == ValonFrame::ACK;
+                                });
+}
+
+task<bool>
+synthesizer::read_registers(ValonSynth::Synthesizer synth,
+                            ValonFrame::register_image &image)
+{
+    ValonFrame::read_registers::reply_frame reply;
+    if(!co_await query<ValonFrame::read_registers>(reply, synth))
+    {
+        co_return false;
+    }
+    memcpy(image.data(), reply.data(), image.size());
+    co_return true;
+}
+
+//------------------//
+// Output Frequency //
+//------------------//
+task<bool>
+synthesizer::get_frequency(ValonSynth::Synthesizer synth, float &frequency)
+{
+    ValonFrame::register_image image;
+    uint32_t reference;
+    if(!co_await read_registers(synth, image)) co_return false;
+    if(!co_await get_reference(reference)) co_return false;
+    frequency = FrequencyPlanner::to_hz(ValonSynth::image_output(image,
+                                                                 reference))
+                / 1e6;
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_frequency(ValonSynth::Synthesizer synth, float frequency,
+                           float chan_spacing)
+{
+    if((frequency <= 0.0f) || (chan_spacing < 0.0f)) co_return false;
+    FrequencyPlanner::tuning t;
+    co_return co_await set_frequency(synth,
+                                     uint64_t(double(frequency) * 1e6 + 0.5),
+                                     uint32_t(double(chan_spacing) * 1e6 + 0.5),
+                                     t);
+}
+
+task<bool>
+synthesizer::set_frequency(ValonSynth::Synthesizer synth, uint64_t frequency,
+                           uint32_t chan_spacing, FrequencyPlanner::tuning &t)
+{
+    ValonSynth::vco_range vcor;
+    ValonFrame::register_image image;
+    uint32_t reference;
+    if(!co_await get_vco_range(synth, vcor)) co_return false;
+    if(!co_await read_registers(synth, image)) co_return false;
+    if(!co_await get_reference(reference)) co_return false;
+    if(!ValonSynth::image_frequency(image, reference, vcor, frequency,
+                                    chan_spacing, t))
+    {
+        co_return false;
+    }
+    co_return co_await command<ValonFrame::write_registers>(image, synth);
+}
+
+//-----------//
+// Reference //
+//-----------//
+task<bool>
+synthesizer::get_reference(uint32_t &frequency)
+{
+    ValonFrame::read_reference::reply_frame reply;
+    if(!co_await query<ValonFrame::read_reference>(reply)) co_return false;
+    frequency = ValonFrame::get_u32<0>(reply);
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_reference(uint32_t frequency)
+{
+    ValonFrame::write_reference::payload data;
+    ValonFrame::put_u32<0>(data, frequency);
+    co_return co_await command<ValonFrame::write_reference>(data);
+}
+
+//----------//
+// RF Level //
+//----------//
+task<bool>
+synthesizer::get_rf_level(ValonSynth::Synthesizer synth, int32_t &rf_level)
+{
+    static const int32_t levels[4] = { -4, -1, 2, 5 };
+    ValonFrame::register_image image;
+    if(!co_await read_registers(synth, image)) co_return false;
+    rf_level = levels[ValonFrame::rf_level::get(image)];
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_rf_level(ValonSynth::Synthesizer synth, int32_t rf_level)
+{
+    ValonFrame::register_image image;
+    if(!co_await read_registers(synth, image)) co_return false;
+    if(!ValonSynth::image_rf_level(image, rf_level)) co_return false;
+    co_return co_await command<ValonFrame::write_registers>(image, synth);
+}
+
+//---------------------//
+// ValonSynth Options //
+//---------------------//
+task<bool>
+synthesizer::get_options(ValonSynth::Synthesizer synth,
+                         ValonSynth::options &opts)
+{
+    ValonFrame::register_image image;
+    if(!co_await read_registers(synth, image)) co_return false;
+    ValonSynth::unpack_options(image, opts);
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_options(ValonSynth::Synthesizer synth,
+                         const ValonSynth::options &opts)
+{
+    ValonFrame::register_image image;
+    if(!co_await read_registers(synth, image)) co_return false;
+    ValonSynth::image_options(image, opts);
+    co_return co_await command<ValonFrame::write_registers>(image, synth);
+}
+
+//------------------//
+// Reference Select //
+//------------------//
+task<bool>
+synthesizer::get_ref_select(bool &e_not_i)
+{
+    ValonFrame::read_status::reply_frame reply;
+    if(!co_await query<ValonFrame::read_status>(reply)) co_return false;
+    e_not_i = reply[0] & 1;
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_ref_select(bool e_not_i)
+{
+    ValonFrame::write_ref_select::payload data = {{uint8_t(e_not_i & 1)}};
+    co_return co_await command<ValonFrame::write_ref_select>(data);
+}
+
+//-----------//
+// VCO Range //
+//-----------//
+task<bool>
+synthesizer::get_vco_range(ValonSynth::Synthesizer synth,
+                           ValonSynth::vco_range &vcor)
+{
+    ValonFrame::read_vco_range::reply_frame reply;
+    if(!co_await query<ValonFrame::read_vco_range>(reply, synth))
+    {
+        co_return false;
+    }
+    vcor.min = ValonFrame::get_u16<0>(reply);
+    vcor.max = ValonFrame::get_u16<2>(reply);
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_vco_range(ValonSynth::Synthesizer synth,
+                           const ValonSynth::vco_range &vcor)
+{
+    ValonFrame::write_vco_range::payload data;
+    ValonFrame::put_u16<0>(data, vcor.min);
+    ValonFrame::put_u16<2>(data, vcor.max);
+    co_return co_await command<ValonFrame::write_vco_range>(data, synth);
+}
+
+//------------//
+// Phase Lock //
+//------------//
+task<bool>
+synthesizer::get_phase_lock(ValonSynth::Synthesizer synth, bool &locked)
+{
+    ValonFrame::read_status::reply_frame reply;
+    if(!co_await query<ValonFrame::read_status>(reply, synth)) co_return false;
+    locked = reply[0] & ((synth == ValonSynth::A) ? 0x20 : 0x10);
+    co_return true;
+}
+
+task<bool>
+synthesizer::wait_for_lock(ValonSynth::Synthesizer synth, int timeout_usec,
+                           int interval_usec)
+{
+    int64_t deadline = loop::now() + int64_t(timeout_usec) * 1000;
+    for(;;)
+    {
+        bool locked = false;
+        if(co_await get_phase_lock(synth, locked) && locked) co_return true;
+        if(loop::now() + int64_t(interval_usec) * 1000 > deadline)
+        {
+            co_return false;
+        }
+        co_await l.sleep(interval_usec);
+    }
+}
+
+//-------//
+// Label //
+//-------//
+task<bool>
+synthesizer::get_label(ValonSynth::Synthesizer synth, char *label)
+{
+    ValonFrame::read_label::reply_frame reply;
+    if(!co_await query<ValonFrame::read_label>(reply, synth)) co_return false;
+    memcpy(label, reply.data(), ValonFrame::read_label::length);
+    co_return true;
+}
+
+task<bool>
+synthesizer::set_label(ValonSynth::Synthesizer synth, const char *label)
+{
+    ValonFrame::write_label::payload data;
+    memcpy(data.data(), label, data.size());
+    co_return co_await command<ValonFrame::write_label>(data, synth);
+}
+
+//-------//
+// Flash //
+//-------//
+task<bool>
+synthesizer::flash()
+{
+    co_return co_await command<ValonFrame::write_flash>(
+        ValonFrame::write_flash::payload());
+}
+
+} // namespace ValonAsync
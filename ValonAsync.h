@@ -0,0 +1,381 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONASYNC_H
+#define VALONASYNC_H
+
+#include "ValonSynth.h"
+#include "ValonFrame.h"
+#include "Serial.h"
+
+#include <stdint.h>
+
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <utility>
+#include <vector>
+
+/**
+ * \file ValonAsync.h
+ * Coroutine interface to the synthesizer. Requires C++20.
+ *
+ * ValonAsync::synthesizer has awaitable versions of the ValonSynth
+ * operations. Each board's port is non-blocking and is waited on by a
+ * single-threaded ValonAsync::loop, so sequences on many boards run
+ * concurrently from one thread as straight-line code:
+ *
+ * <pre>
+ *   ValonAsync::task<void> retune(ValonAsync::synthesizer &s, float mhz)
+ *   {
+ *       if(!co_await s.set_frequency(ValonSynth::A, mhz)) co_return;
+ *       bool locked = co_await s.wait_for_lock(ValonSynth::A);
+ *       ...
+ *   }
+ *
+ *   ValonAsync::loop l;
+ *   ValonAsync::synthesizer a(l, "/dev/ttyUSB0"), b(l, "/dev/ttyUSB1");
+ *   l.spawn(retune(a, 1420.0f));
+ *   l.spawn(retune(b, 1420.0f));
+ *   l.run();
+ * </pre>
+ *
+ * Exchanges on one synthesizer are serialized; a read-modify-write such as
+ * set_frequency() is not atomic with respect to other operations on the
+ * same object. Nothing here is thread safe; a loop and its synthesizers
+ * belong to the thread that runs the loop.
+ **/
+namespace ValonAsync
+{
+
+template<class T> class task;
+
+namespace detail
+{
+
+// Holds a coroutine's result
+template<class T>
+struct promise_result
+{
+    T value;
+    void return_value(T v) { value = std::move(v); }
+    T result() { return std::move(value); }
+};
+
+template<>
+struct promise_result<void>
+{
+    void return_void() {}
+    void result() {}
+};
+
+// Resumes whoever awaited the coroutine once it finishes
+struct final_awaiter
+{
+    bool await_ready() noexcept { return false; }
+
+    template<class Promise>
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<Promise> h) noexcept
+    {
+        std::coroutine_handle<> next = h.promise().continuation;
+        return next ? next : std::noop_coroutine();
+    }
+
+    void await_resume() noexcept {}
+};
+
+} // namespace detail
+
+/**
+ * A lazily started coroutine returning T. Awaiting a task runs it to
+ * completion and gives its result; a top level task is handed to
+ * loop::spawn(). The library reports failure through results, not
+ * exceptions, and an exception escaping a task terminates the program.
+ **/
+template<class T>
+class task
+{
+public:
+    struct promise_type : detail::promise_result<T>
+    {
+        std::coroutine_handle<> continuation;
+
+        task get_return_object()
+        {
+            return task(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        detail::final_awaiter final_suspend() noexcept { return {}; }
+        void unhandled_exception() { std::terminate(); }
+    };
+
+    task(task &&other) noexcept : h(other.h) { other.h = nullptr; }
+    task &operator=(task &&other) noexcept
+    {
+        std::swap(h, other.h);
+        return *this;
+    }
+    ~task() { if(h) h.destroy(); }
+
+    bool await_ready() const { return false; }
+
+    std::coroutine_handle<>
+    await_suspend(std::coroutine_handle<> awaiting)
+    {
+        h.promise().continuation = awaiting;
+        return h;
+    }
+
+    T await_resume() { return h.promise().result(); }
+
+private:
+    explicit task(std::coroutine_handle<promise_type> handle) : h(handle) {}
+    task(const task &);
+    task &operator=(const task &);
+
+    std::coroutine_handle<promise_type> h;
+
+    friend class loop;
+};
+
+/**
+ * A single-threaded executor. Coroutines suspend on descriptor readiness
+ * or timers, and run() waits for all of them with poll().
+ **/
+class loop
+{
+public:
+    /**
+     * An awaitable that resumes once a descriptor is ready or a deadline
+     * passes, giving true if the descriptor became ready.
+     **/
+    struct wait
+    {
+        loop &owner;
+        int fd;
+        short events;
+        int64_t deadline;
+        bool ready;
+
+        bool await_ready() const { return false; }
+        void await_suspend(std::coroutine_handle<> h);
+        bool await_resume() const { return ready; }
+    };
+
+    loop() {}
+
+    /**
+     * Start a top level task. It runs until its first suspension before
+     * spawn() returns, and is destroyed once it finishes.
+     **/
+    void spawn(task<void> t);
+
+    /**
+     * Run until every spawned task has finished.
+     **/
+    void run();
+
+    /**
+     * Await readiness of a descriptor for reading.
+     * @param[in] fd The descriptor.
+     * @param[in] deadline Give up at this time, as returned by now().
+     **/
+    wait readable(int fd, int64_t deadline);
+
+    /**
+     * Await readiness of a descriptor for writing.
+     **/
+    wait writable(int fd, int64_t deadline);
+
+    /**
+     * Await the passing of a time interval.
+     * @param[in] usec The interval in microseconds.
+     **/
+    wait sleep(int usec);
+
+    /**
+     * Queue a suspended coroutine to be resumed by run().
+     **/
+    void post(std::coroutine_handle<> h);
+
+    /**
+     * CLOCK_MONOTONIC in nanoseconds.
+     **/
+    static int64_t now();
+
+private:
+    loop(const loop &);
+    loop &operator=(const loop &);
+
+    struct waiter
+    {
+        wait *w;
+        std::coroutine_handle<> h;
+    };
+
+    std::vector<waiter> waiting;
+    std::deque<std::coroutine_handle<> > ready;
+    std::vector<task<void> > tasks;
+};
+
+/**
+ * Awaitable access to one board. Operations mirror those of ValonSynth and
+ * report success the same way; outputs are written through reference
+ * arguments, which must outlive the awaited call. Nothing is cached, and
+ * failed exchanges are retried as ValonSynth retries them.
+ **/
+class synthesizer
+{
+public:
+    /**
+     * Open and configure a port; check is_open() afterwards.
+     * @param[in] l The loop that will drive this synthesizer.
+     * @param[in] port The serial port device node.
+     **/
+    synthesizer(loop &l, const char *port);
+
+    bool is_open();
+
+    /**
+     * Set how long to wait for each reply.
+     **/
+    void set_timeout(int timeout_usec);
+
+    /**
+     * Set how many times a failed exchange is retried, bringing the link
+     * back into step first as ValonSynth::set_retries() describes. The
+     * default is 2.
+     * @param[in] count Retries after the first attempt; 0 disables them.
+     **/
+    void set_retries(int count);
+
+    /**
+     * \name Awaitable operations
+     * As for the ValonSynth methods of the same name.
+     * \{
+     **/
+    task<bool> get_frequency(ValonSynth::Synthesizer synth, float &frequency);
+    task<bool> set_frequency(ValonSynth::Synthesizer synth, float frequency,
+                             float chan_spacing = 10.0f);
+    task<bool> set_frequency(ValonSynth::Synthesizer synth,
+                             uint64_t frequency, uint32_t chan_spacing,
+                             FrequencyPlanner::tuning &t);
+    task<bool> get_reference(uint32_t &frequency);
+    task<bool> set_reference(uint32_t frequency);
+    task<bool> get_rf_level(ValonSynth::Synthesizer synth, int32_t &rf_level);
+    task<bool> set_rf_level(ValonSynth::Synthesizer synth, int32_t rf_level);
+    task<bool> get_options(ValonSynth::Synthesizer synth,
+                           ValonSynth::options &opts);
+    task<bool> set_options(ValonSynth::Synthesizer synth,
+                           const ValonSynth::options &opts);
+    task<bool> get_ref_select(bool &e_not_i);
+    task<bool> set_ref_select(bool e_not_i);
+    task<bool> get_vco_range(ValonSynth::Synthesizer synth,
+                             ValonSynth::vco_range &vcor);
+    task<bool> set_vco_range(ValonSynth::Synthesizer synth,
+                             const ValonSynth::vco_range &vcor);
+    task<bool> get_phase_lock(ValonSynth::Synthesizer synth, bool &locked);
+    task<bool> get_label(ValonSynth::Synthesizer synth, char *label);
+    task<bool> set_label(ValonSynth::Synthesizer synth, const char *label);
+    task<bool> flash();
+
+    /**
+     * Poll the phase lock status until the synthesizer locks.
+     * @param[in] synth The synthesizer to watch.
+     * @param[in] timeout_usec How long to wait for lock.
+     * @param[in] interval_usec Time between polls.
+     * @return True if locked within the timeout.
+     **/
+    task<bool> wait_for_lock(ValonSynth::Synthesizer synth,
+                             int timeout_usec = 1000000,
+                             int interval_usec = 10000);
+    /**
+     * \}
+     **/
+
+private:
+    synthesizer(const synthesizer &);
+    synthesizer &operator=(const synthesizer &);
+
+    // One exchange at a time on the port
+    struct exclusive
+    {
+        synthesizer &owner;
+        bool await_ready();
+        void await_suspend(std::coroutine_handle<> h);
+        void await_resume() {}
+    };
+    void release();
+
+    // A single query or command frame exchange
+    template<class Query>
+    task<bool> query(typename Query::reply_frame &reply, uint8_t synth = 0);
+    template<class Command>
+    task<bool> command(const typename Command::payload &data,
+                       uint8_t synth = 0);
+
+    // Sends request and reads reply_size bytes into reply until accept
+    // takes the reply or the retries run out
+    typedef bool (*acceptor)(const uint8_t *reply);
+    task<bool> exchange(const uint8_t *request, size_t request_size,
+                        uint8_t *reply, size_t reply_size, acceptor accept);
+    task<bool> attempt(const uint8_t *request, size_t request_size,
+                       uint8_t *reply, size_t reply_size);
+    task<bool> resync();
+    bool drain();
+    enum { RESYNC_ATTEMPTS = 3, RESYNC_QUIET_USEC = 5000 };
+
+    task<bool> read_registers(ValonSynth::Synthesizer synth,
+                              ValonFrame::register_image &image);
+
+    loop &l;
+    Serial s;
+    int timeout;
+    int retries;
+    bool busy;
+    std::deque<std::coroutine_handle<> > queued;
+};
+
+inline bool
+synthesizer::is_open()
+{
+    return s.is_open();
+}
+
+inline void
+synthesizer::set_timeout(int timeout_usec)
+{
+    timeout = timeout_usec;
+}
+
+inline void
+synthesizer::set_retries(int count)
+{
+    retries = count;
+}
+
+} // namespace ValonAsync
+
+#endif//VALONASYNC_H
@@ -0,0 +1,161 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "ValonDiscovery.h"
+#include "ValonProfile.h"
+
+#include <glob.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <fstream>
+#include <thread>
+
+std::vector<std::string>
+ValonDiscovery::candidates(const char *pattern)
+{
+    std::vector<std::string> ports;
+    glob_t g;
+    if(glob(pattern, 0, NULL, &g) == 0)
+    {
+        ports.assign(g.gl_pathv, g.gl_pathv + g.gl_pathc);
+    }
+    globfree(&g);
+    std::sort(ports.begin(), ports.end());
+    return ports;
+}
+
+bool
+ValonDiscovery::probe(const std::string &port, device &d)
+{
+    ValonSynth vs(port.c_str());
+    ValonSynth::identity id;
+    if(!vs.is_open() || !vs.identify(id)) return false;
+    d.port = port;
+    d.label[0] = ValonProfile::trim_label(id.label[0]);
+    d.label[1] = ValonProfile::trim_label(id.label[1]);
+    d.reference = id.reference;
+    return true;
+}
+
+size_t
+ValonDiscovery::scan(const std::vector<std::string> &ports)
+{
+    std::vector<device> devices(ports.size());
+    // vector<bool> packs bits, which threads cannot write independently
+    std::vector<char> ok(ports.size(), 0);
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i < ports.size(); ++i)
+    {
+        workers.push_back(std::thread([&ports, &devices, &ok, i]()
+        {
+            ok[i] = probe(ports[i], devices[i]);
+        }));
+    }
+    found.clear();
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+        if(ok[i]) found.push_back(devices[i]);
+    }
+    return found.size();
+}
+
+bool
+ValonDiscovery::find(const std::string &label, std::string &port)
+{
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        device &d = found[i];
+        if((d.label[0] != label) && (d.label[1] != label)) continue;
+        device now;
+        if(probe(d.port, now) &&
+           ((now.label[0] == label) || (now.label[1] == label)))
+        {
+            d = now;
+            port = d.port;
+            return true;
+        }
+        break;
+    }
+    scan(candidates());
+    std::map<std::string, std::string> map = labels();
+    std::map<std::string, std::string>::const_iterator it = map.find(label);
+    if(it == map.end()) return false;
+    port = it->second;
+    return true;
+}
+
+std::map<std::string, std::string>
+ValonDiscovery::labels() const
+{
+    std::map<std::string, std::string> map;
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        for(int k = 0; k < 2; ++k)
+        {
+            if(!found[i].label[k].empty())
+            {
+                map.insert(std::make_pair(found[i].label[k], found[i].port));
+            }
+        }
+    }
+    return map;
+}
+
+bool
+ValonDiscovery::save(const char *path) const
+{
+    std::ofstream out(path);
+    for(size_t i = 0; i < found.size(); ++i)
+    {
+        out << found[i].port << '\t' << found[i].label[0] << '\t'
+            << found[i].label[1] << '\t' << found[i].reference << '\n';
+    }
+    return bool(out);
+}
+
+bool
+ValonDiscovery::load(const char *path)
+{
+    std::ifstream in(path);
+    if(!in) return false;
+    std::vector<device> devices;
+    std::string line;
+    while(std::getline(in, line))
+    {
+        device d;
+        size_t a = line.find('\t');
+        size_t b = (a == std::string::npos) ? a : line.find('\t', a + 1);
+        size_t c = (b == std::string::npos) ? b : line.find('\t', b + 1);
+        if(c == std::string::npos) return false;
+        d.port = line.substr(0, a);
+        d.label[0] = line.substr(a + 1, b - a - 1);
+        d.label[1] = line.substr(b + 1, c - b - 1);
+        d.reference = strtoul(line.c_str() + c + 1, NULL, 10);
+        devices.push_back(d);
+    }
+    found = devices;
+    return true;
+}
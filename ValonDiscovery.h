@@ -0,0 +1,111 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONDISCOVERY_H
+#define VALONDISCOVERY_H
+
+#include "ValonSynth.h"
+
+#include <map>
+#include <string>
+#include <vector>
+
+/**
+ * Finds Valon 5007 boards by label, whichever serial port they are on.
+ *
+ * Every candidate port is opened and identified at once, one thread per
+ * port, with ValonSynth::identify(), so a scan takes about one serial
+ * turnaround however many ports there are. The results are kept and can
+ * be saved to a file; later lookups confirm the remembered port with one
+ * identify() and only scan again when the board has moved.
+ **/
+class ValonDiscovery
+{
+public:
+    /**
+     * A board found on a port.
+     **/
+    struct device
+    {
+        std::string port;
+        std::string label[2];
+        uint32_t reference;
+    };
+
+    /**
+     * List the serial ports that may have a synthesizer attached.
+     * @param[in] pattern A glob(3) pattern for the device nodes.
+     * @return The matching paths, sorted.
+     **/
+    static std::vector<std::string>
+    candidates(const char *pattern = "/dev/ttyUSB*");
+
+    /**
+     * Identify the boards on the given ports in parallel, replacing the
+     * previous results.
+     * @param[in] ports The ports to try.
+     * @return The number of boards found.
+     **/
+    size_t scan(const std::vector<std::string> &ports);
+
+    /**
+     * The port a board is on, matching the label of either synthesizer.
+     * The remembered port is confirmed first; if the board is no longer
+     * there, the candidate ports are scanned again.
+     * @param[in] label The label, without trailing blanks.
+     * @param[out] port Receives the port.
+     * @return True if the board was found.
+     **/
+    bool find(const std::string &label, std::string &port);
+
+    /**
+     * @return The boards found by the last scan.
+     **/
+    const std::vector<device> &devices() const;
+
+    /**
+     * @return A map from each label to the port its board is on.
+     **/
+    std::map<std::string, std::string> labels() const;
+
+    /**
+     * Save or load the results, one tab separated line per board.
+     * @return True on success.
+     **/
+    bool save(const char *path) const;
+    bool load(const char *path);
+
+private:
+    static bool probe(const std::string &port, device &d);
+
+    std::vector<device> found;
+};
+
+inline const std::vector<ValonDiscovery::device> &
+ValonDiscovery::devices() const
+{
+    return found;
+}
+
+#endif//VALONDISCOVERY_H
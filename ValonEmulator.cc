@@ -0,0 +1,441 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "ValonEmulator.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sstream>
+
+// Ten bits per byte at 9600 baud
+static const int64_t BYTE_USEC = 1042;
+
+static int64_t
+now_usec()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec) * 1000000 + t.tv_nsec / 1000;
+}
+
+static void
+sleep_until(int64_t usec)
+{
+    int64_t wait = usec - now_usec();
+    if(wait > 0) usleep(useconds_t(wait));
+}
+
+// Payload length of each command, by opcode with the synthesizer bit clear
+static int
+command_length(uint8_t opcode)
+{
+    switch(opcode)
+    {
+    case 0x00: return ValonFrame::write_registers::length;
+    case 0x01: return ValonFrame::write_reference::length;
+    case 0x02: return ValonFrame::write_label::length;
+    case 0x03: return ValonFrame::write_vco_range::length;
+    case 0x06: return ValonFrame::write_ref_select::length;
+    case 0x40: return ValonFrame::write_flash::length;
+    default:   return -1;
+    }
+}
+
+static uint8_t
+checksum(const uint8_t *data, size_t length)
+{
+    uint8_t sum = 0;
+    for(size_t i = 0; i < length; ++i) sum += data[i];
+    return sum;
+}
+
+//--------//
+// Faults //
+//--------//
+ValonEmulator::faults::faults()
+    :
+    drop(0.0),
+    corrupt(0.0),
+    nack(0.0),
+    delay(0.0),
+    delay_usec(0),
+    stray(0.0),
+    vanish(0.0)
+{
+}
+
+bool
+ValonEmulator::faults::parse(const std::string &spec)
+{
+    std::istringstream items(spec);
+    std::string item;
+    while(std::getline(items, item, ','))
+    {
+        size_t eq = item.find('=');
+        if(eq == std::string::npos) return false;
+        std::string key = item.substr(0, eq);
+        const char *value = item.c_str() + eq + 1;
+        char *end;
+        double p = strtod(value, &end);
+        if((end == value) || (p < 0.0) || (p > 1.0)) return false;
+        if((key == "delay") && (*end == ':'))
+        {
+            value = end + 1;
+            delay_usec = uint32_t(strtoul(value, &end, 10));
+            if(end == value) return false;
+        }
+        if(*end != '\0') return false;
+        if(key == "drop") drop = p;
+        else if(key == "corrupt") corrupt = p;
+        else if(key == "nack") nack = p;
+        else if(key == "delay") delay = p;
+        else if(key == "stray") stray = p;
+        else if(key == "vanish") vanish = p;
+        else return false;
+    }
+    return true;
+}
+
+//-------//
+// Board //
+//-------//
+ValonEmulator::ValonEmulator(uint32_t seed)
+    :
+    reference(10000000),
+    e_not_i(false),
+    lock_time(0),
+    wire_time(true),
+    gone(false),
+    rng(seed)
+{
+    for(int i = 0; i < 2; ++i)
+    {
+        // 800 MHz, +5 dBm, R = 1
+        regs[i].fill(0);
+        ValonFrame::ncount::set(regs[i], 80);
+        ValonFrame::mod::set(regs[i], 1);
+        ValonFrame::r::set(regs[i], 1);
+        ValonFrame::rf_level::set(regs[i], 3);
+        vco_min[i] = 2200;
+        vco_max[i] = 4400;
+        memset(label[i], ' ', sizeof(label[i]));
+        memcpy(label[i], i ? "Synth B" : "Synth A", 7);
+        unlocked_until[i] = 0;
+        stuck[i] = false;
+    }
+    memset(&count, 0, sizeof(count));
+}
+
+void
+ValonEmulator::lose_lock(uint8_t synth, bool stays)
+{
+    int i = (synth & 0x08) ? 1 : 0;
+    unlocked_until[i] = INT64_MAX;
+    stuck[i] = stays;
+}
+
+void
+ValonEmulator::reconnect()
+{
+    gone = false;
+    pending.clear();
+    input.clear();
+}
+
+bool
+ValonEmulator::chance(double p)
+{
+    return (p > 0.0) && (std::uniform_real_distribution<double>()(rng) < p);
+}
+
+void
+ValonEmulator::frame(const std::vector<uint8_t> &request)
+{
+    uint8_t opcode = request[0];
+    int synth = (opcode & 0x08) ? 1 : 0;
+    std::vector<uint8_t> bytes;
+    if(opcode & 0x80)
+    {
+        switch(opcode & ~0x08)
+        {
+        case 0x80:
+            bytes.assign(regs[synth].begin(), regs[synth].end());
+            break;
+        case 0x81:
+        {
+            ValonFrame::read_reference::reply_frame r = {};
+            ValonFrame::put_u32<0>(r, reference);
+            bytes.assign(r.begin(), r.end() - 1);
+            break;
+        }
+        case 0x82:
+            bytes.assign(label[synth], label[synth] + 16);
+            break;
+        case 0x83:
+        {
+            ValonFrame::read_vco_range::reply_frame r = {};
+            ValonFrame::put_u16<0>(r, vco_min[synth]);
+            ValonFrame::put_u16<2>(r, vco_max[synth]);
+            bytes.assign(r.begin(), r.end() - 1);
+            break;
+        }
+        case 0x86:
+        {
+            int64_t t = now_usec();
+            bytes.push_back((t >= unlocked_until[0] ? 0x20 : 0) |
+                            (t >= unlocked_until[1] ? 0x10 : 0) |
+                            (e_not_i ? 1 : 0));
+            break;
+        }
+        default:
+            reply(opcode, std::vector<uint8_t>(1, ValonFrame::NACK), true);
+            return;
+        }
+        bytes.push_back(checksum(bytes.data(), bytes.size()));
+        reply(opcode, bytes, false);
+        return;
+    }
+
+    // Commands are refused if their checksum is wrong
+    const uint8_t *data = &request[1];
+    if(request.back() != checksum(request.data(), request.size() - 1))
+    {
+        reply(opcode, std::vector<uint8_t>(1, ValonFrame::NACK), true);
+        return;
+    }
+    switch(opcode & ~0x08)
+    {
+    case 0x00:
+        memcpy(regs[synth].data(), data, regs[synth].size());
+        if(!stuck[synth]) unlocked_until[synth] = now_usec() + lock_time;
+        break;
+    case 0x01:
+    {
+        ValonFrame::write_reference::payload p;
+        memcpy(p.data(), data, p.size());
+        reference = ValonFrame::get_u32<0>(p);
+        break;
+    }
+    case 0x02:
+        memcpy(label[synth], data, 16);
+        break;
+    case 0x03:
+    {
+        ValonFrame::write_vco_range::payload p;
+        memcpy(p.data(), data, p.size());
+        vco_min[synth] = ValonFrame::get_u16<0>(p);
+        vco_max[synth] = ValonFrame::get_u16<2>(p);
+        break;
+    }
+    case 0x06:
+        e_not_i = data[0] & 1;
+        break;
+    }
+    reply(opcode, std::vector<uint8_t>(1, ValonFrame::ACK), true);
+}
+
+void
+ValonEmulator::reply(uint8_t opcode, std::vector<uint8_t> bytes, bool command)
+{
+    std::map<uint8_t, faults>::const_iterator it =
+        by_opcode.find(opcode & ~0x08);
+    const faults &f = (it == by_opcode.end()) ? all : it->second;
+    std::uniform_int_distribution<int> any_byte(0, 255);
+    ++count.frames;
+
+    if(command && chance(f.nack))
+    {
+        bytes[0] = ValonFrame::NACK;
+        ++count.nacks;
+    }
+    if(chance(f.corrupt))
+    {
+        // Anything but the byte that was meant
+        bytes.back() ^= uint8_t(1 + any_byte(rng) % 255);
+        ++count.corrupts;
+    }
+    if(!bytes.empty() && chance(f.drop))
+    {
+        std::uniform_int_distribution<size_t> at(0, bytes.size() - 1);
+        bytes.erase(bytes.begin() + at(rng));
+        ++count.drops;
+    }
+    if(chance(f.stray))
+    {
+        int n = std::uniform_int_distribution<int>(1, 3)(rng);
+        for(int i = 0; i < n; ++i)
+        {
+            bytes.insert(bytes.begin(), uint8_t(any_byte(rng)));
+        }
+        ++count.strays;
+    }
+    if(chance(f.vanish))
+    {
+        std::uniform_int_distribution<size_t> kept(0, bytes.size());
+        bytes.resize(kept(rng));
+        gone = true;
+        ++count.vanishes;
+    }
+
+    // Replies follow whatever is still on its way
+    int64_t t = now_usec();
+    if(!input.empty() && (input.back().first > t)) t = input.back().first;
+    if(chance(f.delay))
+    {
+        t += f.delay_usec;
+        ++count.delays;
+    }
+    for(size_t i = 0; i < bytes.size(); ++i)
+    {
+        if(wire_time) t += BYTE_USEC;
+        input.push_back(std::make_pair(t, bytes[i]));
+    }
+}
+
+//------//
+// Link //
+//------//
+int
+ValonEmulator::serial_write(const unsigned char *output_buffer,
+                            const int &number_of_bytes)
+{
+    if(gone) return -1;
+    if(wire_time) usleep(useconds_t(number_of_bytes * BYTE_USEC));
+    pending.insert(pending.end(), output_buffer,
+                   output_buffer + number_of_bytes);
+    while(!pending.empty() && !gone)
+    {
+        size_t size = 1;
+        if(!(pending[0] & 0x80))
+        {
+            int length = command_length(pending[0] & ~0x08);
+            size = (length < 0) ? 1 : size_t(length) + 2;
+        }
+        if(pending.size() < size) break;
+        frame(std::vector<uint8_t>(pending.begin(), pending.begin() + size));
+        pending.erase(pending.begin(), pending.begin() + size);
+    }
+    return number_of_bytes;
+}
+
+int
+ValonEmulator::serial_read(unsigned char *input_buffer,
+                           const int &number_of_bytes,
+                           const int timeout_usec)
+{
+    // As with a real port, the timeout runs from the last byte received
+    int64_t deadline = now_usec() + timeout_usec;
+    int received = 0;
+    while(received < number_of_bytes)
+    {
+        int64_t t = now_usec();
+        if(!input.empty() && (input.front().first <= t))
+        {
+            input_buffer[received++] = input.front().second;
+            input.pop_front();
+            deadline = t + timeout_usec;
+            continue;
+        }
+        if(gone && input.empty()) return received ? received : -1;
+        if(t >= deadline) break;
+        int64_t next = input.empty() ? deadline : input.front().first;
+        sleep_until(next < deadline ? next : deadline);
+    }
+    return received;
+}
+
+bool
+ValonEmulator::serial_is_open()
+{
+    return !gone;
+}
+
+int
+ValonEmulator::serial_flush_input()
+{
+    // Bytes still on the wire are not affected
+    int64_t t = now_usec();
+    while(!input.empty() && (input.front().first <= t)) input.pop_front();
+    return 0;
+}
+
+//---------------//
+// Configuration //
+//---------------//
+int
+ValonEmulator::update_parity(const parity_choices &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_baud_rate(const int &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_data_bits(const int &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_stop_bits(const int &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_hardware_flow_control(const int &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_software_flow_control(const int &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_input_mode(const input_choices &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_exclusive(const int &)
+{
+    return 0;
+}
+
+int
+ValonEmulator::update_nonblocking(const int &)
+{
+    return -1;
+}
@@ -0,0 +1,233 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONEMULATOR_H
+#define VALONEMULATOR_H
+
+#include "Serial.h"
+#include "ValonFrame.h"
+
+#include <stdint.h>
+
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * An in-process stand-in for a Valon 5007 that can misbehave the way boards
+ * and USB adapters do in the field, for testing how ValonSynth copes and
+ * measuring its tail latency. Pass one to ValonSynth(Serial *).
+ *
+ * The board starts with both synthesizers at 800 MHz from a 10 MHz
+ * reference. Replies take as long as they would on the wire at 9600 baud,
+ * and a read waits in real time for bytes that are late, up to its
+ * timeout. Bytes that arrive after a read gives up stay in the input
+ * buffer, as they would on a real port.
+ *
+ * Faults are drawn independently for each frame from a seeded generator,
+ * with probabilities set for all opcodes or for one opcode (synthesizer
+ * A's opcode covers B as well).
+ **/
+class ValonEmulator : public Serial
+{
+public:
+    /**
+     * Per-frame fault probabilities, each from 0 to 1.
+     **/
+    struct faults
+    {
+        /**
+         * One byte of the reply is lost.
+         **/
+        double drop;
+
+        /**
+         * The reply checksum is wrong, or a command's ACK is garbled.
+         **/
+        double corrupt;
+
+        /**
+         * A command is refused with NACK.
+         **/
+        double nack;
+
+        /**
+         * The reply starts delay_usec late.
+         **/
+        double delay;
+        uint32_t delay_usec;
+
+        /**
+         * One to three stray bytes arrive ahead of the reply.
+         **/
+        double stray;
+
+        /**
+         * The port goes away partway through the reply and stays away
+         * until reconnect().
+         **/
+        double vanish;
+
+        faults();
+
+        /**
+         * Parse "drop=0.01,corrupt=0.001,delay=0.05:300000,...".
+         * @return False if a key or value is not recognized.
+         **/
+        bool parse(const std::string &spec);
+    };
+
+    /**
+     * How many of each fault have been injected.
+     **/
+    struct counters
+    {
+        unsigned frames;
+        unsigned drops;
+        unsigned corrupts;
+        unsigned nacks;
+        unsigned delays;
+        unsigned strays;
+        unsigned vanishes;
+    };
+
+    /**
+     * @param[in] seed Seed for the fault generator, so runs repeat.
+     **/
+    explicit ValonEmulator(uint32_t seed = 1);
+
+    /**
+     * Set the fault probabilities for every opcode without its own.
+     **/
+    void set_faults(const faults &f);
+
+    /**
+     * Set the fault probabilities for one opcode, such as 0x80.
+     **/
+    void set_faults(uint8_t opcode, const faults &f);
+
+    /**
+     * Report a synthesizer as unlocked for this long after each register
+     * write to it.
+     **/
+    void set_lock_time(uint32_t usec);
+
+    /**
+     * Make a synthesizer lose lock, as a reference glitch does, until its
+     * registers are next written.
+     * @param[in] synth 0x00 for A or 0x08 for B.
+     * @param[in] stuck If true it stays unlocked whatever is written.
+     **/
+    void lose_lock(uint8_t synth, bool stuck = false);
+
+    /**
+     * Model the time replies take on the wire. On by default.
+     **/
+    void set_wire_time(bool enable);
+
+    /**
+     * Bring back a port that went away, with an empty input buffer.
+     **/
+    void reconnect();
+
+    const counters &injected() const;
+
+private:
+    virtual int serial_write(const unsigned char *output_buffer,
+                             const int &number_of_bytes);
+    virtual int serial_read(unsigned char *input_buffer,
+                            const int &number_of_bytes,
+                            const int timeout_usec);
+    virtual int update_parity(const parity_choices &);
+    virtual int update_baud_rate(const int &);
+    virtual int update_data_bits(const int &);
+    virtual int update_stop_bits(const int &);
+    virtual int update_hardware_flow_control(const int &);
+    virtual int update_software_flow_control(const int &);
+    virtual int update_input_mode(const input_choices &);
+    virtual int update_exclusive(const int &);
+    virtual int update_nonblocking(const int &);
+    virtual bool serial_is_open();
+    virtual int serial_flush_input();
+
+    // Handles one complete frame and queues the reply
+    void frame(const std::vector<uint8_t> &request);
+    void reply(uint8_t opcode, std::vector<uint8_t> bytes, bool command);
+    bool chance(double p);
+
+    // The board
+    ValonFrame::register_image regs[2];
+    uint32_t reference;
+    uint16_t vco_min[2], vco_max[2];
+    uint8_t label[2][16];
+    bool e_not_i;
+    int64_t unlocked_until[2];
+    uint32_t lock_time;
+    bool stuck[2];
+
+    // The link
+    std::vector<uint8_t> pending;
+    std::deque<std::pair<int64_t, uint8_t> > input;
+    bool wire_time;
+    bool gone;
+
+    faults all;
+    std::map<uint8_t, faults> by_opcode;
+    counters count;
+    std::mt19937 rng;
+};
+
+inline void
+ValonEmulator::set_faults(const faults &f)
+{
+    all = f;
+}
+
+inline void
+ValonEmulator::set_faults(uint8_t opcode, const faults &f)
+{
+    by_opcode[opcode & ~0x08] = f;
+}
+
+inline void
+ValonEmulator::set_lock_time(uint32_t usec)
+{
+    lock_time = usec;
+}
+
+inline void
+ValonEmulator::set_wire_time(bool enable)
+{
+    wire_time = enable;
+}
+
+inline const ValonEmulator::counters &
+ValonEmulator::injected() const
+{
+    return count;
+}
+
+#endif//VALONEMULATOR_H
@@ -0,0 +1,234 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONFRAME_H
+#define VALONFRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <array>
+#include <utility>
+
+/**
+ * \file ValonFrame.h
+ * Typed frames for the Valon 5007 serial protocol.
+ *
+ * Every opcode has a frame type with its size known at compile time. A
+ * query is a single opcode byte answered by a fixed length payload and a
+ * checksum; a command is an opcode, a fixed length payload and a checksum,
+ * answered by ACK or NACK. The checksum is the sum of the preceding bytes
+ * modulo 256 and is computed by an unrolled fold over the frame, so frames
+ * can be built and checked in constant expressions.
+ *
+ * The six 32-bit registers of each synthesizer travel as a 24 byte
+ * big-endian register_image. Its fields are described by field<> types
+ * below, which generate the masks and shifts used to read and write them.
+ **/
+namespace ValonFrame
+{
+
+enum { ACK  = 0x06,
+       NACK = 0x15 };
+
+/**
+ * Sum of the first N bytes of a frame modulo 256.
+ **/
+template<size_t N, size_t M, size_t... I>
+constexpr uint8_t
+checksum(const std::array<uint8_t, M> &bytes, std::index_sequence<I...>)
+{
+    return uint8_t((0u + ... + bytes[I]));
+}
+
+template<size_t N, size_t M>
+constexpr uint8_t
+checksum(const std::array<uint8_t, M> &bytes)
+{
+    static_assert(N <= M, "checksum beyond the end of the frame");
+    return checksum<N>(bytes, std::make_index_sequence<N>());
+}
+
+/**
+ * Big-endian integers at a fixed offset.
+ **/
+template<size_t Offset, size_t M>
+constexpr uint32_t
+get_u32(const std::array<uint8_t, M> &bytes)
+{
+    static_assert(Offset + 4 <= M, "u32 beyond the end of the frame");
+    return ((uint32_t(bytes[Offset]) << 24) |
+            (uint32_t(bytes[Offset + 1]) << 16) |
+            (uint32_t(bytes[Offset + 2]) << 8) |
+            uint32_t(bytes[Offset + 3]));
+}
+
+template<size_t Offset, size_t M>
+constexpr void
+put_u32(std::array<uint8_t, M> &bytes, uint32_t num)
+{
+    static_assert(Offset + 4 <= M, "u32 beyond the end of the frame");
+    bytes[Offset] = uint8_t(num >> 24);
+    bytes[Offset + 1] = uint8_t(num >> 16);
+    bytes[Offset + 2] = uint8_t(num >> 8);
+    bytes[Offset + 3] = uint8_t(num);
+}
+
+template<size_t Offset, size_t M>
+constexpr uint16_t
+get_u16(const std::array<uint8_t, M> &bytes)
+{
+    static_assert(Offset + 2 <= M, "u16 beyond the end of the frame");
+    return uint16_t((uint32_t(bytes[Offset]) << 8) | bytes[Offset + 1]);
+}
+
+template<size_t Offset, size_t M>
+constexpr void
+put_u16(std::array<uint8_t, M> &bytes, uint16_t num)
+{
+    static_assert(Offset + 2 <= M, "u16 beyond the end of the frame");
+    bytes[Offset] = uint8_t(num >> 8);
+    bytes[Offset + 1] = uint8_t(num);
+}
+
+//----------------//
+// Register Image //
+//----------------//
+typedef std::array<uint8_t, 24> register_image;
+
+/**
+ * A field of Width bits starting at bit Shift of register Reg.
+ **/
+template<size_t Reg, unsigned Shift, unsigned Width>
+struct field
+{
+    static_assert(Reg < 6, "the synthesizer has six registers");
+    static_assert(Width > 0 && Shift + Width <= 32, "field outside register");
+
+    static constexpr uint32_t mask = uint32_t(((uint64_t(1) << Width) - 1)
+                                              << Shift);
+
+    static constexpr uint32_t
+    get(const register_image &regs)
+    {
+        return (get_u32<4 * Reg>(regs) & mask) >> Shift;
+    }
+
+    static constexpr void
+    set(register_image &regs, uint32_t value)
+    {
+        put_u32<4 * Reg>(regs, ((get_u32<4 * Reg>(regs) & ~mask) |
+                                ((value << Shift) & mask)));
+    }
+};
+
+// Register 0
+typedef field<0, 15, 16> ncount;
+typedef field<0, 3, 12>  frac;
+// Register 1
+typedef field<1, 3, 12>  mod;
+// Register 2; low spur mode sets both bits
+typedef field<2, 29, 2>  low_spur;
+typedef field<2, 25, 1>  double_ref;
+typedef field<2, 24, 1>  half_ref;
+typedef field<2, 14, 10> r;
+// Register 4; dbf holds log2 of the output divider
+typedef field<4, 20, 3>  dbf;
+typedef field<4, 3, 2>   rf_level;
+
+//--------//
+// Frames //
+//--------//
+/**
+ * A read of Length bytes. Op has the high bit set; PerSynth opcodes are
+ * combined with the synthesizer address.
+ **/
+template<uint8_t Op, size_t Length, bool PerSynth>
+struct query
+{
+    static_assert(Op & 0x80, "queries have the high bit set");
+    static_assert(!PerSynth || !(Op & 0x08), "opcode overlaps synth bit");
+
+    typedef std::array<uint8_t, 1> request_frame;
+    typedef std::array<uint8_t, Length + 1> reply_frame;
+    static constexpr size_t length = Length;
+
+    static constexpr request_frame
+    request(uint8_t synth = 0)
+    {
+        return request_frame{{uint8_t(PerSynth ? (Op | synth) : Op)}};
+    }
+
+    static constexpr bool
+    verify(const reply_frame &reply)
+    {
+        return checksum<Length>(reply) == reply[Length];
+    }
+};
+
+/**
+ * A write of Length bytes, answered by ACK or NACK.
+ **/
+template<uint8_t Op, size_t Length, bool PerSynth>
+struct command
+{
+    static_assert(!(Op & 0x80), "commands have the high bit clear");
+    static_assert(!PerSynth || !(Op & 0x08), "opcode overlaps synth bit");
+
+    typedef std::array<uint8_t, Length + 2> frame;
+    typedef std::array<uint8_t, Length> payload;
+    static constexpr size_t length = Length;
+
+    static constexpr frame
+    encode(const payload &data, uint8_t synth = 0)
+    {
+        frame f{};
+        f[0] = uint8_t(PerSynth ? (Op | synth) : Op);
+        for(size_t i = 0; i < Length; ++i)
+        {
+            f[i + 1] = data[i];
+        }
+        f[Length + 1] = checksum<Length + 1>(f);
+        return f;
+    }
+};
+
+typedef query<0x80, 24, true>   read_registers;
+typedef query<0x81, 4, false>   read_reference;
+typedef query<0x82, 16, true>   read_label;
+typedef query<0x83, 4, true>    read_vco_range;
+typedef query<0x86, 1, true>    read_status;
+
+typedef command<0x00, 24, true> write_registers;
+typedef command<0x01, 4, false> write_reference;
+typedef command<0x02, 16, true> write_label;
+typedef command<0x03, 4, true>  write_vco_range;
+typedef command<0x06, 1, false> write_ref_select;
+typedef command<0x40, 0, false> write_flash;
+
+static_assert(write_flash::encode({})[1] == 0x40, "flash checksum");
+static_assert(read_registers::request(0x08)[0] == 0x88, "synth B address");
+
+} // namespace ValonFrame
+
+#endif//VALONFRAME_H
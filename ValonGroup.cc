@@ -0,0 +1,128 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "ValonGroup.h"
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+namespace
+{
+
+// Releases all threads once the last one arrives
+class barrier
+{
+public:
+    explicit barrier(size_t n) : waiting(n), failed(false) {}
+
+    // Returns false if any thread arrived with ok false
+    bool arrive(bool ok)
+    {
+        std::unique_lock<std::mutex> hold(lock);
+        failed = failed || !ok;
+        if(--waiting == 0)
+        {
+            released.notify_all();
+        }
+        else
+        {
+            released.wait(hold, [this]() { return waiting == 0; });
+        }
+        return !failed;
+    }
+
+private:
+    std::mutex lock;
+    std::condition_variable released;
+    size_t waiting;
+    bool failed;
+};
+
+} // namespace
+
+static int64_t
+to_ns(const timespec &t)
+{
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+bool
+ValonGroup::hop(const std::vector<change> &changes, report &r)
+{
+    r.ok.assign(changes.size(), 0);
+    r.acked.assign(changes.size(), timespec());
+    r.spread = 0;
+
+    // The changes for each board, in order
+    std::map<ValonSynth *, std::vector<size_t> > boards;
+    for(size_t i = 0; i < changes.size(); ++i)
+    {
+        boards[changes[i].board].push_back(i);
+    }
+
+    barrier staged(boards.size());
+    std::vector<std::thread> workers;
+    for(std::map<ValonSynth *, std::vector<size_t> >::const_iterator
+            it = boards.begin(); it != boards.end(); ++it)
+    {
+        ValonSynth *board = it->first;
+        const std::vector<size_t> &mine = it->second;
+        workers.push_back(std::thread([board, &mine, &changes, &staged, &r]()
+        {
+            std::vector<ValonSynth::staged_write> w(mine.size());
+            bool ok = true;
+            for(size_t k = 0; ok && (k < mine.size()); ++k)
+            {
+                const change &c = changes[mine[k]];
+                FrequencyPlanner::tuning t;
+                ok = board->stage_frequency(c.synth, c.frequency,
+                                            c.chan_spacing, w[k], t);
+            }
+            if(!staged.arrive(ok)) return;
+            for(size_t k = 0; k < mine.size(); ++k)
+            {
+                r.ok[mine[k]] = board->commit(w[k]);
+                clock_gettime(CLOCK_MONOTONIC, &r.acked[mine[k]]);
+            }
+        }));
+    }
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+    }
+
+    bool ok = !changes.empty();
+    int64_t first = 0, last = 0;
+    for(size_t i = 0; i < changes.size(); ++i)
+    {
+        ok = ok && r.ok[i];
+        int64_t t = to_ns(r.acked[i]);
+        if((i == 0) || (t < first)) first = t;
+        if((i == 0) || (t > last)) last = t;
+    }
+    if(ok) r.spread = last - first;
+    return ok;
+}
@@ -0,0 +1,85 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONGROUP_H
+#define VALONGROUP_H
+
+#include "ValonSynth.h"
+
+#include <time.h>
+
+#include <vector>
+
+/**
+ * Changes the frequency of several boards as nearly together as possible.
+ *
+ * One thread per board stages its writes with ValonSynth::stage_frequency()
+ * and then waits at a barrier. Once every board is staged, all threads are
+ * released at once and only the prepared frames go out, so the boards
+ * change within about one write turnaround of each other instead of one
+ * read-modify-write each, in turn. If any board cannot be staged nothing
+ * is written.
+ **/
+class ValonGroup
+{
+public:
+    /**
+     * One frequency change. Changes for both synthesizers of a board are
+     * sent back to back by that board's thread.
+     **/
+    struct change
+    {
+        ValonSynth *board;
+        ValonSynth::Synthesizer synth;
+        uint64_t frequency;
+        uint32_t chan_spacing;
+    };
+
+    /**
+     * The outcome of a hop. Times are on CLOCK_MONOTONIC.
+     **/
+    struct report
+    {
+        /**
+         * Per change, in the order given.
+         **/
+        std::vector<char> ok;
+        std::vector<timespec> acked;
+
+        /**
+         * Latest ACK minus earliest ACK in nanoseconds.
+         **/
+        int64_t spread;
+    };
+
+    /**
+     * Make all the changes together.
+     * @param[in] changes The changes. No board may be in use elsewhere.
+     * @param[out] r Receives the ACK times and their spread.
+     * @return True if every change was acknowledged.
+     **/
+    static bool hop(const std::vector<change> &changes, report &r);
+};
+
+#endif//VALONGROUP_H
@@ -0,0 +1,549 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+#include "ValonMetrics.h"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <utility>
+
+// How long the server waits for a request before dropping the client, and
+// how often it checks for shutdown
+static const int REQUEST_TIMEOUT_MS = 1000;
+static const int SHUTDOWN_POLL_MS = 200;
+
+const int64_t ValonMetrics::bucket_bounds[BUCKETS] =
+{
+    1000000, 2500000, 5000000, 10000000, 25000000, 50000000,
+    100000000, 250000000, 500000000, 1000000000, 2500000000LL, 5000000000LL
+};
+
+//-----------//
+// Labelling //
+//-----------//
+namespace
+{
+
+// Names of the base opcodes, with the synthesizer bit clear
+struct opcode_name
+{
+    uint8_t op;
+    bool per_synth;
+    const char *name;
+};
+
+const opcode_name opcode_names[] =
+{
+    { 0x80, true,  "read_registers" },
+    { 0x81, false, "read_reference" },
+    { 0x82, true,  "read_label" },
+    { 0x83, true,  "read_vco_range" },
+    { 0x86, true,  "read_status" },
+    { 0x00, true,  "write_registers" },
+    { 0x01, false, "write_reference" },
+    { 0x02, true,  "write_label" },
+    { 0x03, true,  "write_vco_range" },
+    { 0x06, false, "write_ref_select" },
+    { 0x40, false, "write_flash" }
+};
+
+const char *const error_names[] =
+{
+    "", "port", "short_write", "timeout", "nack", "checksum", "resync"
+};
+
+void
+append_escaped(std::string &out, const std::string &value)
+{
+    for(size_t i = 0; i < value.size(); ++i)
+    {
+        switch(value[i])
+        {
+        case '\\': out += "\\\\"; break;
+        case '"': out += "\\\""; break;
+        case '\n': out += "\\n"; break;
+        default: out += value[i]; break;
+        }
+    }
+}
+
+// device="...",op="...",synth="..."
+void
+append_labels(std::string &out, const std::string &device, int op)
+{
+    out += "device=\"";
+    append_escaped(out, device);
+    out += "\"";
+    if(op < 0) return;
+    const char *name = NULL;
+    const char *synth = "";
+    for(size_t i = 0; i < sizeof(opcode_names) / sizeof(opcode_names[0]);
+        ++i)
+    {
+        const opcode_name &n = opcode_names[i];
+        if(n.per_synth ? ((op & ~0x08) == n.op) : (op == n.op))
+        {
+            name = n.name;
+            if(n.per_synth) synth = (op & 0x08) ? "B" : "A";
+        }
+    }
+    char unknown[12];
+    if(name == NULL)
+    {
+        snprintf(unknown, sizeof(unknown), "0x%02x", op);
+        name = unknown;
+    }
+    out += ",op=\"";
+    out += name;
+    out += "\",synth=\"";
+    out += synth;
+    out += "\"";
+}
+
+void
+append_sample(std::string &out, const char *metric, const std::string &labels,
+              uint64_t value)
+{
+    char number[24];
+    snprintf(number, sizeof(number), "%llu", (unsigned long long)value);
+    out += metric;
+    out += "{";
+    out += labels;
+    out += "} ";
+    out += number;
+    out += "\n";
+}
+
+void
+append_header(std::string &out, const char *metric, const char *type,
+              const char *help)
+{
+    out += "# HELP ";
+    out += metric;
+    out += " ";
+    out += help;
+    out += "\n# TYPE ";
+    out += metric;
+    out += " ";
+    out += type;
+    out += "\n";
+}
+
+}
+
+//----------//
+// Counting //
+//----------//
+ValonMetrics::device::device(ValonSynth &vs, const char *n)
+    :
+    synth(&vs),
+    name(n)
+{
+    for(size_t i = 0; i < 256; ++i)
+    {
+        opcode_counts &c = ops[i];
+        c.commands = 0;
+        c.failures = 0;
+        c.attempts = 0;
+        for(size_t k = 0; k <= ValonSynth::RESYNC_FAILED; ++k) c.errors[k] = 0;
+        c.written = 0;
+        c.read = 0;
+        for(size_t k = 0; k <= BUCKETS; ++k) c.buckets[k] = 0;
+        c.duration_ns = 0;
+        c.hits = 0;
+        c.misses = 0;
+    }
+    port_errors = 0;
+    lock_losses[0] = lock_losses[1] = 0;
+    locked[0] = locked[1] = -1;
+    queue_depth = 0;
+}
+
+void
+ValonMetrics::device::exchanged(ValonSynth &, const ValonSynth::exchange &e)
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    opcode_counts &c = ops[e.opcode];
+    c.commands.fetch_add(1, relaxed);
+    if(e.result != ValonSynth::NO_ERROR) c.failures.fetch_add(1, relaxed);
+    c.attempts.fetch_add(e.attempts, relaxed);
+    c.written.fetch_add(e.written, relaxed);
+    c.read.fetch_add(e.read, relaxed);
+    size_t b = 0;
+    while((b < BUCKETS) && (e.duration > bucket_bounds[b])) ++b;
+    c.buckets[b].fetch_add(1, relaxed);
+    c.duration_ns.fetch_add(e.duration, relaxed);
+}
+
+void
+ValonMetrics::device::failed(ValonSynth &, ValonSynth::error_code code,
+                             int detail)
+{
+    const std::memory_order relaxed = std::memory_order_relaxed;
+    if(code == ValonSynth::PORT_ERROR)
+    {
+        port_errors.fetch_add(1, relaxed);
+        return;
+    }
+    ops[uint8_t(detail)].errors[code].fetch_add(1, relaxed);
+}
+
+void
+ValonMetrics::device::cache_used(ValonSynth &, uint8_t opcode, bool hit)
+{
+    opcode_counts &c = ops[opcode];
+    (hit ? c.hits : c.misses).fetch_add(1, std::memory_order_relaxed);
+}
+
+void
+ValonMetrics::device::lock_changed(ValonSynth &,
+                                   ValonSynth::Synthesizer s, bool now)
+{
+    int was = locked[s >> 3].exchange(now, std::memory_order_relaxed);
+    if((was == 1) && !now)
+    {
+        lock_losses[s >> 3].fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+//-----------//
+// Exporting //
+//-----------//
+ValonMetrics::ValonMetrics()
+    :
+    listener(-1),
+    stopping(false)
+{
+}
+
+ValonMetrics::~ValonMetrics()
+{
+    stopping = true;
+    if(server.joinable()) server.join();
+    if(listener >= 0) close(listener);
+}
+
+void
+ValonMetrics::attach(ValonSynth &vs, const char *name)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    std::unique_ptr<device> d(new device(vs, name));
+    vs.set_observer(d.get());
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        if(devices[i]->synth == &vs)
+        {
+            devices[i] = std::move(d);
+            return;
+        }
+    }
+    devices.push_back(std::move(d));
+}
+
+ValonMetrics::device *
+ValonMetrics::find(const ValonSynth &vs)
+{
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        if(devices[i]->synth == &vs) return devices[i].get();
+    }
+    return NULL;
+}
+
+void
+ValonMetrics::set_queue_depth(const ValonSynth &vs, size_t depth)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    device *d = find(vs);
+    if(d != NULL) d->queue_depth = depth;
+}
+
+std::string
+ValonMetrics::exposition()
+{
+    typedef std::atomic<uint64_t> opcode_counts::*counter;
+    struct family
+    {
+        const char *metric;
+        const char *help;
+        counter member;
+        bool cache;
+    };
+    static const family opcode_families[] =
+    {
+        { "valon_commands_total", "Exchanges with the synthesizer.",
+          &opcode_counts::commands, false },
+        { "valon_command_failures_total",
+          "Exchanges that failed after all retries.",
+          &opcode_counts::failures, false },
+        { "valon_command_attempts_total",
+          "Attempts made, including retries.", &opcode_counts::attempts,
+          false },
+        { "valon_bytes_written_total", "Bytes written to the port.",
+          &opcode_counts::written, false },
+        { "valon_bytes_read_total", "Bytes read from the port.",
+          &opcode_counts::read, false },
+        { "valon_cache_hits_total",
+          "Reads answered from the shadow copy.", &opcode_counts::hits,
+          true },
+        { "valon_cache_misses_total",
+          "Reads that needed a query.", &opcode_counts::misses, true }
+    };
+    const std::memory_order relaxed = std::memory_order_relaxed;
+
+    std::lock_guard<std::mutex> hold(lock);
+    std::string out;
+    for(size_t f = 0; f < sizeof(opcode_families) / sizeof(family); ++f)
+    {
+        const family &fam = opcode_families[f];
+        append_header(out, fam.metric, "counter", fam.help);
+        for(size_t i = 0; i < devices.size(); ++i)
+        {
+            const device &d = *devices[i];
+            for(int op = 0; op < 256; ++op)
+            {
+                const opcode_counts &c = d.ops[op];
+                bool used = fam.cache ? (c.hits.load(relaxed) ||
+                                         c.misses.load(relaxed))
+                                      : c.commands.load(relaxed);
+                if(!used) continue;
+                std::string labels;
+                append_labels(labels, d.name, op);
+                append_sample(out, fam.metric, labels,
+                              (c.*fam.member).load(relaxed));
+            }
+        }
+    }
+
+    append_header(out, "valon_attempt_errors_total", "counter",
+                  "Failed attempts by cause.");
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        const device &d = *devices[i];
+        for(int op = 0; op < 256; ++op)
+        {
+            const opcode_counts &c = d.ops[op];
+            for(int k = ValonSynth::SHORT_WRITE;
+                k <= ValonSynth::RESYNC_FAILED; ++k)
+            {
+                uint64_t n = c.errors[k].load(relaxed);
+                if(n == 0) continue;
+                std::string labels;
+                append_labels(labels, d.name, op);
+                labels += ",error=\"";
+                labels += error_names[k];
+                labels += "\"";
+                append_sample(out, "valon_attempt_errors_total", labels, n);
+            }
+        }
+    }
+
+    append_header(out, "valon_command_duration_seconds", "histogram",
+                  "Time per exchange, including retries.");
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        const device &d = *devices[i];
+        for(int op = 0; op < 256; ++op)
+        {
+            const opcode_counts &c = d.ops[op];
+            uint64_t count = c.commands.load(relaxed);
+            if(count == 0) continue;
+            std::string labels;
+            append_labels(labels, d.name, op);
+            uint64_t cumulative = 0;
+            for(size_t b = 0; b <= BUCKETS; ++b)
+            {
+                char le[32];
+                if(b < BUCKETS)
+                {
+                    snprintf(le, sizeof(le), ",le=\"%g\"",
+                             bucket_bounds[b] / 1e9);
+                }
+                else
+                {
+                    snprintf(le, sizeof(le), ",le=\"+Inf\"");
+                }
+                cumulative += c.buckets[b].load(relaxed);
+                append_sample(out, "valon_command_duration_seconds_bucket",
+                              labels + le, cumulative);
+            }
+            char sum[64];
+            snprintf(sum, sizeof(sum), "} %.9f\n",
+                     c.duration_ns.load(relaxed) / 1e9);
+            out += "valon_command_duration_seconds_sum{" + labels + sum;
+            append_sample(out, "valon_command_duration_seconds_count",
+                          labels, cumulative);
+        }
+    }
+
+    append_header(out, "valon_port_errors_total", "counter",
+                  "Failures configuring the serial port.");
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        std::string labels;
+        append_labels(labels, devices[i]->name, -1);
+        append_sample(out, "valon_port_errors_total", labels,
+                      devices[i]->port_errors.load(relaxed));
+    }
+
+    append_header(out, "valon_lock_losses_total", "counter",
+                  "Times a synthesizer was seen to go from locked to "
+                  "unlocked.");
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        for(int k = 0; k < 2; ++k)
+        {
+            std::string labels;
+            append_labels(labels, devices[i]->name, -1);
+            labels += k ? ",synth=\"B\"" : ",synth=\"A\"";
+            append_sample(out, "valon_lock_losses_total", labels,
+                          devices[i]->lock_losses[k].load(relaxed));
+        }
+    }
+
+    append_header(out, "valon_locked", "gauge",
+                  "Whether the synthesizer was locked when last read.");
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        for(int k = 0; k < 2; ++k)
+        {
+            int locked = devices[i]->locked[k].load(relaxed);
+            if(locked < 0) continue;
+            std::string labels;
+            append_labels(labels, devices[i]->name, -1);
+            labels += k ? ",synth=\"B\"" : ",synth=\"A\"";
+            append_sample(out, "valon_locked", labels, locked);
+        }
+    }
+
+    append_header(out, "valon_queue_depth", "gauge",
+                  "Requests waiting for the synthesizer.");
+    for(size_t i = 0; i < devices.size(); ++i)
+    {
+        std::string labels;
+        append_labels(labels, devices[i]->name, -1);
+        append_sample(out, "valon_queue_depth", labels,
+                      devices[i]->queue_depth.load(relaxed));
+    }
+    return out;
+}
+
+bool
+ValonMetrics::write_textfile(const char *path)
+{
+    std::string text = exposition();
+    std::string temp = std::string(path) + ".tmp";
+    FILE *fp = fopen(temp.c_str(), "w");
+    if(fp == NULL) return false;
+    bool ok = (fwrite(text.data(), 1, text.size(), fp) == text.size());
+    ok = (fclose(fp) == 0) && ok;
+    if(ok && (rename(temp.c_str(), path) == 0)) return true;
+    remove(temp.c_str());
+    return false;
+}
+
+//---------//
+// Serving //
+//---------//
+bool
+ValonMetrics::serve(uint16_t port)
+{
+    if(listener >= 0) return false;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if(fd < 0) return false;
+    int on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if((bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0) ||
+       (listen(fd, 8) < 0))
+    {
+        close(fd);
+        return false;
+    }
+    listener = fd;
+    server = std::thread(&ValonMetrics::run_server, this);
+    return true;
+}
+
+void
+ValonMetrics::run_server()
+{
+    while(!stopping)
+    {
+        pollfd p = { listener, POLLIN, 0 };
+        if(poll(&p, 1, SHUTDOWN_POLL_MS) <= 0) continue;
+        int fd = accept(listener, NULL, NULL);
+        if(fd < 0) continue;
+
+        // Read up to the end of the request headers; only the request line
+        // matters
+        std::string request;
+        char buf[1024];
+        pollfd c = { fd, POLLIN, 0 };
+        while((request.find("\r\n\r\n") == std::string::npos) &&
+              (request.size() < 8192) &&
+              (poll(&c, 1, REQUEST_TIMEOUT_MS) > 0))
+        {
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if(n <= 0) break;
+            request.append(buf, n);
+        }
+
+        std::string status, body;
+        if((request.compare(0, 13, "GET /metrics ") == 0) ||
+           (request.compare(0, 6, "GET / ") == 0))
+        {
+            status = "200 OK";
+            body = exposition();
+        }
+        else
+        {
+            status = "404 Not Found";
+            body = "Not found\n";
+        }
+        char length[32];
+        snprintf(length, sizeof(length), "%zu", body.size());
+        std::string reply = "HTTP/1.0 " + status + "\r\n"
+                            "Content-Type: text/plain; version=0.0.4\r\n"
+                            "Content-Length: " + length + "\r\n"
+                            "Connection: close\r\n\r\n" + body;
+        size_t sent = 0;
+        while(sent < reply.size())
+        {
+            ssize_t n = send(fd, reply.data() + sent, reply.size() - sent,
+                             MSG_NOSIGNAL);
+            if(n <= 0) break;
+            sent += n;
+        }
+        close(fd);
+    }
+}
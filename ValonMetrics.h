@@ -0,0 +1,172 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+#ifndef VALONMETRICS_H
+#define VALONMETRICS_H
+
+#include "ValonSynth.h"
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Counts what a fleet of synthesizers is doing and exports it in the
+ * Prometheus text exposition format, either over HTTP on a loopback port
+ * or as a file for node_exporter's textfile collector.
+ *
+ * Each attached synthesizer is watched through ValonSynth::observer. Per
+ * device, opcode and synthesizer it exports:
+ *
+ * | metric                                | type      | extra labels |
+ * |---------------------------------------|-----------|--------------|
+ * | valon_commands_total                  | counter   |              |
+ * | valon_command_failures_total          | counter   |              |
+ * | valon_command_attempts_total          | counter   |              |
+ * | valon_attempt_errors_total            | counter   | error        |
+ * | valon_bytes_written_total             | counter   |              |
+ * | valon_bytes_read_total                | counter   |              |
+ * | valon_command_duration_seconds        | histogram |              |
+ * | valon_cache_hits_total                | counter   |              |
+ * | valon_cache_misses_total              | counter   |              |
+ *
+ * and per device valon_port_errors_total, valon_lock_losses_total and
+ * valon_locked by synthesizer, and the gauge valon_queue_depth. Opcodes
+ * are labelled by name (op="read_registers") with synth="A", "B", or ""
+ * for those shared by both synthesizers; errors are "short_write",
+ * "timeout", "nack", "checksum" and "resync". Durations cover retries.
+ *
+ * Counting is lock-free and allocation-free, so it is safe on a real-time
+ * I/O thread; attaching, exporting and serving are not.
+ **/
+class ValonMetrics
+{
+public:
+    ValonMetrics();
+
+    /**
+     * Destructor. Stops the HTTP server. Detach every synthesizer first
+     * with ValonSynth::set_observer(NULL), or destroy them, unless they
+     * are no longer used.
+     **/
+    ~ValonMetrics();
+
+    /**
+     * Start counting for a synthesizer. Replaces any observer it had; if
+     * it was already attached, its series start again under the new label.
+     * @param[in] vs The synthesizer.
+     * @param[in] device The device label, usually the serial port.
+     **/
+    void attach(ValonSynth &vs, const char *device);
+
+    /**
+     * Set how many requests are waiting for a synthesizer, for services
+     * that queue them.
+     * @param[in] vs An attached synthesizer.
+     * @param[in] depth The number waiting.
+     **/
+    void set_queue_depth(const ValonSynth &vs, size_t depth);
+
+    /**
+     * @return Every metric in the text exposition format.
+     **/
+    std::string exposition();
+
+    /**
+     * Write the exposition to a file, replacing it atomically so that a
+     * collector never reads a partial file. node_exporter only reads
+     * files ending in .prom.
+     * @param[in] path The file.
+     * @return False if it could not be written.
+     **/
+    bool write_textfile(const char *path);
+
+    /**
+     * Serve the exposition at /metrics on 127.0.0.1 from a background
+     * thread until destruction.
+     * @param[in] port The TCP port.
+     * @return False if the port could not be bound, or a server is
+     *         already running.
+     **/
+    bool serve(uint16_t port);
+
+private:
+    ValonMetrics(const ValonMetrics &);
+    ValonMetrics &operator=(const ValonMetrics &);
+
+    // Upper bounds of the duration histogram buckets in nanoseconds; a
+    // register read takes about 27ms at 9600 baud
+    enum { BUCKETS = 12 };
+    static const int64_t bucket_bounds[BUCKETS];
+
+    // One per opcode byte
+    struct opcode_counts
+    {
+        std::atomic<uint64_t> commands;
+        std::atomic<uint64_t> failures;
+        std::atomic<uint64_t> attempts;
+        std::atomic<uint64_t> errors[ValonSynth::RESYNC_FAILED + 1];
+        std::atomic<uint64_t> written;
+        std::atomic<uint64_t> read;
+        std::atomic<uint64_t> buckets[BUCKETS + 1];
+        std::atomic<int64_t> duration_ns;
+        std::atomic<uint64_t> hits;
+        std::atomic<uint64_t> misses;
+    };
+
+    class device : public ValonSynth::observer
+    {
+    public:
+        device(ValonSynth &vs, const char *name);
+
+        void exchanged(ValonSynth &vs, const ValonSynth::exchange &e);
+        void failed(ValonSynth &vs, ValonSynth::error_code code, int detail);
+        void cache_used(ValonSynth &vs, uint8_t opcode, bool hit);
+        void lock_changed(ValonSynth &vs, ValonSynth::Synthesizer synth,
+                          bool locked);
+
+        const ValonSynth *synth;
+        std::string name;
+        opcode_counts ops[256];
+        std::atomic<uint64_t> port_errors;
+        std::atomic<uint64_t> lock_losses[2];
+        std::atomic<int> locked[2];
+        std::atomic<uint64_t> queue_depth;
+    };
+
+    device *find(const ValonSynth &vs);
+    void run_server();
+
+    // Guards devices; held only while attaching and exporting
+    std::mutex lock;
+    std::vector<std::unique_ptr<device> > devices;
+
+    int listener;
+    std::atomic<bool> stopping;
+    std::thread server;
+};
+
+#endif//VALONMETRICS_H
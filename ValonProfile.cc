@@ -0,0 +1,383 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "ValonProfile.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+//---------//
+// Parsing //
+//---------//
+static std::string
+strip(const std::string &text)
+{
+    size_t begin = text.find_first_not_of(" \t\r");
+    if(begin == std::string::npos) return std::string();
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+static bool
+parse_uint(const std::string &text, uint64_t max, uint64_t &value)
+{
+    if(text.empty() || (text[0] == '-')) return false;
+    char *end;
+    errno = 0;
+    unsigned long long v = strtoull(text.c_str(), &end, 0);
+    if(errno || *end || (v > max)) return false;
+    value = v;
+    return true;
+}
+
+static bool
+parse_bool(const std::string &text, bool &value)
+{
+    if(text == "yes" || text == "true" || text == "on" || text == "1")
+    {
+        value = true;
+        return true;
+    }
+    if(text == "no" || text == "false" || text == "off" || text == "0")
+    {
+        value = false;
+        return true;
+    }
+    return false;
+}
+
+// A decimal number of MHz, exactly in Hz
+static bool
+parse_mhz(const std::string &text, uint64_t max, uint64_t &hz)
+{
+    size_t point = text.find('.');
+    std::string whole = text.substr(0, point);
+    std::string frac = (point == std::string::npos) ? "" : text.substr(point + 1);
+    if(frac.size() > 6) return false;
+    frac.resize(6, '0');
+    uint64_t mhz, part;
+    if(!parse_uint(whole.empty() ? "0" : whole, max / 1000000, mhz)) return false;
+    if(frac.find_first_not_of("0123456789") != std::string::npos) return false;
+    if(!parse_uint(frac, 999999, part)) return false;
+    hz = mhz * 1000000 + part;
+    return hz <= max;
+}
+
+bool
+ValonProfile::load(const char *path)
+{
+    std::ifstream in(path);
+    if(!in)
+    {
+        message = std::string(path) + ": " + strerror(errno);
+        return false;
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    return parse(text.str());
+}
+
+bool
+ValonProfile::parse(const std::string &text)
+{
+    std::istringstream in(text);
+    std::string line;
+    sections.clear();
+    message.clear();
+    for(int number = 1; std::getline(in, line); ++number)
+    {
+        std::ostringstream where;
+        where << "line " << number << ": ";
+        line = strip(line.substr(0, line.find_first_of("#;")));
+        if(line.empty()) continue;
+        if(line[0] == '[')
+        {
+            size_t space = line.find(' ');
+            if((line[line.size() - 1] != ']') || (space == std::string::npos))
+            {
+                message = where.str() + "expected [port name] or [label name]";
+                return false;
+            }
+            board b;
+            b.match = line.substr(1, space - 1);
+            b.name = strip(line.substr(space + 1, line.size() - space - 2));
+            if(((b.match != "port") && (b.match != "label")) || b.name.empty())
+            {
+                message = where.str() + "expected [port name] or [label name]";
+                return false;
+            }
+            b.synth[0].chan_spacing = 0;
+            b.synth[1].chan_spacing = 0;
+            sections.push_back(b);
+            continue;
+        }
+        size_t equals = line.find('=');
+        if(equals == std::string::npos)
+        {
+            message = where.str() + "expected key = value";
+            return false;
+        }
+        if(sections.empty())
+        {
+            message = where.str() + "setting outside a section";
+            return false;
+        }
+        std::string key = strip(line.substr(0, equals));
+        std::string value = strip(line.substr(equals + 1));
+        if(!set(sections.back(), key, value))
+        {
+            message = where.str() + "bad setting " + key + " = " + value;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+ValonProfile::set(board &b, const std::string &key, const std::string &value)
+{
+    uint64_t n;
+    bool flag;
+    if(key == "reference")
+    {
+        if(!parse_uint(value, 0xffffffff, n)) return false;
+        b.reference = uint32_t(n);
+        return true;
+    }
+    if(key == "ref_select")
+    {
+        if(value != "internal" && value != "external") return false;
+        b.e_not_i = (value == "external");
+        return true;
+    }
+    if((key.size() < 3) || (key[1] != '.') ||
+       ((key[0] != 'A') && (key[0] != 'B')))
+    {
+        return false;
+    }
+    synth_settings &ss = b.synth[key[0] == 'B'];
+    std::string name = key.substr(2);
+    if(name == "frequency")
+    {
+        if(!parse_mhz(value, 0xffffffffffffULL, n)) return false;
+        ss.frequency = n;
+    }
+    else if(name == "channel_spacing")
+    {
+        if(!parse_mhz(value, 0xffffffff, n)) return false;
+        ss.chan_spacing = uint32_t(n);
+    }
+    else if(name == "rf_level")
+    {
+        char *end;
+        long level = strtol(value.c_str(), &end, 10);
+        if(value.empty() || *end) return false;
+        ValonFrame::register_image image = {};
+        if(!ValonSynth::image_rf_level(image, level)) return false;
+        ss.rf_level = int32_t(level);
+    }
+    else if(name == "low_spur" || name == "double_ref" || name == "half_ref")
+    {
+        if(!parse_bool(value, flag)) return false;
+        if(name == "low_spur") ss.low_spur = flag;
+        else if(name == "double_ref") ss.double_ref = flag;
+        else ss.half_ref = flag;
+    }
+    else if(name == "r")
+    {
+        if(!parse_uint(value, 0x03ff, n)) return false;
+        ss.r = uint32_t(n);
+    }
+    else if(name == "vco_range")
+    {
+        std::istringstream in(value);
+        std::string low, high, rest;
+        uint64_t min, max;
+        in >> low >> high;
+        if((in >> rest) || !parse_uint(low, 0xffff, min) ||
+           !parse_uint(high, 0xffff, max))
+        {
+            return false;
+        }
+        ValonSynth::vco_range vcor;
+        vcor.min = uint16_t(min);
+        vcor.max = uint16_t(max);
+        ss.vcor = vcor;
+    }
+    else if(name == "label")
+    {
+        if(value.size() > 16) return false;
+        ss.label = value;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+//----------//
+// Applying //
+//----------//
+std::string
+ValonProfile::trim_label(const char *label)
+{
+    std::string text(label, strnlen(label, 16));
+    size_t end = text.find_last_not_of(' ');
+    return (end == std::string::npos) ? std::string() : text.substr(0, end + 1);
+}
+
+const ValonProfile::board *
+ValonProfile::find(const std::string &port, const std::string &label) const
+{
+    for(size_t i = 0; i < sections.size(); ++i)
+    {
+        const board &b = sections[i];
+        if((b.match == "port") ? (b.name == port) : (b.name == label))
+        {
+            return &b;
+        }
+    }
+    return NULL;
+}
+
+void
+ValonProfile::apply(ValonSynth &vs, const board &b, bool dry_run, result &r)
+{
+    r.section = b.match + " " + b.name;
+    r.ok = false;
+    r.changes = 0;
+    ValonSynth::board_state now;
+    if(!vs.snapshot(now))
+    {
+        r.message = "no response from synthesizer";
+        return;
+    }
+
+    // Work out the desired state offline, in the order the setters would
+    // have to be called
+    ValonSynth::board_state want = now;
+    if(b.reference) want.reference = *b.reference;
+    if(b.e_not_i) want.e_not_i = *b.e_not_i;
+    for(int i = 0; i < 2; ++i)
+    {
+        const synth_settings &ss = b.synth[i];
+        ValonFrame::register_image &image = want.regs[i];
+        if(ss.vcor) want.vcor[i] = *ss.vcor;
+        ValonSynth::options opts;
+        ValonSynth::unpack_options(image, opts);
+        if(ss.low_spur) opts.low_spur = *ss.low_spur;
+        if(ss.double_ref) opts.double_ref = *ss.double_ref;
+        if(ss.half_ref) opts.half_ref = *ss.half_ref;
+        if(ss.r) opts.r = *ss.r;
+        ValonSynth::image_options(image, opts);
+        if(ss.rf_level) ValonSynth::image_rf_level(image, *ss.rf_level);
+        FrequencyPlanner::tuning t;
+        if(ss.frequency &&
+           !ValonSynth::image_frequency(image, want.reference, want.vcor[i],
+                                        *ss.frequency, ss.chan_spacing, t))
+        {
+            r.message = std::string("synthesizer ") + "AB"[i] +
+                        " cannot produce the frequency";
+            return;
+        }
+        if(ss.label)
+        {
+            memset(want.label[i], ' ', 16);
+            memcpy(want.label[i], ss.label->data(), ss.label->size());
+        }
+    }
+
+    r.changes += (want.reference != now.reference);
+    r.changes += (want.e_not_i != now.e_not_i);
+    for(int i = 0; i < 2; ++i)
+    {
+        r.changes += (want.regs[i] != now.regs[i]);
+        r.changes += ((want.vcor[i].min != now.vcor[i].min) ||
+                      (want.vcor[i].max != now.vcor[i].max));
+        r.changes += (memcmp(want.label[i], now.label[i], 16) != 0);
+    }
+    if(dry_run || (r.changes == 0))
+    {
+        r.ok = true;
+        return;
+    }
+    r.ok = vs.restore(want, now);
+    if(!r.ok) r.message = "write failed";
+}
+
+bool
+ValonProfile::apply_profile(const std::vector<std::string> &ports,
+                            bool dry_run, std::vector<result> &results) const
+{
+    results.assign(ports.size(), result());
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i < ports.size(); ++i)
+    {
+        workers.push_back(std::thread([this, &ports, &results, dry_run, i]()
+        {
+            result &r = results[i];
+            r.port = ports[i];
+            r.ok = false;
+            r.changes = 0;
+            ValonSynth vs(ports[i].c_str());
+            if(!vs.is_open())
+            {
+                r.message = "cannot open port";
+                return;
+            }
+            // Section names are never empty, so this only matches by port;
+            // the label is only read when that fails
+            const board *b = find(ports[i], std::string());
+            if(b == NULL)
+            {
+                char label[16];
+                if(!vs.get_label(ValonSynth::A, label))
+                {
+                    r.message = "no response from synthesizer";
+                    return;
+                }
+                b = find(ports[i], trim_label(label));
+            }
+            if(b == NULL)
+            {
+                r.message = "no matching section";
+                return;
+            }
+            apply(vs, *b, dry_run, r);
+        }));
+    }
+    bool ok = true;
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        workers[i].join();
+        ok = ok && results[i].ok;
+    }
+    return ok;
+}
@@ -0,0 +1,193 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONPROFILE_H
+#define VALONPROFILE_H
+
+#include "ValonSynth.h"
+
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * Desired settings for a fleet of Valon 5007 boards, read from a profile
+ * file and applied with as few serial transactions as possible.
+ *
+ * A profile file has one section per board. A section names the board by
+ * the serial port it is on or by the label of its synthesizer A. Settings
+ * left out of a section are left as they are on the board.
+ *
+ * <pre>
+ *   # Comments start with '#' or ';'
+ *   [label LO1]
+ *   reference = 10000000        # Hz
+ *   ref_select = external       # or internal
+ *   A.frequency = 1420.405      # MHz, exact to 1 Hz
+ *   A.channel_spacing = 0.01    # MHz; 0, the default, for the closest
+ *   A.rf_level = 5              # dBm: -4, -1, 2 or 5
+ *   A.low_spur = no
+ *   A.double_ref = no
+ *   A.half_ref = no
+ *   A.r = 1
+ *   A.vco_range = 2200 4400     # MHz
+ *   A.label = LO1
+ *
+ *   [port /dev/ttyUSB1]
+ *   B.frequency = 1000
+ * </pre>
+ *
+ * Applying a profile reads the board state once with
+ * ValonSynth::snapshot(), works out the desired state offline and writes
+ * only what differs with ValonSynth::restore().
+ **/
+class ValonProfile
+{
+public:
+    /**
+     * Desired settings for one synthesizer.
+     **/
+    struct synth_settings
+    {
+        std::optional<uint64_t> frequency;
+        uint32_t chan_spacing;
+        std::optional<int32_t> rf_level;
+        std::optional<bool> low_spur;
+        std::optional<bool> double_ref;
+        std::optional<bool> half_ref;
+        std::optional<uint32_t> r;
+        std::optional<ValonSynth::vco_range> vcor;
+        std::optional<std::string> label;
+    };
+
+    /**
+     * Desired settings for one board.
+     **/
+    struct board
+    {
+        /**
+         * Match boards by "port" or "label".
+         **/
+        std::string match;
+        std::string name;
+
+        std::optional<uint32_t> reference;
+        std::optional<bool> e_not_i;
+
+        /**
+         * Indexed A then B.
+         **/
+        synth_settings synth[2];
+    };
+
+    /**
+     * The outcome of applying a profile to one port.
+     **/
+    struct result
+    {
+        std::string port;
+
+        /**
+         * The section applied, empty if none matched.
+         **/
+        std::string section;
+        bool ok;
+
+        /**
+         * The number of settings that differed from the board.
+         **/
+        int changes;
+        std::string message;
+    };
+
+    /**
+     * Read a profile file.
+     * @param[in] path The file to read.
+     * @return True on success; otherwise error() describes the problem.
+     **/
+    bool load(const char *path);
+
+    /**
+     * Parse a profile from text.
+     * @param[in] text The profile.
+     * @return True on success; otherwise error() describes the problem.
+     **/
+    bool parse(const std::string &text);
+
+    const std::string &error() const;
+    const std::vector<board> &boards() const;
+
+    /**
+     * Find the section for a board.
+     * @param[in] port The serial port the board is on.
+     * @param[in] label The label of its synthesizer A.
+     * @return The matching section, or NULL.
+     **/
+    const board *find(const std::string &port, const std::string &label) const;
+
+    /**
+     * Bring a board to the settings of a section.
+     * @param[in] vs The board.
+     * @param[in] b The desired settings.
+     * @param[in] dry_run Only count the changes; write nothing.
+     * @param[out] r Receives the outcome.
+     **/
+    static void apply(ValonSynth &vs, const board &b, bool dry_run,
+                      result &r);
+
+    /**
+     * Open each port, find its section and apply it, one thread per port.
+     * @param[in] ports The serial ports.
+     * @param[in] dry_run Only count the changes; write nothing.
+     * @param[out] results One result per port, in the same order.
+     * @return True if every port had a section that applied cleanly.
+     **/
+    bool apply_profile(const std::vector<std::string> &ports, bool dry_run,
+                       std::vector<result> &results) const;
+
+    /**
+     * Trim trailing blanks and NULs from a 16 character label.
+     **/
+    static std::string trim_label(const char *label);
+
+private:
+    bool set(board &b, const std::string &key, const std::string &value);
+
+    std::vector<board> sections;
+    std::string message;
+};
+
+inline const std::string &
+ValonProfile::error() const
+{
+    return message;
+}
+
+inline const std::vector<ValonProfile::board> &
+ValonProfile::boards() const
+{
+    return sections;
+}
+
+#endif//VALONPROFILE_H
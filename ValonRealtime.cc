@@ -0,0 +1,151 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+#include "ValonRealtime.h"
+
+#include <sched.h>
+#include <string.h>
+#include <sys/mman.h>
+
+//------------//
+// Error Ring //
+//------------//
+ValonRealtime::error_ring::error_ring(size_t capacity)
+    :
+    slots(),
+    mask(0),
+    head(0),
+    tail(0),
+    lost(0)
+{
+    size_t n = 1;
+    while(n < capacity) n <<= 1;
+    std::vector<slot> storage(n);
+    slots.swap(storage);
+    mask = n - 1;
+    for(size_t i = 0; i < n; ++i)
+    {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+}
+
+void
+ValonRealtime::error_ring::attach(ValonSynth &vs)
+{
+    vs.set_error_handler(&error_ring::record, this);
+}
+
+bool
+ValonRealtime::error_ring::push(const event &e)
+{
+    size_t pos = tail.load(std::memory_order_relaxed);
+    for(;;)
+    {
+        slot &s = slots[pos & mask];
+        size_t seq = s.sequence.load(std::memory_order_acquire);
+        intptr_t diff = intptr_t(seq) - intptr_t(pos);
+        if(diff == 0)
+        {
+            // The slot is free; claim it, or learn where the tail went
+            if(tail.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed))
+            {
+                s.e = e;
+                s.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if(diff < 0)
+        {
+            // The oldest event has not been popped yet
+            lost.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        else
+        {
+            pos = tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool
+ValonRealtime::error_ring::pop(event &e)
+{
+    size_t pos = head.load(std::memory_order_relaxed);
+    slot &s = slots[pos & mask];
+    if(s.sequence.load(std::memory_order_acquire) != pos + 1) return false;
+    e = s.e;
+    head.store(pos + 1, std::memory_order_relaxed);
+    s.sequence.store(pos + slots.size(), std::memory_order_release);
+    return true;
+}
+
+void
+ValonRealtime::error_ring::record(void *ring, ValonSynth &vs,
+                                  ValonSynth::error_code code, int detail)
+{
+    event e;
+    clock_gettime(CLOCK_MONOTONIC, &e.time);
+    e.device = &vs;
+    e.code = code;
+    e.detail = detail;
+    static_cast<error_ring *>(ring)->push(e);
+}
+
+//------------------//
+// Process & Thread //
+//------------------//
+bool
+ValonRealtime::lock_memory(size_t stack_bytes)
+{
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0) return false;
+
+    // Touch each page of a stack buffer so that the stack below the
+    // caller is faulted in now rather than on a later deep call
+    volatile unsigned char *stack =
+        static_cast<volatile unsigned char *>(__builtin_alloca(stack_bytes));
+    for(size_t i = 0; i < stack_bytes; i += 4096)
+    {
+        stack[i] = 0;
+    }
+    return true;
+}
+
+bool
+ValonRealtime::set_thread_priority(pthread_t thread, int priority, int cpu)
+{
+    if(cpu >= 0)
+    {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(pthread_setaffinity_np(thread, sizeof(set), &set) != 0)
+        {
+            return false;
+        }
+    }
+    sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = priority;
+    return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+}
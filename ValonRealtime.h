@@ -0,0 +1,175 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+#ifndef VALONREALTIME_H
+#define VALONREALTIME_H
+
+#include "ValonSynth.h"
+
+#include <pthread.h>
+#include <time.h>
+
+#include <atomic>
+#include <vector>
+
+/**
+ * Support for driving synthesizers from a real-time control loop.
+ *
+ * ValonSynth itself makes no heap allocations and writes nothing to
+ * iostream once it is constructed, provided state_dir and tracing are left
+ * unset and failures are sent to a handler (see
+ * ValonSynth::set_error_handler()). What remains is to keep the process's
+ * pages resident, to run the thread doing I/O at a fixed priority on a
+ * chosen CPU, and to get failures out of that thread without blocking it;
+ * that is what this provides.
+ *
+ * A typical setup, before the loop starts:
+ * <pre>
+ *   ValonRealtime::lock_memory();
+ *   ValonRealtime::error_ring errors(256);
+ *   errors.attach(synth);
+ *   ValonRealtime::set_thread_priority(pthread_self(), 80, 3);
+ * </pre>
+ * and from a thread that may block, now and then:
+ * <pre>
+ *   ValonRealtime::event e;
+ *   while(errors.pop(e)) log(e);
+ * </pre>
+ **/
+class ValonRealtime
+{
+public:
+    /**
+     * A failure reported by a synthesizer.
+     **/
+    struct event
+    {
+        timespec time;             ///< When it was reported, CLOCK_MONOTONIC
+        ValonSynth *device;        ///< The synthesizer that reported it
+        ValonSynth::error_code code;
+        int detail;                ///< As passed to the error handler
+    };
+
+    /**
+     * A fixed-size queue of events. Any number of threads may push without
+     * locks or allocation; one thread at a time may pop. When the ring is
+     * full new events are counted and dropped, so a burst of failures can
+     * never hold up the thread reporting them.
+     **/
+    class error_ring
+    {
+    public:
+        /**
+         * Constructor. All storage is allocated here.
+         * @param[in] capacity The number of events held, rounded up to a
+         *                     power of two.
+         **/
+        explicit error_ring(size_t capacity);
+
+        /**
+         * Record every failure of a synthesizer in this ring. Replaces any
+         * error handler the synthesizer had.
+         * @param[in] vs The synthesizer; must not outlive the ring unless
+         *               detached with vs.set_error_handler(NULL, NULL).
+         **/
+        void attach(ValonSynth &vs);
+
+        /**
+         * Add an event without blocking.
+         * @param[in] e The event.
+         * @return False if the ring was full and the event was dropped.
+         **/
+        bool push(const event &e);
+
+        /**
+         * Take the oldest event.
+         * @param[out] e Receives the event.
+         * @return False if the ring is empty.
+         **/
+        bool pop(event &e);
+
+        /**
+         * @return The number of events dropped because the ring was full.
+         **/
+        uint64_t dropped() const;
+
+        /**
+         * A ValonSynth::error_handler that pushes to the ring given as
+         * context, time-stamped.
+         **/
+        static void record(void *ring, ValonSynth &vs,
+                           ValonSynth::error_code code, int detail);
+
+    private:
+        error_ring(const error_ring &);
+        error_ring &operator=(const error_ring &);
+
+        // Each slot's sequence says whose turn it is: equal to the
+        // position for the next push, one past it for the next pop
+        struct slot
+        {
+            std::atomic<size_t> sequence;
+            event e;
+        };
+
+        std::vector<slot> slots;
+        size_t mask;
+        std::atomic<size_t> head;
+        std::atomic<size_t> tail;
+        std::atomic<uint64_t> lost;
+    };
+
+    /**
+     * Lock all current and future pages of the process into memory and
+     * touch a stretch of stack so that it is resident too. Needs
+     * CAP_IPC_LOCK or a large enough RLIMIT_MEMLOCK.
+     * @param[in] stack_bytes How much of the calling thread's stack to
+     *                        fault in.
+     * @return False if the pages could not be locked.
+     **/
+    static bool lock_memory(size_t stack_bytes = DEFAULT_STACK_PREFAULT);
+
+    /**
+     * Run a thread under SCHED_FIFO, optionally on one CPU only. Needs
+     * CAP_SYS_NICE or a large enough RLIMIT_RTPRIO.
+     * @param[in] thread The thread, e.g. pthread_self() or a
+     *                   std::thread's native_handle().
+     * @param[in] priority The SCHED_FIFO priority, 1 to 99.
+     * @param[in] cpu The CPU to pin the thread to, or -1 to leave its
+     *                affinity alone.
+     * @return False if the policy or the affinity could not be set.
+     **/
+    static bool set_thread_priority(pthread_t thread, int priority,
+                                    int cpu = -1);
+
+private:
+    enum { DEFAULT_STACK_PREFAULT = 256 * 1024 };
+};
+
+inline uint64_t
+ValonRealtime::error_ring::dropped() const
+{
+    return lost.load(std::memory_order_relaxed);
+}
+
+#endif//VALONREALTIME_H
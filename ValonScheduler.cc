@@ -0,0 +1,195 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+#include "ValonScheduler.h"
+#include "ValonRealtime.h"
+
+#include <errno.h>
+
+// Serial settings of the synthesizer, for the first lead time estimate
+static const int64_t BAUD_RATE = 9600;
+static const int64_t BITS_PER_BYTE = 10;
+// How much of each new turnaround measurement goes into the estimate
+static const int64_t LEAD_WEIGHT = 4;
+// Waits shorter than this are done with clock_nanosleep for precision
+static const int64_t SPIN_NS = 2000000;
+
+static int64_t
+to_ns(const timespec &t)
+{
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+static timespec
+to_timespec(int64_t ns)
+{
+    timespec t;
+    t.tv_sec = ns / 1000000000;
+    t.tv_nsec = ns % 1000000000;
+    return t;
+}
+
+ValonScheduler::ValonScheduler(ValonSynth &vs, clockid_t c)
+    :
+    synth(vs),
+    clock(c),
+    next_id(0),
+    // The frame and its ACK on the wire
+    lead((sizeof(ValonFrame::write_registers::frame) + 1) * BITS_PER_BYTE *
+         1000000000 / BAUD_RATE),
+    stopping(false),
+    worker(&ValonScheduler::run, this)
+{
+}
+
+ValonScheduler::~ValonScheduler()
+{
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    worker.join();
+}
+
+int64_t
+ValonScheduler::now()
+{
+    timespec t;
+    clock_gettime(clock, &t);
+    return to_ns(t);
+}
+
+int
+ValonScheduler::schedule_frequency(ValonSynth::Synthesizer s,
+                                   uint64_t frequency, uint32_t chan_spacing,
+                                   const timespec &deadline)
+{
+    ValonSynth::staged_write w;
+    FrequencyPlanner::tuning t;
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        if(!synth.stage_frequency(s, frequency, chan_spacing, w, t))
+        {
+            return -1;
+        }
+    }
+    return schedule(w, deadline);
+}
+
+int
+ValonScheduler::schedule(const ValonSynth::staged_write &w,
+                         const timespec &deadline)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    retired.clear();
+    job j;
+    j.id = next_id++;
+    j.w = w;
+    j.deadline = deadline;
+    pending.insert(std::make_pair(to_ns(deadline), j));
+    unfilled[j.id];
+    changed.notify_all();
+    return j.id;
+}
+
+bool
+ValonScheduler::wait(int id, outcome &result)
+{
+    std::unique_lock<std::mutex> hold(lock);
+    if((id < 0) || (id >= next_id)) return false;
+    while(done.find(id) == done.end())
+    {
+        bool queued = false;
+        for(std::multimap<int64_t, job>::const_iterator it = pending.begin();
+            it != pending.end(); ++it)
+        {
+            queued = queued || (it->second.id == id);
+        }
+        if(!queued && done.find(id) == done.end()) return false;
+        changed.wait(hold);
+    }
+    result = done[id];
+    done.erase(id);
+    retired.clear();
+    return true;
+}
+
+int64_t
+ValonScheduler::lead_time()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    return lead;
+}
+
+bool
+ValonScheduler::set_realtime(int priority, int cpu)
+{
+    return ValonRealtime::set_thread_priority(worker.native_handle(),
+                                              priority, cpu);
+}
+
+void
+ValonScheduler::run()
+{
+    std::unique_lock<std::mutex> hold(lock);
+    while(!stopping)
+    {
+        if(pending.empty())
+        {
+            changed.wait(hold);
+            continue;
+        }
+        int64_t start = pending.begin()->first - lead;
+        int64_t remaining = start - now();
+        if(remaining > SPIN_NS)
+        {
+            // Sleep until close to the start time, or until an earlier job
+            // is added
+            changed.wait_for(hold, std::chrono::nanoseconds(remaining -
+                                                            SPIN_NS));
+            continue;
+        }
+        std::multimap<int64_t, job>::iterator next =
+            retired.insert(pending.extract(pending.begin()));
+        const job &j = next->second;
+
+        timespec at = to_timespec(start);
+        while(clock_nanosleep(clock, TIMER_ABSTIME, &at, NULL) == EINTR)
+        {
+        }
+        outcome &o = done.insert(unfilled.extract(j.id)).position->second;
+        o.deadline = j.deadline;
+        clock_gettime(clock, &o.sent);
+        o.ok = synth.commit(j.w);
+        clock_gettime(clock, &o.acked);
+        o.jitter = to_ns(o.acked) - to_ns(j.deadline);
+        if(o.ok)
+        {
+            int64_t turnaround = to_ns(o.acked) - to_ns(o.sent);
+            lead += (turnaround - lead) / LEAD_WEIGHT;
+        }
+        changed.notify_all();
+    }
+}
@@ -0,0 +1,175 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+
+#ifndef VALONSCHEDULER_H
+#define VALONSCHEDULER_H
+
+#include "ValonSynth.h"
+
+#include <time.h>
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <thread>
+
+/**
+ * Runs ValonSynth writes at given times.
+ *
+ * Each change is staged when it is scheduled, so all the reads and
+ * calculations are done up front. A scheduler thread then sends the
+ * prepared frame early enough that the synthesizer's ACK arrives just
+ * before the deadline. The lead time starts from the time the frame takes
+ * on the wire and is refined from the turnaround of every write sent, so
+ * the remaining error is the jitter reported in each outcome.
+ *
+ * While a scheduler exists it must be the only user of its ValonSynth;
+ * other operations can be run through call().
+ **/
+class ValonScheduler
+{
+public:
+    /**
+     * What happened to a scheduled write. Times are on the scheduler's
+     * clock.
+     **/
+    struct outcome
+    {
+        bool ok;
+        timespec deadline;
+        timespec sent;
+        timespec acked;
+
+        /**
+         * acked minus deadline in nanoseconds; negative when early.
+         **/
+        int64_t jitter;
+    };
+
+    /**
+     * Constructor. Starts the scheduler thread.
+     * @param[in] vs The synthesizer to drive.
+     * @param[in] clock CLOCK_MONOTONIC or CLOCK_REALTIME; the clock that
+     *                  deadlines are given on.
+     **/
+    ValonScheduler(ValonSynth &vs, clockid_t clock = CLOCK_MONOTONIC);
+
+    /**
+     * Destructor. Writes still pending are abandoned.
+     **/
+    ~ValonScheduler();
+
+    /**
+     * Schedule a frequency change.
+     * @param[in] synth, frequency, chan_spacing As for
+     *            ValonSynth::set_frequency.
+     * @param[in] deadline When the change should take effect.
+     * @return An id for wait(), or -1 if the change could not be staged.
+     **/
+    int schedule_frequency(ValonSynth::Synthesizer synth, uint64_t frequency,
+                           uint32_t chan_spacing, const timespec &deadline);
+
+    /**
+     * Schedule a prepared write.
+     * @param[in] w The write, from ValonSynth::stage_frequency() or
+     *              ValonSynth::stage_registers().
+     * @param[in] deadline When the change should take effect.
+     * @return An id for wait().
+     **/
+    int schedule(const ValonSynth::staged_write &w, const timespec &deadline);
+
+    /**
+     * Wait for a scheduled write to complete.
+     * @param[in] id The id returned when it was scheduled.
+     * @param[out] result Receives the outcome.
+     * @return False if the id is unknown or was already waited for.
+     **/
+    bool wait(int id, outcome &result);
+
+    /**
+     * Run an operation on the synthesizer between scheduled writes.
+     * @param[in] op Called with the synthesizer.
+     * @return What op returns.
+     **/
+    template<class Op>
+    bool call(Op op);
+
+    /**
+     * @return The current estimate of the time from starting a write to
+     *         its ACK, in nanoseconds.
+     **/
+    int64_t lead_time();
+
+    /**
+     * Run the scheduler thread under SCHED_FIFO, optionally pinned to one
+     * CPU; see ValonRealtime::set_thread_priority(). The thread makes no
+     * heap allocations: every container node it uses is made and freed by
+     * the threads calling schedule() and wait().
+     * @param[in] priority The SCHED_FIFO priority, 1 to 99.
+     * @param[in] cpu The CPU to run on, or -1 for any.
+     * @return False if the priority or affinity could not be set.
+     **/
+    bool set_realtime(int priority, int cpu = -1);
+
+private:
+    ValonScheduler(const ValonScheduler &);
+    ValonScheduler &operator=(const ValonScheduler &);
+
+    struct job
+    {
+        int id;
+        ValonSynth::staged_write w;
+        timespec deadline;
+    };
+
+    void run();
+    int64_t now();
+
+    ValonSynth &synth;
+    clockid_t clock;
+
+    // Guards everything below and the use of synth
+    std::mutex lock;
+    std::condition_variable changed;
+    std::multimap<int64_t, job> pending;
+    std::map<int, outcome> done;
+    // Nodes the scheduler thread has finished with, moved here rather than
+    // freed, and an outcome node made ready for each pending job
+    std::multimap<int64_t, job> retired;
+    std::map<int, outcome> unfilled;
+    int next_id;
+    int64_t lead;
+    bool stopping;
+    std::thread worker;
+};
+
+template<class Op>
+bool
+ValonScheduler::call(Op op)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    return op(synth);
+}
+
+#endif//VALONSCHEDULER_H
@@ -23,32 +23,149 @@
 #include "Serial.h"
 #include "ValonSynth.h"
 
+#include <stdio.h>
 
-ValonSynth::ValonSynth(const char *port)
+
+ValonSynth::ValonSynth(const char *port, const char *state_dir)
+    :
+    ValonSynth(new Serial(port))
+{
+    if(state_dir != NULL)
+    {
+        // One file per port: /dev/ttyUSB0 becomes dev_ttyUSB0.state
+        std::string name = port;
+        for(size_t i = 0; i < name.size(); ++i)
+        {
+            if(name[i] == '/') name[i] = '_';
+        }
+        size_t start = name.find_first_not_of('_');
+        name = (start == std::string::npos) ? name : name.substr(start);
+        state_path = std::string(state_dir) + "/" + name + ".state";
+        state_temp_path = state_path + ".tmp";
+    }
+}
+
+ValonSynth::ValonSynth(Serial *port)
     :
-    s(port)
+    transport(port),
+    s(*port),
+    cached_reference(0),
+    reference_valid(false),
+    caching(false),
+    force_writes(false),
+    write_skipped(false),
+    timeout(200000),
+    verify_checksums(true),
+    retries(2),
+    failure(NO_ERROR),
+    on_error(NULL),
+    error_context(NULL),
+    watcher(NULL),
+    bytes_written(0),
+    bytes_read(0),
+    state_label_valid(false),
+    state_loaded(false)
+{
+    invalidate();
+    last_lock[0] = last_lock[1] = -1;
+    memset(saved_state, 0, sizeof(saved_state));
+}
+
+bool
+ValonSynth::set_exclusive(bool exclusive)
+{
+    return s.set_exclusive(exclusive) == 0;
+}
+
+bool
+ValonSynth::set_trace(const char *path)
+{
+    return s.set_trace(path) == 0;
+}
+
+void
+ValonSynth::set_error_handler(error_handler handler, void *context)
+{
+    on_error = handler;
+    error_context = context;
+    forward_port_errors();
+}
+
+void
+ValonSynth::set_observer(observer *o)
+{
+    watcher = o;
+    forward_port_errors();
+}
+
+void
+ValonSynth::forward_port_errors()
+{
+    if((on_error != NULL) || (watcher != NULL))
+    {
+        s.set_error_handler(&ValonSynth::report_port_error, this);
+    }
+    else
+    {
+        s.set_error_handler(NULL, NULL);
+    }
+}
+
+void
+ValonSynth::observer::exchanged(ValonSynth &, const exchange &)
+{
+}
+
+void
+ValonSynth::observer::failed(ValonSynth &, error_code, int)
+{
+}
+
+void
+ValonSynth::observer::cache_used(ValonSynth &, uint8_t, bool)
 {
 }
 
+void
+ValonSynth::observer::lock_changed(ValonSynth &, Synthesizer, bool)
+{
+}
+
+void
+ValonSynth::report(error_code code, int detail)
+{
+    failure = code;
+    if(on_error != NULL) on_error(error_context, *this, code, detail);
+    if(watcher != NULL) watcher->failed(*this, code, detail);
+}
+
+void
+ValonSynth::report_port_error(void *context, Serial::error_codes code, int)
+{
+    static_cast<ValonSynth *>(context)->report(PORT_ERROR, code);
+}
+
 //------------------//
 // Output Frequency //
 //------------------//
 bool
 ValonSynth::get_frequency(enum ValonSynth::Synthesizer synth, float &frequency)
 {
-    uint8_t bytes[24];
-    uint8_t checksum;
-    bytes[0] = 0x80 | synth;
-    s.write(bytes, 1);
-    s.read(bytes, 24);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(bytes, 24, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    registers regs;
-    float EPDF = getEPDF(synth);
-    unpack_freq_registers(bytes, regs);
-    frequency = (regs.ncount + float(regs.frac) / regs.mod) * EPDF / regs.dbf;
+    FrequencyPlanner::rational exact;
+    if(!get_frequency(synth, exact)) return false;
+    frequency = FrequencyPlanner::to_hz(exact) / 1e6;
+    return true;
+}
+
+bool
+ValonSynth::get_frequency(enum ValonSynth::Synthesizer synth,
+                          FrequencyPlanner::rational &frequency)
+{
+    ValonFrame::register_image image;
+    uint32_t reference;
+    if(!read_registers(synth, image)) return false;
+    if(!get_reference(reference)) return false;
+    frequency = image_output(image, reference);
     return true;
 }
 
@@ -56,54 +173,222 @@ bool
 ValonSynth::set_frequency(enum ValonSynth::Synthesizer synth, float frequency,
                           float chan_spacing)
 {
-    vco_range vcor;
-    int32_t dbf = 1;
-    get_vco_range(synth, vcor);
-    while(((frequency * dbf) <= vcor.min) && (dbf <= 16))
+    if((frequency <= 0.0f) || (chan_spacing < 0.0f)) return false;
+    FrequencyPlanner::tuning t;
+    return set_frequency(synth, uint64_t(double(frequency) * 1e6 + 0.5),
+                         uint32_t(double(chan_spacing) * 1e6 + 0.5), t);
+}
+
+bool
+ValonSynth::set_frequency(enum ValonSynth::Synthesizer synth,
+                          uint64_t frequency, uint32_t chan_spacing,
+                          FrequencyPlanner::tuning &t)
+{
+    ValonFrame::register_image image;
+    FrequencyPlanner::config cfg;
+    if(!tuning_config(synth, chan_spacing, image, cfg)) return false;
+    if(!FrequencyPlanner(cfg).plan(frequency, t)) return false;
+    // Write values to hardware
+    pack_tuning(t, image);
+    return write_registers(synth, image);
+}
+
+bool
+ValonSynth::get_frequency_pair(float &frequency_a, float &frequency_b)
+{
+    FrequencyPlanner::rational a, b;
+    if(!get_frequency_pair(a, b)) return false;
+    frequency_a = FrequencyPlanner::to_hz(a) / 1e6;
+    frequency_b = FrequencyPlanner::to_hz(b) / 1e6;
+    return true;
+}
+
+bool
+ValonSynth::get_frequency_pair(FrequencyPlanner::rational &frequency_a,
+                               FrequencyPlanner::rational &frequency_b)
+{
+    ValonFrame::register_image image[2];
+    uint32_t reference;
+    if(!read_pair(false, image, reference)) return false;
+    frequency_a = image_output(image[0], reference);
+    frequency_b = image_output(image[1], reference);
+    return true;
+}
+
+bool
+ValonSynth::set_frequency_pair(float frequency_a, float frequency_b,
+                               float chan_spacing)
+{
+    if((frequency_a <= 0.0f) || (frequency_b <= 0.0f)) return false;
+    if(chan_spacing < 0.0f) return false;
+    FrequencyPlanner::tuning ta, tb;
+    return set_frequency_pair(uint64_t(double(frequency_a) * 1e6 + 0.5),
+                              uint64_t(double(frequency_b) * 1e6 + 0.5),
+                              uint32_t(double(chan_spacing) * 1e6 + 0.5),
+                              ta, tb);
+}
+
+bool
+ValonSynth::set_frequency_pair(uint64_t frequency_a, uint64_t frequency_b,
+                               uint32_t chan_spacing,
+                               FrequencyPlanner::tuning &ta,
+                               FrequencyPlanner::tuning &tb)
+{
+    ValonFrame::register_image image[2];
+    uint32_t reference;
+    if(!read_pair(true, image, reference)) return false;
+
+    FrequencyPlanner::config cfg[2];
+    for(int i = 0; i < 2; ++i)
     {
-        dbf *= 2;
+        options opts;
+        unpack_options(image[i], opts);
+        planner_config(reference, opts, cfg[i]);
+        cfg[i].vco_min = cache[i].vcor.min;
+        cfg[i].chan_spacing = chan_spacing;
+        if(chan_spacing == 0) cfg[i].mode = FrequencyPlanner::BEST_APPROXIMATION;
     }
-    if(dbf > 16)
+    // B reuses A's planner, and so its EPDF, when their settings agree
+    FrequencyPlanner planner_a(cfg[0]);
+    bool shared = ((cfg[0].double_ref == cfg[1].double_ref) &&
+                   (cfg[0].half_ref == cfg[1].half_ref) &&
+                   (cfg[0].r == cfg[1].r) &&
+                   (cfg[0].vco_min == cfg[1].vco_min));
+    if(!planner_a.plan(frequency_a, ta)) return false;
+    if(shared ? !planner_a.plan(frequency_b, tb)
+              : !FrequencyPlanner(cfg[1]).plan(frequency_b, tb))
     {
-        dbf = 16;
+        return false;
     }
-    float vco = frequency * dbf;
-    registers regs;
-    float EPDF = getEPDF(synth);
-    regs.ncount = int32_t(vco / EPDF);
-    regs.frac = int32_t((vco - regs.ncount * EPDF) / chan_spacing + 0.5);
-    regs.mod = int32_t(EPDF / chan_spacing + 0.5);
-    regs.dbf = dbf;
-    // Reduce frac/mod to simplest fraction
-    if((regs.frac != 0) && (regs.mod != 0))
-    {
-        while(!(regs.frac & 1) && !(regs.mod & 1))
+    pack_tuning(ta, image[0]);
+    pack_tuning(tb, image[1]);
+
+    // Send both writes before reading either ACK
+    staged_write w[2];
+    uint8_t frames[2 * (ValonFrame::write_registers::length + 2)];
+    size_t sent[2];
+    size_t n = 0, length = 0;
+    for(int i = 0; i < 2; ++i)
+    {
+        const shadow &sh = cache[i];
+        if(!force_writes && sh.regs_valid && (sh.regs == image[i])) continue;
+        stage_registers(Synthesizer(i << 3), image[i], w[n]);
+        memcpy(&frames[length], w[n].frame.data(), w[n].frame.size());
+        length += w[n].frame.size();
+        sent[n++] = i;
+    }
+    write_skipped = (n == 0);
+    if(write_skipped) return true;
+    bool ok = with_retries(frames[0], [&]()
+    {
+        uint8_t replies[2] = { ValonFrame::NACK, ValonFrame::NACK };
+        bool written = (transmit(frames, length) == int(length));
+        bool answered = written && (receive(replies, n, timeout) == int(n));
+        bool acked = true;
+        for(size_t k = 0; k < n; ++k)
+        {
+            shadow &sh = cache[sent[k]];
+            sh.regs_valid = (replies[k] == ValonFrame::ACK);
+            sh.regs = w[k].image;
+            acked = acked && sh.regs_valid;
+        }
+        if(!written) return failed(SHORT_WRITE);
+        if(!answered) return failed(REPLY_TIMEOUT);
+        return acked || failed(REPLY_NACK);
+    });
+    save_state();
+    return ok;
+}
+
+size_t
+ValonSynth::plan_frequencies(enum ValonSynth::Synthesizer synth,
+                             const uint64_t *frequency, size_t count,
+                             uint32_t chan_spacing,
+                             FrequencyPlanner::batch &out, uint8_t *blocks)
+{
+    ValonFrame::register_image image;
+    FrequencyPlanner::config cfg;
+    if(!tuning_config(synth, chan_spacing, image, cfg)) return 0;
+    size_t valid = FrequencyPlanner(cfg).plan(frequency, count, out);
+    if(blocks == NULL) return valid;
+    for(size_t i = 0; i < count; ++i)
+    {
+        ValonFrame::register_image block = image;
+        if(out.valid[i])
         {
-            regs.frac /= 2;
-            regs.mod /= 2;
+            registers regs;
+            regs.ncount = out.ncount[i];
+            regs.frac = out.frac[i];
+            regs.mod = out.mod[i];
+            regs.dbf = out.dbf[i];
+            pack_freq_registers(regs, block);
         }
+        memcpy(&blocks[block.size() * i], block.data(), block.size());
     }
-    else
+    return valid;
+}
+
+bool
+ValonSynth::tuning_config(enum ValonSynth::Synthesizer synth,
+                          uint32_t chan_spacing,
+                          ValonFrame::register_image &image,
+                          FrequencyPlanner::config &cfg)
+{
+    vco_range vcor;
+    uint32_t reference;
+    if(!get_vco_range(synth, vcor)) return false;
+    if(!read_registers(synth, image)) return false;
+    if(!get_reference(reference)) return false;
+    options opts;
+    unpack_options(image, opts);
+    planner_config(reference, opts, cfg);
+    cfg.vco_min = vcor.min;
+    cfg.chan_spacing = chan_spacing;
+    if(chan_spacing == 0) cfg.mode = FrequencyPlanner::BEST_APPROXIMATION;
+    return true;
+}
+
+//---------------//
+// Staged Writes //
+//---------------//
+bool
+ValonSynth::stage_frequency(enum ValonSynth::Synthesizer synth,
+                            uint64_t frequency, uint32_t chan_spacing,
+                            staged_write &w, FrequencyPlanner::tuning &t)
+{
+    ValonFrame::register_image image;
+    FrequencyPlanner::config cfg;
+    if(!tuning_config(synth, chan_spacing, image, cfg)) return false;
+    if(!FrequencyPlanner(cfg).plan(frequency, t)) return false;
+    pack_tuning(t, image);
+    stage_registers(synth, image, w);
+    return true;
+}
+
+void
+ValonSynth::stage_registers(enum ValonSynth::Synthesizer synth,
+                            const ValonFrame::register_image &image,
+                            staged_write &w)
+{
+    w.synth = synth;
+    w.image = image;
+    w.frame = ValonFrame::write_registers::encode(image, synth);
+}
+
+bool
+ValonSynth::commit(const staged_write &w)
+{
+    shadow &sh = cache[w.synth >> 3];
+    if(!send_frame(w.frame.data(), w.frame.size()))
     {
-        regs.frac = 0;
-        regs.mod = 1;
+        // The board state is unknown after a failed write
+        sh.regs_valid = false;
+        return false;
     }
-    // Write values to hardware
-    uint8_t bytes[26];
-    uint8_t checksum;
-    bytes[0] = 0x80 | synth;
-    s.write(bytes, 1);
-    s.read(&bytes[1], 24);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(&bytes[1], 24, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    bytes[0] = 0x00 | synth;
-    pack_freq_registers(regs, &bytes[1]);
-    bytes[25] = generate_checksum(bytes, 25);
-    s.write(bytes, 26);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    sh.regs = w.image;
+    sh.regs_valid = true;
+    save_state();
+    return true;
 }
 
 //---------------------//
@@ -112,29 +397,35 @@ ValonSynth::set_frequency(enum ValonSynth::Synthesizer synth, float frequency,
 bool
 ValonSynth::get_reference(uint32_t &frequency)
 {
-    uint8_t bytes[4];
-    uint8_t checksum;
-    bytes[0] = 0x81;
-    s.write(bytes, 1);
-    s.read(bytes, 4);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if (!verify_checksum(bytes, 4, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    unpack_int(bytes, frequency);
+    cache_used(ValonFrame::read_reference::request()[0],
+               caching && reference_valid);
+    if(caching && reference_valid)
+    {
+        frequency = cached_reference;
+        return true;
+    }
+    ValonFrame::read_reference::reply_frame reply;
+    if(!query<ValonFrame::read_reference>(reply)) return false;
+    frequency = ValonFrame::get_u32<0>(reply);
+    cached_reference = frequency;
+    reference_valid = true;
+    save_state();
     return true;
 }
 
 bool
 ValonSynth::set_reference(uint32_t frequency)
 {
-    uint8_t bytes[6];
-    bytes[0] = 0x01;
-    pack_int(frequency, &bytes[1]);
-    bytes[5] = generate_checksum(bytes, 5);
-    s.write(bytes, 6);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    write_skipped = (!force_writes && caching && reference_valid &&
+                     (cached_reference == frequency));
+    if(write_skipped) return true;
+    ValonFrame::write_reference::payload data;
+    ValonFrame::put_u32<0>(data, frequency);
+    bool ok = command<ValonFrame::write_reference>(data);
+    reference_valid = ok;
+    cached_reference = frequency;
+    save_state();
+    return ok;
 }
 
 //----------//
@@ -143,26 +434,9 @@ ValonSynth::set_reference(uint32_t frequency)
 bool
 ValonSynth::get_rf_level(enum ValonSynth::Synthesizer synth, int32_t &rf_level)
 {
-    uint8_t bytes[24];
-    uint8_t checksum;
-    bytes[0] = 0x80 | synth;
-    s.write(bytes, 1);
-    s.read(bytes, 24);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(bytes, 24, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    //uint32_t reg0, reg1, reg2, reg3;
-    uint32_t reg4;
-    //uint32_t reg5;
-    //unpack_int(&bytes[0], reg0);
-    //unpack_int(&bytes[4], reg1);
-    //unpack_int(&bytes[8], reg2);
-    //unpack_int(&bytes[12], reg3);
-    unpack_int(&bytes[16], reg4);
-    //unpack_int(&bytes[20], reg5);
-    int32_t rfl = (reg4 >> 3) & 0x03;
-    switch(rfl)
+    ValonFrame::register_image image;
+    if(!read_registers(synth, image)) return false;
+    switch(ValonFrame::rf_level::get(image))
     {
     case 0: rf_level = -4; break;
     case 1: rf_level = -1; break;
@@ -175,42 +449,11 @@ ValonSynth::get_rf_level(enum ValonSynth::Synthesizer synth, int32_t &rf_level)
 bool
 ValonSynth::set_rf_level(enum ValonSynth::Synthesizer synth, int32_t rf_level)
 {
-    int32_t rfl = 0;
-    switch(rf_level)
-    {
-    case -4: rfl = 0; break;
-    case -1: rfl = 1; break;
-    case 2:  rfl = 2; break;
-    case 5:  rfl = 3; break;
-    default: return false;
-    }
-    uint8_t bytes[26];
-    uint8_t checksum;
-    bytes[0] = 0x80 | synth;
-    s.write(bytes, 1);
-    s.read(&bytes[1], 24);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(&bytes[1], 24, checksum)) return;
-#endif//VERIFY_CHECKSUM
-    //uint32_t reg0, reg1, reg2, reg3;
-    uint32_t reg4;
-    //uint32_t reg5;
-    //unpack_int(&bytes[1], reg0);
-    //unpack_int(&bytes[5], reg1);
-    //unpack_int(&bytes[9], reg2);
-    //unpack_int(&bytes[13], reg3);
-    unpack_int(&bytes[17], reg4);
-    //unpack_int(&bytes[21], reg5);
-    reg4 &= 0xffffffe7;
-    reg4 |= (rfl & 0x03) << 3;
+    ValonFrame::register_image image;
+    if(!read_registers(synth, image)) return false;
+    if(!image_rf_level(image, rf_level)) return false;
     // Write values to hardware
-    bytes[0] = 0x00 | synth;
-    pack_int(reg4, &bytes[17]);
-    bytes[25] = generate_checksum(bytes, 25);
-    s.write(bytes, 26);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    return write_registers(synth, image);
 }
 
 //---------------------//
@@ -219,28 +462,9 @@ ValonSynth::set_rf_level(enum ValonSynth::Synthesizer synth, int32_t rf_level)
 bool
 ValonSynth::get_options(enum ValonSynth::Synthesizer synth, options &opts)
 {
-    uint8_t bytes[24];
-    uint8_t checksum;
-    bytes[0] = 0x80 | synth;
-    s.write(bytes, 1);
-    s.read(bytes, 24);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(bytes, 24, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    //uint32_t reg0, reg1;
-    uint32_t reg2;
-    //uint32_t reg3, reg4, reg5;
-    //unpack_int(&bytes[0], reg0);
-    //unpack_int(&bytes[4], reg1);
-    unpack_int(&bytes[8], reg2);
-    //unpack_int(&bytes[12], reg3);
-    //unpack_int(&bytes[16], reg4);
-    //unpack_int(&bytes[20], reg5);
-    opts.low_spur = ((reg2 >> 30) & 1) & ((reg2 >> 29) & 1);
-    opts.double_ref = (reg2 >> 25) & 1;
-    opts.half_ref = (reg2 >> 24) & 1;
-    opts.r = (reg2 >> 14) & 0x03ff;
+    ValonFrame::register_image image;
+    if(!read_registers(synth, image)) return false;
+    unpack_options(image, opts);
     return true;
 }
 
@@ -248,35 +472,11 @@ bool
 ValonSynth::set_options(enum ValonSynth::Synthesizer synth,
                         const options &opts)
 {
-    uint8_t bytes[26];
-    uint8_t checksum;
-    bytes[0] = 0x80 | synth;
-    s.write(bytes, 1);
-    s.read(&bytes[1], 24);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(&bytes[1], 24, checksum)) return;
-#endif//VERIFY_CHECKSUM
-    //uint32_t reg0, reg1;
-    uint32_t reg2;
-    //uint32_t reg3, reg4, reg5;
-    //unpack_int(&bytes[1], reg0);
-    //unpack_int(&bytes[5], reg1);
-    unpack_int(&bytes[9], reg2);
-    //unpack_int(&bytes[13], reg3);
-    //unpack_int(&bytes[17], reg4);
-    //unpack_int(&bytes[21], reg5);
-    reg2 &= 0x9c003fff;
-    reg2 |= (((opts.low_spur & 1) << 30) | ((opts.low_spur & 1) << 29) |
-             ((opts.double_ref & 1) << 25) | ((opts.half_ref & 1) << 24) |
-             ((opts.r & 0x03ff) << 14));
+    ValonFrame::register_image image;
+    if(!read_registers(synth, image)) return false;
+    image_options(image, opts);
     // Write values to hardware
-    bytes[0] = 0x00 | synth;
-    pack_int(reg2, &bytes[9]);
-    bytes[25] = generate_checksum(bytes, 25);
-    s.write(bytes, 26);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    return write_registers(synth, image);
 }
 
 //------------------//
@@ -285,29 +485,17 @@ ValonSynth::set_options(enum ValonSynth::Synthesizer synth,
 bool
 ValonSynth::get_ref_select(bool &e_not_i)
 {
-    uint8_t bytes;
-    uint8_t checksum;
-    bytes = 0x86;
-    s.write(&bytes, 1);
-    s.read(&bytes, 1);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(&bytes, 1, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    e_not_i = bytes & 1;
+    ValonFrame::read_status::reply_frame reply;
+    if(!query<ValonFrame::read_status>(reply)) return false;
+    e_not_i = reply[0] & 1;
     return true;
 }
 
 bool
 ValonSynth::set_ref_select(bool e_not_i)
 {
-    uint8_t bytes[3];
-    bytes[0] = 0x06;
-    bytes[1] = e_not_i & 1;
-    bytes[2] = generate_checksum(bytes, 2);
-    s.write(bytes, 3);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    ValonFrame::write_ref_select::payload data = {{uint8_t(e_not_i & 1)}};
+    return command<ValonFrame::write_ref_select>(data);
 }
 
 //-----------//
@@ -316,17 +504,21 @@ ValonSynth::set_ref_select(bool e_not_i)
 bool
 ValonSynth::get_vco_range(enum ValonSynth::Synthesizer synth, vco_range &vcor)
 {
-    uint8_t bytes[4];
-    uint8_t checksum;
-    bytes[0] = 0x83 | synth;
-    s.write(bytes, 1);
-    s.read(bytes, 4);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(bytes, 4, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    unpack_short(&bytes[0], vcor.min);
-    unpack_short(&bytes[2], vcor.max);
+    shadow &sh = cache[synth >> 3];
+    cache_used(ValonFrame::read_vco_range::request(synth)[0],
+               caching && sh.vcor_valid);
+    if(caching && sh.vcor_valid)
+    {
+        vcor = sh.vcor;
+        return true;
+    }
+    ValonFrame::read_vco_range::reply_frame reply;
+    if(!query<ValonFrame::read_vco_range>(reply, synth)) return false;
+    vcor.min = ValonFrame::get_u16<0>(reply);
+    vcor.max = ValonFrame::get_u16<2>(reply);
+    sh.vcor = vcor;
+    sh.vcor_valid = true;
+    save_state();
     return true;
 }
 
@@ -334,14 +526,18 @@ bool
 ValonSynth::set_vco_range(enum ValonSynth::Synthesizer synth,
                           const vco_range &vcor)
 {
-    uint8_t bytes[6];
-    bytes[0] = 0x03 | synth;
-    pack_short(vcor.min, &bytes[1]);
-    pack_short(vcor.max, &bytes[3]);
-    bytes[5] = generate_checksum(bytes, 5);
-    s.write(bytes, 6);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    shadow &sh = cache[synth >> 3];
+    write_skipped = (!force_writes && caching && sh.vcor_valid &&
+                     (sh.vcor.min == vcor.min) && (sh.vcor.max == vcor.max));
+    if(write_skipped) return true;
+    ValonFrame::write_vco_range::payload data;
+    ValonFrame::put_u16<0>(data, vcor.min);
+    ValonFrame::put_u16<2>(data, vcor.max);
+    bool ok = command<ValonFrame::write_vco_range>(data, synth);
+    sh.vcor = vcor;
+    sh.vcor_valid = ok;
+    save_state();
+    return ok;
 }
 
 //------------//
@@ -350,21 +546,20 @@ ValonSynth::set_vco_range(enum ValonSynth::Synthesizer synth,
 bool
 ValonSynth::get_phase_lock(enum ValonSynth::Synthesizer synth, bool &locked)
 {
-    uint8_t bytes;
-    uint8_t checksum;
-    bytes = 0x86 | synth;
-    s.write(&bytes, 1);
-    s.read(&bytes, 1);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(&bytes, 1, checksum)) return false;
-#endif//VERIFY_CHECKSUM
+    ValonFrame::read_status::reply_frame reply;
+    if(!query<ValonFrame::read_status>(reply, synth)) return false;
     int32_t mask;
     // ValonSynth A
     if(synth == ValonSynth::A) mask = 0x20;
     // ValonSynth B
     else mask = 0x10;
-    locked = bytes & mask;
+    locked = reply[0] & mask;
+    int8_t &last = last_lock[synth >> 3];
+    if(last != int8_t(locked))
+    {
+        last = int8_t(locked);
+        if(watcher != NULL) watcher->lock_changed(*this, synth, locked);
+    }
     return true;
 }
 
@@ -374,29 +569,31 @@ ValonSynth::get_phase_lock(enum ValonSynth::Synthesizer synth, bool &locked)
 bool
 ValonSynth::get_label(enum ValonSynth::Synthesizer synth, char *label)
 {
-    uint8_t bytes[16];
-    uint8_t checksum;
-    bytes[0] = 0x82 | synth;
-    s.write(bytes, 1);
-    s.read(bytes, 16);
-    s.read(&checksum, 1);
-#ifdef VERIFY_CHECKSUM
-    if(!verify_checksum(bytes, 16, checksum)) return false;
-#endif//VERIFY_CHECKSUM
-    memcpy(label, (char*)bytes, 16);
+    ValonFrame::read_label::reply_frame reply;
+    if(!query<ValonFrame::read_label>(reply, synth)) return false;
+    memcpy(label, reply.data(), ValonFrame::read_label::length);
+    if(synth == ValonSynth::A)
+    {
+        memcpy(state_label, label, 16);
+        state_label_valid = true;
+        save_state();
+    }
     return true;
 }
 
 bool
 ValonSynth::set_label(enum ValonSynth::Synthesizer synth, const char *label)
 {
-    uint8_t bytes[18];
-    bytes[0] = 0x02 | synth;
-    memcpy(&bytes[1], label, 16);
-    bytes[17] = generate_checksum(bytes, 17);
-    s.write(bytes, 18);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    ValonFrame::write_label::payload data;
+    memcpy(data.data(), label, data.size());
+    if(!command<ValonFrame::write_label>(data, synth)) return false;
+    if(synth == ValonSynth::A)
+    {
+        memcpy(state_label, label, 16);
+        state_label_valid = true;
+        save_state();
+    }
+    return true;
 }
 
 //-------//
@@ -405,142 +602,699 @@ ValonSynth::set_label(enum ValonSynth::Synthesizer synth, const char *label)
 bool
 ValonSynth::flash()
 {
-    uint8_t bytes[2];
-    bytes[0] = 0x40;
-    bytes[1] = generate_checksum(bytes, 1);
-    s.write(bytes, 2);
-    s.read(bytes, 1);
-    return bytes[0] == ACK;
+    return command<ValonFrame::write_flash>(ValonFrame::write_flash::payload());
 }
 
-//------------------//
-// EDPF Calculation //
-//------------------//
-float
-ValonSynth::getEPDF(enum ValonSynth::Synthesizer synth)
+//----------------//
+// Identification //
+//----------------//
+bool
+ValonSynth::identify(identity &id)
 {
-    options opts;
-    float reference = get_reference() / 1e6;
-    get_options(synth, opts);
+    typedef ValonFrame::read_label label;
+    typedef ValonFrame::read_reference reference;
+    uint8_t request[3] = { label::request(ValonSynth::A)[0],
+                           label::request(ValonSynth::B)[0],
+                           reference::request()[0] };
+    label::reply_frame a, b;
+    reference::reply_frame ref;
 
-    if(opts.double_ref) reference *= 2.0;
-    if(opts.half_ref) reference /= 2.0;
-    if(opts.r > 1) reference /= opts.r;
-    return reference;
+    // Tried once only: a scan must not spend retries on every port that
+    // has no board
+    bool ok = with_retries(request[0], [&]()
+    {
+        uint8_t bytes[2 * (label::length + 1) + reference::length + 1];
+        if(transmit(request, sizeof(request)) != int(sizeof(request)))
+        {
+            return failed(SHORT_WRITE);
+        }
+        if(receive(bytes, sizeof(bytes), timeout) != int(sizeof(bytes)))
+        {
+            return failed(REPLY_TIMEOUT);
+        }
+        memcpy(a.data(), bytes, a.size());
+        memcpy(b.data(), &bytes[a.size()], b.size());
+        memcpy(ref.data(), &bytes[a.size() + b.size()], ref.size());
+        return (label::verify(a) && label::verify(b) &&
+                reference::verify(ref)) || failed(REPLY_CHECKSUM);
+    }, false);
+    if(!ok) return false;
+    memcpy(id.label[0], a.data(), 16);
+    memcpy(id.label[1], b.data(), 16);
+    id.reference = ValonFrame::get_u32<0>(ref);
+    return true;
 }
 
-//----------//
-// Checksum //
-//----------//
-uint8_t
-ValonSynth::generate_checksum(const uint8_t *bytes, size_t length)
+//-----------//
+// Snapshots //
+//-----------//
+static const uint8_t STATE_VERSION = 1;
+
+bool
+ValonSynth::snapshot(board_state &state)
 {
-    uint32_t sum = 0;
-    for(size_t i = 0; i < length; ++i)
+    const Synthesizer synths[2] = { ValonSynth::A, ValonSynth::B };
+    for(int i = 0; i < 2; ++i)
     {
-        sum += bytes[i];
+        if(!read_registers(synths[i], state.regs[i])) return false;
+        if(!get_vco_range(synths[i], state.vcor[i])) return false;
+        if(!get_label(synths[i], state.label[i])) return false;
     }
-    return (uint8_t)(sum % 256);
+    return (get_reference(state.reference) &&
+            get_ref_select(state.e_not_i));
 }
 
 bool
-ValonSynth::verify_checksum(const uint8_t *bytes, size_t length, uint8_t checksum)
+ValonSynth::restore(const board_state &state)
 {
-    return (generate_checksum(bytes, length) == checksum);
+    board_state now;
+    if(!snapshot(now)) return false;
+    return restore(state, now);
+}
+
+bool
+ValonSynth::restore(const board_state &state, const board_state &now)
+{
+    // The reference and VCO ranges go first since they are not part of the
+    // register blocks
+    if((now.reference != state.reference) &&
+       !set_reference(state.reference))
+    {
+        return false;
+    }
+    if((now.e_not_i != state.e_not_i) && !set_ref_select(state.e_not_i))
+    {
+        return false;
+    }
+    const Synthesizer synths[2] = { ValonSynth::A, ValonSynth::B };
+    for(int i = 0; i < 2; ++i)
+    {
+        if(((now.vcor[i].min != state.vcor[i].min) ||
+            (now.vcor[i].max != state.vcor[i].max)) &&
+           !set_vco_range(synths[i], state.vcor[i]))
+        {
+            return false;
+        }
+        if((now.regs[i] != state.regs[i]) &&
+           !write_registers(synths[i], state.regs[i]))
+        {
+            return false;
+        }
+        if(memcmp(now.label[i], state.label[i], 16) &&
+           !set_label(synths[i], state.label[i]))
+        {
+            return false;
+        }
+    }
+    return true;
 }
 
-//-------------//
-// Bit Packing //
-//-------------//
 void
-ValonSynth::pack_freq_registers(const registers &regs, uint8_t *bytes)
+ValonSynth::encode_state(const board_state &state, uint8_t *bytes)
 {
-    int32_t dbf = 0;
-    switch(regs.dbf)
+    *bytes++ = STATE_VERSION;
+    for(int i = 0; i < 2; ++i)
     {
-    case 1: dbf = 0; break;
-    case 2: dbf = 1; break;
-    case 4: dbf = 2; break;
-    case 8: dbf = 3; break;
-    case 16: dbf = 4; break;
+        memcpy(bytes, state.regs[i].data(), state.regs[i].size());
+        bytes += state.regs[i].size();
+    }
+    for(int i = 0; i < 2; ++i)
+    {
+        *bytes++ = uint8_t(state.vcor[i].min >> 8);
+        *bytes++ = uint8_t(state.vcor[i].min);
+        *bytes++ = uint8_t(state.vcor[i].max >> 8);
+        *bytes++ = uint8_t(state.vcor[i].max);
     }
-    uint32_t reg0, reg1;
-    //uint32_t reg2, reg3;
-    uint32_t reg4;
-    //uint32_t reg5;
-    unpack_int(&bytes[0], reg0);
-    unpack_int(&bytes[4], reg1);
-    //unpack_int(&bytes[8], reg2);
-    //unpack_int(&bytes[12], reg3);
-    unpack_int(&bytes[16], reg4);
-    //unpack_int(&bytes[20], reg5);
-    reg0 &= 0x80000007;
-    reg0 |= ((regs.ncount & 0xffff) << 15) | ((regs.frac & 0x0fff) << 3);
-    reg1 &= 0xffff8007;
-    reg1 |= (regs.mod & 0x0fff) << 3;
-    reg4 &= 0xff8fffff;
-    reg4 |= dbf << 20;
-    pack_int(reg0, &bytes[0]);
-    pack_int(reg1, &bytes[4]);
-    //pack_int(reg2, &bytes[8]);
-    //pack_int(reg3, &bytes[12]);
-    pack_int(reg4, &bytes[16]);
-    //pack_int(reg5, &bytes[20]);
+    for(int i = 0; i < 2; ++i)
+    {
+        memcpy(bytes, state.label[i], 16);
+        bytes += 16;
+    }
+    *bytes++ = uint8_t(state.reference >> 24);
+    *bytes++ = uint8_t(state.reference >> 16);
+    *bytes++ = uint8_t(state.reference >> 8);
+    *bytes++ = uint8_t(state.reference);
+    *bytes++ = state.e_not_i;
+}
+
+bool
+ValonSynth::decode_state(const uint8_t *bytes, board_state &state)
+{
+    if(*bytes++ != STATE_VERSION) return false;
+    for(int i = 0; i < 2; ++i)
+    {
+        memcpy(state.regs[i].data(), bytes, state.regs[i].size());
+        bytes += state.regs[i].size();
+    }
+    for(int i = 0; i < 2; ++i)
+    {
+        state.vcor[i].min = uint16_t((bytes[0] << 8) | bytes[1]);
+        state.vcor[i].max = uint16_t((bytes[2] << 8) | bytes[3]);
+        bytes += 4;
+    }
+    for(int i = 0; i < 2; ++i)
+    {
+        memcpy(state.label[i], bytes, 16);
+        bytes += 16;
+    }
+    state.reference = ((uint32_t(bytes[0]) << 24) | (uint32_t(bytes[1]) << 16) |
+                       (uint32_t(bytes[2]) << 8) | uint32_t(bytes[3]));
+    state.e_not_i = bytes[4] & 1;
+    return true;
+}
+
+//----------------//
+// Register Cache //
+//----------------//
+void
+ValonSynth::invalidate()
+{
+    cache[0].regs_valid = false;
+    cache[0].vcor_valid = false;
+    cache[1].regs_valid = false;
+    cache[1].vcor_valid = false;
+    reference_valid = false;
 }
 
 void
-ValonSynth::unpack_freq_registers(const uint8_t *bytes, registers &regs)
-{
-    uint32_t reg0, reg1;
-    //uint32_t reg2, reg3;
-    uint32_t reg4;
-    //uint32_t reg5;
-    unpack_int(&bytes[0], reg0);
-    unpack_int(&bytes[4], reg1);
-    //unpack_int(&bytes[8], reg2);
-    //unpack_int(&bytes[12], reg3);
-    unpack_int(&bytes[16], reg4);
-    //unpack_int(&bytes[20], reg5);
-    regs.ncount = (reg0 >> 15) & 0xffff;
-    regs.frac = (reg0 >> 3) & 0x0fff;
-    regs.mod = (reg1 >> 3) & 0x0fff;
-    int32_t dbf = (reg4 >> 20) & 0x07;
-    switch(dbf)
-    {
-    case 0: regs.dbf = 1; break;
-    case 1: regs.dbf = 2; break;
-    case 2: regs.dbf = 4; break;
-    case 3: regs.dbf = 8; break;
-    case 4: regs.dbf = 16; break;
-    default: regs.dbf = 1;
+ValonSynth::set_caching(bool enable)
+{
+    caching = enable;
+    // The state file is only of use to a cached reader, so it is left
+    // unread until caching is first enabled
+    if(enable && !state_loaded && !state_path.empty())
+    {
+        state_loaded = true;
+        load_state();
     }
 }
 
+bool
+ValonSynth::refresh()
+{
+    bool enabled = caching;
+    ValonFrame::register_image image;
+    uint32_t reference;
+    vco_range vcor;
+    caching = false;
+    bool ok = (read_registers(ValonSynth::A, image) &&
+               read_registers(ValonSynth::B, image) &&
+               get_reference(reference) &&
+               get_vco_range(ValonSynth::A, vcor) &&
+               get_vco_range(ValonSynth::B, vcor));
+    caching = enabled;
+    return ok;
+}
+
+bool
+ValonSynth::read_registers(enum ValonSynth::Synthesizer synth,
+                           ValonFrame::register_image &regs)
+{
+    shadow &sh = cache[synth >> 3];
+    cache_used(ValonFrame::read_registers::request(synth)[0],
+               caching && sh.regs_valid);
+    if(caching && sh.regs_valid)
+    {
+        regs = sh.regs;
+        return true;
+    }
+    ValonFrame::read_registers::reply_frame reply;
+    if(!query<ValonFrame::read_registers>(reply, synth))
+    {
+        sh.regs_valid = false;
+        return false;
+    }
+    memcpy(regs.data(), reply.data(), regs.size());
+    sh.regs = regs;
+    sh.regs_valid = true;
+    save_state();
+    return true;
+}
+
+bool
+ValonSynth::write_registers(enum ValonSynth::Synthesizer synth,
+                            const ValonFrame::register_image &regs)
+{
+    shadow &sh = cache[synth >> 3];
+    write_skipped = (!force_writes && sh.regs_valid && (sh.regs == regs));
+    if(write_skipped) return true;
+    staged_write w;
+    stage_registers(synth, regs, w);
+    return commit(w);
+}
+
+bool
+ValonSynth::read_pair(bool vco_ranges, ValonFrame::register_image image[2],
+                      uint32_t &reference)
+{
+    typedef ValonFrame::read_registers regs;
+    typedef ValonFrame::read_vco_range vco;
+    typedef ValonFrame::read_reference ref;
+    enum item { REGS_A, REGS_B, VCO_A, VCO_B, REFERENCE };
+
+    // Queue a query for everything the shadow copy cannot answer
+    uint8_t request[5];
+    item queued[5];
+    size_t n = 0, length = 0;
+    for(int i = 0; i < 2; ++i)
+    {
+        const shadow &sh = cache[i];
+        cache_used(regs::request(i << 3)[0], caching && sh.regs_valid);
+        if(!caching || !sh.regs_valid)
+        {
+            request[n] = regs::request(i << 3)[0];
+            queued[n++] = item(REGS_A + i);
+            length += regs::length + 1;
+        }
+        if(vco_ranges)
+        {
+            cache_used(vco::request(i << 3)[0], caching && sh.vcor_valid);
+        }
+        if(vco_ranges && (!caching || !sh.vcor_valid))
+        {
+            request[n] = vco::request(i << 3)[0];
+            queued[n++] = item(VCO_A + i);
+            length += vco::length + 1;
+        }
+    }
+    cache_used(ref::request()[0], caching && reference_valid);
+    if(!caching || !reference_valid)
+    {
+        request[n] = ref::request()[0];
+        queued[n++] = REFERENCE;
+        length += ref::length + 1;
+    }
+
+    // Each complete reply rewrites every queued entry of the shadow copy; a
+    // short one leaves it as it was
+    if((n > 0) && !with_retries(request[0], [&]()
+    {
+        uint8_t bytes[2 * (regs::length + vco::length + 2) + ref::length + 1];
+        if(transmit(request, n) != int(n)) return failed(SHORT_WRITE);
+        if(receive(bytes, length, timeout) != int(length))
+        {
+            return failed(REPLY_TIMEOUT);
+        }
+        bool ok = true;
+        const uint8_t *p = bytes;
+        for(size_t k = 0; k < n; ++k)
+        {
+            switch(queued[k])
+            {
+            case REGS_A:
+            case REGS_B:
+            {
+                shadow &sh = cache[queued[k] - REGS_A];
+                regs::reply_frame reply;
+                memcpy(reply.data(), p, reply.size());
+                p += reply.size();
+                if(ok && verify_checksums && !regs::verify(reply))
+                {
+                    ok = failed(REPLY_CHECKSUM);
+                }
+                memcpy(sh.regs.data(), reply.data(), sh.regs.size());
+                sh.regs_valid = ok;
+                break;
+            }
+            case VCO_A:
+            case VCO_B:
+            {
+                shadow &sh = cache[queued[k] - VCO_A];
+                vco::reply_frame reply;
+                memcpy(reply.data(), p, reply.size());
+                p += reply.size();
+                if(ok && verify_checksums && !vco::verify(reply))
+                {
+                    ok = failed(REPLY_CHECKSUM);
+                }
+                sh.vcor.min = ValonFrame::get_u16<0>(reply);
+                sh.vcor.max = ValonFrame::get_u16<2>(reply);
+                sh.vcor_valid = ok;
+                break;
+            }
+            case REFERENCE:
+            {
+                ref::reply_frame reply;
+                memcpy(reply.data(), p, reply.size());
+                p += reply.size();
+                if(ok && verify_checksums && !ref::verify(reply))
+                {
+                    ok = failed(REPLY_CHECKSUM);
+                }
+                cached_reference = ValonFrame::get_u32<0>(reply);
+                reference_valid = ok;
+                break;
+            }
+            }
+        }
+        return ok;
+    }))
+    {
+        return false;
+    }
+    if(n > 0) save_state();
+    image[0] = cache[0].regs;
+    image[1] = cache[1].regs;
+    reference = cached_reference;
+    return true;
+}
+
+template<class Query>
+bool
+ValonSynth::query(typename Query::reply_frame &reply, uint8_t synth)
+{
+    typename Query::request_frame request = Query::request(synth);
+    return with_retries(request[0], [&]()
+    {
+        if(transmit(request.data(), request.size()) != int(request.size()))
+        {
+            return failed(SHORT_WRITE);
+        }
+        int n = receive(reply.data(), reply.size(), timeout);
+        // A missing checksum byte is tolerated unless it is being verified
+        if(!verify_checksums && (n >= int(Query::length))) return true;
+        if(n != int(reply.size())) return failed(REPLY_TIMEOUT);
+        return Query::verify(reply) || failed(REPLY_CHECKSUM);
+    });
+}
+
+template<class Command>
+bool
+ValonSynth::command(const typename Command::payload &data, uint8_t synth)
+{
+    typename Command::frame frame = Command::encode(data, synth);
+    return send_frame(frame.data(), frame.size());
+}
+
+bool
+ValonSynth::send_frame(const uint8_t *frame, size_t size)
+{
+    return with_retries(frame[0], [&]()
+    {
+        uint8_t reply = ValonFrame::NACK;
+        if(transmit(frame, size) != int(size)) return failed(SHORT_WRITE);
+        if(receive(&reply, 1, timeout) != 1) return failed(REPLY_TIMEOUT);
+        return (reply == ValonFrame::ACK) || failed(REPLY_NACK);
+    });
+}
+
+template<class Attempt>
+bool
+ValonSynth::with_retries(uint8_t opcode, Attempt attempt, bool retry)
+{
+    exchange e;
+    e.opcode = opcode;
+    e.attempts = 0;
+    uint64_t written = bytes_written, read = bytes_read;
+    int64_t start = (watcher != NULL) ? monotonic_ns() : 0;
+    bool ok = false;
+    for(int i = 0; ; ++i)
+    {
+        failure = NO_ERROR;
+        ++e.attempts;
+        ok = attempt();
+        if(ok) break;
+        report(failure, opcode);
+        if(!retry || (i >= retries)) break;
+        if(!resync())
+        {
+            report(RESYNC_FAILED, opcode);
+            break;
+        }
+    }
+    if(watcher != NULL)
+    {
+        e.written = uint32_t(bytes_written - written);
+        e.read = uint32_t(bytes_read - read);
+        e.duration = monotonic_ns() - start;
+        e.result = failure;
+        watcher->exchanged(*this, e);
+    }
+    return ok;
+}
+
+int64_t
+ValonSynth::monotonic_ns()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+bool
+ValonSynth::resync()
+{
+    typedef ValonFrame::read_reference ref;
+    for(int i = 0; i < RESYNC_ATTEMPTS; ++i)
+    {
+        // Let the rest of any late or overlong reply arrive, then discard
+        // it along with anything else waiting
+        uint8_t junk[64];
+        while(receive(junk, sizeof(junk), RESYNC_QUIET_USEC) > 0) {}
+        s.flush_input();
+
+        // A reference read has a known length and a checksum that spans
+        // several bytes, so a good one shows the replies are in step
+        ref::request_frame request = ref::request();
+        ref::reply_frame reply;
+        transmit(request.data(), request.size());
+        if((receive(reply.data(), reply.size(), timeout) == int(reply.size())) &&
+           ref::verify(reply) &&
+           (!reference_valid ||
+            (ValonFrame::get_u32<0>(reply) == cached_reference)))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------//
+// Frequency Calculation //
+//-----------------------//
+void
+ValonSynth::planner_config(uint32_t reference, const options &opts,
+                           FrequencyPlanner::config &cfg)
+{
+    cfg.reference = reference;
+    cfg.double_ref = opts.double_ref;
+    cfg.half_ref = opts.half_ref;
+    cfg.r = opts.r;
+    cfg.vco_min = 0;
+    cfg.chan_spacing = 0;
+    cfg.mode = FrequencyPlanner::CHANNEL_SPACING;
+}
+
+FrequencyPlanner::rational
+ValonSynth::image_output(const ValonFrame::register_image &image,
+                         uint32_t reference)
+{
+    registers regs;
+    options opts;
+    unpack_freq_registers(image, regs);
+    unpack_options(image, opts);
+    FrequencyPlanner::config cfg;
+    planner_config(reference, opts, cfg);
+    return FrequencyPlanner(cfg).output(regs.ncount, regs.frac,
+                                        regs.mod, regs.dbf);
+}
+
+//-------------------//
+// Persistent Shadow //
+//-------------------//
+static const uint8_t STATE_FILE_VERSION = 1;
+
+void
+ValonSynth::load_state()
+{
+    uint8_t bytes[STATE_FILE_SIZE];
+    FILE *fp = fopen(state_path.c_str(), "rb");
+    if(fp == NULL) return;
+    size_t length = fread(bytes, 1, sizeof(bytes), fp);
+    fclose(fp);
+    if((length != sizeof(bytes)) || (bytes[0] != STATE_FILE_VERSION)) return;
+
+    // A single read of the label confirms this is the same board; the rest
+    // of the shadow copy is taken from the file
+    char label[16];
+    if(!get_label(ValonSynth::A, label)) return;
+    if(memcmp(label, &bytes[1], 16)) return;
+
+    const uint8_t *p = &bytes[17];
+    for(int i = 0; i < 2; ++i)
+    {
+        memcpy(cache[i].regs.data(), p, 24);
+        cache[i].regs_valid = true;
+        p += 24;
+    }
+    for(int i = 0; i < 2; ++i)
+    {
+        cache[i].vcor.min = uint16_t((p[0] << 8) | p[1]);
+        cache[i].vcor.max = uint16_t((p[2] << 8) | p[3]);
+        cache[i].vcor_valid = true;
+        p += 4;
+    }
+    cached_reference = ((uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) |
+                        (uint32_t(p[2]) << 8) | uint32_t(p[3]));
+    reference_valid = true;
+    memcpy(saved_state, bytes, sizeof(bytes));
+}
+
+void
+ValonSynth::save_state()
+{
+    if(state_path.empty() || !reference_valid ||
+       !cache[0].regs_valid || !cache[1].regs_valid ||
+       !cache[0].vcor_valid || !cache[1].vcor_valid)
+    {
+        return;
+    }
+    if(!state_label_valid)
+    {
+        // The label is read once, when there is first a full shadow copy
+        // to save; get_label() saves the state itself
+        char label[16];
+        get_label(ValonSynth::A, label);
+        return;
+    }
+    uint8_t bytes[STATE_FILE_SIZE];
+    uint8_t *p = bytes;
+    *p++ = STATE_FILE_VERSION;
+    memcpy(p, state_label, 16);
+    p += 16;
+    for(int i = 0; i < 2; ++i)
+    {
+        memcpy(p, cache[i].regs.data(), 24);
+        p += 24;
+    }
+    for(int i = 0; i < 2; ++i)
+    {
+        *p++ = uint8_t(cache[i].vcor.min >> 8);
+        *p++ = uint8_t(cache[i].vcor.min);
+        *p++ = uint8_t(cache[i].vcor.max >> 8);
+        *p++ = uint8_t(cache[i].vcor.max);
+    }
+    *p++ = uint8_t(cached_reference >> 24);
+    *p++ = uint8_t(cached_reference >> 16);
+    *p++ = uint8_t(cached_reference >> 8);
+    *p++ = uint8_t(cached_reference);
+    if(!memcmp(bytes, saved_state, sizeof(bytes))) return;
+
+    // Write a new file and rename it over the old one, so that a reader
+    // never sees a partial file
+    FILE *fp = fopen(state_temp_path.c_str(), "wb");
+    if(fp == NULL) return;
+    bool ok = (fwrite(bytes, 1, sizeof(bytes), fp) == sizeof(bytes));
+    ok = (fclose(fp) == 0) && ok;
+    if(ok && (rename(state_temp_path.c_str(), state_path.c_str()) == 0))
+    {
+        memcpy(saved_state, bytes, sizeof(bytes));
+    }
+    else
+    {
+        remove(state_temp_path.c_str());
+    }
+}
+
+//-----------------//
+// Register Images //
+//-----------------//
+bool
+ValonSynth::image_frequency(ValonFrame::register_image &image,
+                            uint32_t reference, const vco_range &vcor,
+                            uint64_t frequency, uint32_t chan_spacing,
+                            FrequencyPlanner::tuning &t)
+{
+    options opts;
+    unpack_options(image, opts);
+    FrequencyPlanner::config cfg;
+    planner_config(reference, opts, cfg);
+    cfg.vco_min = vcor.min;
+    cfg.chan_spacing = chan_spacing;
+    if(chan_spacing == 0) cfg.mode = FrequencyPlanner::BEST_APPROXIMATION;
+    if(!FrequencyPlanner(cfg).plan(frequency, t)) return false;
+    pack_tuning(t, image);
+    return true;
+}
+
+bool
+ValonSynth::image_rf_level(ValonFrame::register_image &image,
+                           int32_t rf_level)
+{
+    int32_t rfl = 0;
+    switch(rf_level)
+    {
+    case -4: rfl = 0; break;
+    case -1: rfl = 1; break;
+    case 2:  rfl = 2; break;
+    case 5:  rfl = 3; break;
+    default: return false;
+    }
+    ValonFrame::rf_level::set(image, rfl);
+    return true;
+}
+
+void
+ValonSynth::image_options(ValonFrame::register_image &image,
+                          const options &opts)
+{
+    ValonFrame::low_spur::set(image, opts.low_spur ? 3 : 0);
+    ValonFrame::double_ref::set(image, opts.double_ref);
+    ValonFrame::half_ref::set(image, opts.half_ref);
+    ValonFrame::r::set(image, opts.r);
+}
+
+//-------------//
+// Bit Packing //
+//-------------//
 void
-ValonSynth::pack_int(uint32_t num, uint8_t *bytes)
+ValonSynth::pack_tuning(const FrequencyPlanner::tuning &t,
+                        ValonFrame::register_image &image)
 {
-    bytes[0] = (num >> 24) & 0xff;
-    bytes[1] = (num >> 16) & 0xff;
-    bytes[2] = (num >> 8) & 0xff;
-    bytes[3] = (num) & 0xff;
+    registers regs;
+    regs.ncount = t.ncount;
+    regs.frac = t.frac;
+    regs.mod = t.mod;
+    regs.dbf = t.dbf;
+    pack_freq_registers(regs, image);
 }
 
 void
-ValonSynth::pack_short(uint16_t num, uint8_t *bytes)
+ValonSynth::pack_freq_registers(const registers &regs,
+                                ValonFrame::register_image &image)
 {
-    bytes[0] = (num >> 8) & 0xff;
-    bytes[1] = (num) & 0xff;
+    uint32_t dbf = 0;
+    switch(regs.dbf)
+    {
+    case 1: dbf = 0; break;
+    case 2: dbf = 1; break;
+    case 4: dbf = 2; break;
+    case 8: dbf = 3; break;
+    case 16: dbf = 4; break;
+    }
+    ValonFrame::ncount::set(image, regs.ncount);
+    ValonFrame::frac::set(image, regs.frac);
+    ValonFrame::mod::set(image, regs.mod);
+    ValonFrame::dbf::set(image, dbf);
 }
 
 void
-ValonSynth::unpack_int(const uint8_t *bytes, uint32_t &num)
+ValonSynth::unpack_freq_registers(const ValonFrame::register_image &image,
+                                  registers &regs)
 {
-    num = ((uint32_t(bytes[0]) << 24) + (uint32_t(bytes[1]) << 16) +
-           (uint32_t(bytes[2]) <<  8) + (uint32_t(bytes[3])));
+    regs.ncount = ValonFrame::ncount::get(image);
+    regs.frac = ValonFrame::frac::get(image);
+    regs.mod = ValonFrame::mod::get(image);
+    uint32_t dbf = ValonFrame::dbf::get(image);
+    regs.dbf = (dbf <= 4) ? (1u << dbf) : 1;
 }
 
 void
-ValonSynth::unpack_short(const uint8_t *bytes, uint16_t &num)
+ValonSynth::unpack_options(const ValonFrame::register_image &image,
+                           options &opts)
 {
-    num = (uint16_t(bytes[0]) << 8) + uint16_t(bytes[1]);
+    opts.low_spur = (ValonFrame::low_spur::get(image) == 3);
+    opts.double_ref = ValonFrame::double_ref::get(image);
+    opts.half_ref = ValonFrame::half_ref::get(image);
+    opts.r = ValonFrame::r::get(image);
 }
@@ -28,7 +28,11 @@
 // * write(uint8_t*, int)
 // class Serial;
 #include "Serial.h"
+#include "FrequencyPlanner.h"
+#include "ValonFrame.h"
 #include <cstring>
+#include <memory>
+#include <string>
 #include <stdint.h>
 
 /**
@@ -57,14 +61,15 @@
  *      ncount = \lfloor\frac{vco}{EPDF}\rfloor
  * \f]
  * \f[
- *      frac = \lfloor\frac{vco-ncount\times EPDF}{channel\_spacing}\rfloor
+ *      mod = \lfloor\frac{EPDF}{channel\_spacing}+0.5\rfloor
  * \f]
  * \f[
- *      mod = \lfloor\frac{EPDF}{channel\_spacing}+0.5\rfloor
+ *      frac = \lfloor\frac{(vco-ncount\times EPDF)\times mod}{EPDF}+0.5\rfloor
  * \f]
  * 
- * \f$frac\f$ and \f$mod\f$ are a ratio, and can be reduced to the simplest
- * fraction after the calculations above. To compute the output frequency, use
+ * \f$frac\f$ and \f$mod\f$ are a ratio, and are reduced to the simplest
+ * fraction after the calculations above. The calculations are done exactly,
+ * in integer Hz, by FrequencyPlanner. To compute the output frequency, use
  * the following equation.
  * 
  * \f[
@@ -123,11 +128,207 @@ public:
         uint16_t max;
     };
 
+    /**
+     * Everything the protocol exposes about a board, as captured by
+     * snapshot(). Arrays are indexed by synthesizer, A then B.
+     **/
+    struct board_state
+    {
+        ValonFrame::register_image regs[2];
+        vco_range vcor[2];
+        char label[2][16];
+        uint32_t reference;
+        bool e_not_i;
+    };
+
+    /**
+     * A register block write encoded ahead of time, so that sending it is a
+     * single serial transaction with no computation.
+     **/
+    struct staged_write
+    {
+        Synthesizer synth;
+        ValonFrame::register_image image;
+        ValonFrame::write_registers::frame frame;
+    };
+
+    /**
+     * What identifies a board, as read by identify().
+     **/
+    struct identity
+    {
+        char label[2][16];
+        uint32_t reference;
+    };
+
+    /**
+     * Size of a board_state packed by encode_state().
+     **/
+    enum { STATE_SIZE = 1 + 2 * 24 + 2 * 4 + 2 * 16 + 4 + 1 };
+
     /**
      * Constructor.
      * @param[in] port The filename of the serial port device node.
+     * @param[in] state_dir If not NULL, a directory in which to keep a copy
+     *                      of the shadow state between processes. See the
+     *                      section on the register cache.
+     **/
+    ValonSynth(const char *port, const char *state_dir = NULL);
+
+    /**
+     * Constructor for a connection over another transport, such as a
+     * SerialReplay. No state file is kept.
+     * @param[in] transport The port to use; the ValonSynth takes ownership.
+     **/
+    explicit ValonSynth(Serial *transport);
+
+    /**
+     * Check that the serial port was opened successfully.
+     * @return True if the port is open.
+     **/
+    bool is_open();
+
+    /**
+     * Request exclusive use of the serial port. While set, further opens of
+     * the device node by other processes fail.
+     * @param[in] exclusive True to lock the port, false to release it.
+     * @return True on successful completion.
+     **/
+    bool set_exclusive(bool exclusive);
+
+    /**
+     * Record all traffic with the synthesizer to a file, for later analysis
+     * with valontrace or playback with SerialReplay.
+     * @param[in] path The trace file, or NULL to stop recording.
+     * @return True on successful completion.
      **/
-    ValonSynth(const char *port);
+    bool set_trace(const char *path);
+
+    /**
+     * Set how long to wait for each reply from the synthesizer before giving
+     * up on the command. The default is 200ms.
+     * @param[in] timeout_usec The reply timeout in microseconds.
+     **/
+    void set_timeout(int timeout_usec);
+
+    /**
+     * Check the checksum of every reply. On by default. When off, a reply
+     * missing only its checksum byte is accepted.
+     * @param[in] verify True to check checksums.
+     **/
+    void set_verify_checksums(bool verify);
+
+    /**
+     * Set how many times a failed exchange is retried. The default is 2.
+     *
+     * After a short, garbled or refused reply the link is brought back into
+     * step before retrying: whatever is still arriving is drained, the input
+     * buffer is flushed, and the reference is read and checked. A stray or
+     * corrupted byte therefore costs a few milliseconds rather than leaving
+     * every later reply out of step.
+     * @param[in] count Retries after the first attempt; 0 disables them.
+     **/
+    void set_retries(int count);
+
+    /**
+     * Why an exchange with the synthesizer failed.
+     **/
+    enum error_code
+    {
+        NO_ERROR,       ///< The last exchange succeeded
+        PORT_ERROR,     ///< The port could not be set up
+        SHORT_WRITE,    ///< The request could not be written
+        REPLY_TIMEOUT,  ///< The reply was missing or short
+        REPLY_NACK,     ///< The synthesizer refused a command
+        REPLY_CHECKSUM, ///< The reply failed its checksum
+        RESYNC_FAILED   ///< The link could not be brought back into step
+    };
+
+    /**
+     * Receives each failure as it happens.
+     * @param[in] context As given to set_error_handler().
+     * @param[in] vs The synthesizer whose exchange failed.
+     * @param[in] code What went wrong.
+     * @param[in] detail The opcode of the failed exchange, or the
+     *                   Serial::error_codes value for PORT_ERROR.
+     **/
+    typedef void (*error_handler)(void *context, ValonSynth &vs,
+                                  error_code code, int detail);
+
+    /**
+     * Report every failed attempt, including those later retried, and
+     * every port error to handler rather than to cerr. The handler runs on
+     * the thread making the call, in the middle of the exchange, so it
+     * must be quick; ValonRealtime::error_ring records them without
+     * blocking.
+     * @param[in] handler The handler, or NULL to stop reporting.
+     * @param[in] context Passed to the handler.
+     **/
+    void set_error_handler(error_handler handler, void *context);
+
+    /**
+     * @return Why the last attempt of the last exchange failed, or
+     *         NO_ERROR if it succeeded.
+     **/
+    error_code last_error() const;
+
+    /**
+     * What one exchange with the synthesizer cost, including its retries.
+     **/
+    struct exchange
+    {
+        uint8_t opcode;     ///< The first opcode sent
+        uint32_t written;   ///< Bytes written over all attempts
+        uint32_t read;      ///< Bytes read over all attempts
+        uint32_t attempts;
+        int64_t duration;   ///< Nanoseconds from the first write to the end
+        error_code result;  ///< Why the last attempt failed, or NO_ERROR
+    };
+
+    /**
+     * Watches a synthesizer for monitoring. Every method is called on the
+     * thread using the synthesizer, in the middle of the operation, so
+     * overrides must be quick and must not call back into it. The
+     * defaults do nothing.
+     **/
+    class observer
+    {
+    public:
+        virtual ~observer() {}
+
+        /**
+         * An exchange finished, successfully or not.
+         **/
+        virtual void exchanged(ValonSynth &vs, const exchange &e);
+
+        /**
+         * An attempt failed; as for error_handler.
+         **/
+        virtual void failed(ValonSynth &vs, error_code code, int detail);
+
+        /**
+         * A read was answered from the shadow copy (hit) or needed a query
+         * (miss).
+         * @param[in] opcode The query that was or would have been sent.
+         **/
+        virtual void cache_used(ValonSynth &vs, uint8_t opcode, bool hit);
+
+        /**
+         * get_phase_lock() saw a synthesizer's lock for the first time, or
+         * saw it change.
+         **/
+        virtual void lock_changed(ValonSynth &vs, Synthesizer synth,
+                                  bool locked);
+    };
+
+    /**
+     * Report exchanges, failures, shadow copy use and lock changes. Port
+     * errors are reported to the observer, and no longer to cerr, as
+     * with set_error_handler().
+     * @param[in] o The observer, or NULL for none. It must outlive its use
+     *              here.
+     **/
+    void set_observer(observer *o);
 
     /**
      * \name Methods relating to output frequency
@@ -148,6 +349,15 @@ public:
      * @return True on succesful completion.
      **/
     bool get_frequency(enum Synthesizer synth, float &frequency);
+
+    /**
+     * Read the current settings from the synthesizer.
+     * @param[in] synth The synthesizer to be read.
+     * @param[out] frequency Receives the exact frequency in Hz.
+     * @return True on succesful completion.
+     **/
+    bool get_frequency(enum Synthesizer synth,
+                       FrequencyPlanner::rational &frequency);
     
     /**
      * Set the synthesizer to the desired frequency, or best approximation based
@@ -155,11 +365,137 @@ public:
      * @param[in] synth The synthesizer to be set.
      * @param[in] frequency The desired output frequency in MHz. The range is
      *                      determined by the minimum and maximum VCO frequency.
-     * @param[in] chan_spacing The "resolution" of the synthesizer.
+     * @param[in] chan_spacing The "resolution" of the synthesizer. 0 selects
+     *                         the closest frequency the 12-bit modulus allows.
      **/
     bool set_frequency(enum Synthesizer synth, float frequency,
                        float chan_spacing = 10.0f);
 
+    /**
+     * Set the synthesizer to the desired frequency, or best approximation based
+     * on channel spacing, using exact integer arithmetic.
+     * @param[in] synth The synthesizer to be set.
+     * @param[in] frequency The desired output frequency in Hz.
+     * @param[in] chan_spacing The "resolution" of the synthesizer in Hz. 0
+     *                         selects the closest frequency the 12-bit modulus
+     *                         allows.
+     * @param[out] t Receives the register values written and the exact
+     *               frequency they produce.
+     * @return True on successful completion.
+     **/
+    bool set_frequency(enum Synthesizer synth, uint64_t frequency,
+                       uint32_t chan_spacing, FrequencyPlanner::tuning &t);
+
+    /**
+     * Read both synthesizers' frequencies in a single exchange. The register
+     * blocks, and the reference if it is not yet known, are all requested
+     * before any reply is awaited.
+     * @param[out] frequency_a, frequency_b Receive the frequencies in MHz.
+     * @return True on successful completion.
+     **/
+    bool get_frequency_pair(float &frequency_a, float &frequency_b);
+
+    /**
+     * As above, giving the exact frequencies in Hz.
+     **/
+    bool get_frequency_pair(FrequencyPlanner::rational &frequency_a,
+                            FrequencyPlanner::rational &frequency_b);
+
+    /**
+     * Set both synthesizers at once. Everything needed for both changes is
+     * read in one exchange, the reference is shared between the two
+     * calculations, and both register writes are sent back to back before
+     * either ACK is awaited. A write that would change nothing is skipped as
+     * usual.
+     * @param[in] frequency_a, frequency_b The desired frequencies in MHz.
+     * @param[in] chan_spacing As for set_frequency, for both synthesizers.
+     * @return True if both synthesizers were set.
+     **/
+    bool set_frequency_pair(float frequency_a, float frequency_b,
+                            float chan_spacing = 10.0f);
+
+    /**
+     * As above, using exact integer arithmetic.
+     * @param[in] frequency_a, frequency_b The desired frequencies in Hz.
+     * @param[in] chan_spacing The channel spacing in Hz.
+     * @param[out] ta, tb Receive the register values and exact frequencies.
+     * @return True if both synthesizers were set.
+     **/
+    bool set_frequency_pair(uint64_t frequency_a, uint64_t frequency_b,
+                            uint32_t chan_spacing,
+                            FrequencyPlanner::tuning &ta,
+                            FrequencyPlanner::tuning &tb);
+
+    /**
+     * Compute the register values for many frequencies at once, against the
+     * synthesizer's current reference, options and VCO range. Nothing is
+     * written to the synthesizer.
+     * @param[in] synth The synthesizer the frequencies are meant for.
+     * @param[in] frequency The desired output frequencies in Hz.
+     * @param[in] count The number of frequencies.
+     * @param[in] chan_spacing As for set_frequency.
+     * @param[out] out Receives the register values for each frequency.
+     * @param[out] blocks If not NULL, receives a 24 byte register block per
+     *                    frequency, laid out as the synthesizer expects it.
+     *                    Blocks for invalid entries are the current registers.
+     * @return The number of frequencies the synthesizer can produce, or 0 if
+     *         the synthesizer could not be read.
+     **/
+    size_t plan_frequencies(enum Synthesizer synth, const uint64_t *frequency,
+                            size_t count, uint32_t chan_spacing,
+                            FrequencyPlanner::batch &out,
+                            uint8_t *blocks = NULL);
+
+    /**
+     * \}
+     * \name Methods relating to staged writes
+     * 
+     * Staging does all the reading and calculation for a change up front;
+     * commit() then sends the prepared frame and waits for its ACK. This
+     * keeps the time a change takes short and predictable.
+     * \{
+     **/
+
+    /**
+     * Prepare a frequency change without sending it.
+     * @param[in] synth, frequency, chan_spacing As for set_frequency.
+     * @param[out] w Receives the prepared write.
+     * @param[out] t Receives the register values and exact frequency.
+     * @return True if the registers were read and the frequency can be
+     *         produced.
+     **/
+    bool stage_frequency(enum Synthesizer synth, uint64_t frequency,
+                         uint32_t chan_spacing, staged_write &w,
+                         FrequencyPlanner::tuning &t);
+
+    /**
+     * Read a synthesizer's register block, from the shadow copy when
+     * caching is enabled.
+     * @param[in] synth The synthesizer to read.
+     * @param[out] image Receives the register block.
+     * @return True on successful completion.
+     **/
+    bool get_registers(enum Synthesizer synth,
+                       ValonFrame::register_image &image);
+
+    /**
+     * Prepare a write of a complete register block.
+     * @param[in] synth The synthesizer to write.
+     * @param[in] image The register block.
+     * @param[out] w Receives the prepared write.
+     **/
+    static void stage_registers(enum Synthesizer synth,
+                                const ValonFrame::register_image &image,
+                                staged_write &w);
+
+    /**
+     * Send a prepared write. It is always sent, even if the shadow copy
+     * shows the board already holds the values.
+     * @param[in] w The prepared write.
+     * @return True if the synthesizer acknowledged it.
+     **/
+    bool commit(const staged_write &w);
+
     /**
      * \}
      * \name Methods relating to the reference frequency
@@ -352,10 +688,182 @@ public:
      **/
     bool flash();
 
-private:
-    enum { ACK  = 0x06,
-           NACK = 0x15 };
+    /**
+     * Read both labels and the reference frequency in a single exchange,
+     * sending all three queries before waiting for any reply. The checksums
+     * are always verified, so anything other than a synthesizer on the port
+     * is rejected.
+     * @param[out] id Receives the labels and reference frequency.
+     * @return True if all three replies arrived with valid checksums.
+     **/
+    bool identify(identity &id);
+
+    /**
+     * \name Methods relating to snapshots
+     * \{
+     **/
+
+    /**
+     * Read the complete state of both synthesizers.
+     * @param[out] state Receives the register blocks, VCO ranges, labels,
+     *                   reference frequency and reference source.
+     * @return True on successful completion.
+     **/
+    bool snapshot(board_state &state);
+
+    /**
+     * Return the board to a state captured by snapshot(). The current state
+     * is read first and only the values that differ are written.
+     * @param[in] state The state to restore.
+     * @return True on successful completion.
+     **/
+    bool restore(const board_state &state);
+
+    /**
+     * Return the board to a state, given the state it is in now.
+     * @param[in] state The state to restore.
+     * @param[in] now The current state, as read by snapshot().
+     * @return True on successful completion.
+     **/
+    bool restore(const board_state &state, const board_state &now);
+
+    /**
+     * Pack a board state into STATE_SIZE bytes, big-endian, starting with a
+     * format version byte.
+     * @param[in] state The state to pack.
+     * @param[out] bytes Receives STATE_SIZE bytes.
+     **/
+    static void encode_state(const board_state &state, uint8_t *bytes);
+
+    /**
+     * Unpack a board state packed by encode_state().
+     * @param[in] bytes STATE_SIZE bytes.
+     * @param[out] state Receives the state.
+     * @return False if the format version is not recognized.
+     **/
+    static bool decode_state(const uint8_t *bytes, board_state &state);
+
+    /**
+     * \}
+     **/
+
+    /**
+     * \name Methods for editing register images offline
+     * 
+     * These change a register block the way the corresponding setters do,
+     * without talking to the board, for use with snapshot() and restore().
+     * \{
+     **/
+
+    /**
+     * Set the frequency fields of a register block.
+     * @param[in,out] image The register block, whose options are used.
+     * @param[in] reference The reference frequency in Hz.
+     * @param[in] vcor The VCO range.
+     * @param[in] frequency, chan_spacing As for set_frequency.
+     * @param[out] t Receives the register values and exact frequency.
+     * @return True if the frequency can be produced.
+     **/
+    static bool image_frequency(ValonFrame::register_image &image,
+                                uint32_t reference, const vco_range &vcor,
+                                uint64_t frequency, uint32_t chan_spacing,
+                                FrequencyPlanner::tuning &t);
+
+    /**
+     * The output frequency a register block produces.
+     * @param[in] image The register block.
+     * @param[in] reference The reference frequency in Hz.
+     * @return The exact frequency in Hz.
+     **/
+    static FrequencyPlanner::rational
+    image_output(const ValonFrame::register_image &image, uint32_t reference);
 
+    /**
+     * Set the RF level field of a register block.
+     * @return False if rf_level is not -4, -1, 2 or 5 dBm.
+     **/
+    static bool image_rf_level(ValonFrame::register_image &image,
+                               int32_t rf_level);
+
+    /**
+     * Set the option fields of a register block.
+     **/
+    static void image_options(ValonFrame::register_image &image,
+                              const options &opts);
+
+    /**
+     * Read the option fields of a register block.
+     **/
+    static void unpack_options(const ValonFrame::register_image &image,
+                               options &opts);
+
+    /**
+     * \}
+     **/
+
+    /**
+     * \name Methods relating to the register cache
+     * 
+     * A shadow copy of each synthesizer's register block, the reference
+     * frequency and the VCO ranges is kept up to date on every successful
+     * read and write. When caching is enabled, reads of these values are
+     * answered from the shadow copy without a serial transaction. Phase lock,
+     * reference select and labels are always read from the hardware.
+     * 
+     * Writes of the register blocks, reference frequency and VCO ranges are
+     * skipped when the shadow copy shows the board already holds the values
+     * being written, unless forced with set_force_writes(). Setters that
+     * read before writing compare against what they just read, and the
+     * reference frequency and VCO ranges are only compared with caching
+     * enabled, so with caching disabled this never skips a write that would
+     * change the board.
+     * 
+     * Caching is only safe while this object is the sole user of the board.
+     * 
+     * Given a state directory, the shadow copy is saved to a file named after
+     * the port whenever it changes, along with the label of synthesizer A.
+     * When caching is first enabled the file is loaded and the label of
+     * synthesizer A read from the board; if they match, the shadow copy is
+     * taken from the file, so the first reads need no serial transactions.
+     * \{
+     **/
+
+    /**
+     * Enable or disable answering reads from the shadow copy.
+     * @param[in] enable True to enable caching.
+     **/
+    void set_caching(bool enable);
+
+    /**
+     * Send writes even when the shadow copy shows they would change nothing.
+     * @param[in] force True to always write.
+     **/
+    void set_force_writes(bool force);
+
+    /**
+     * @return True if the most recent write was skipped because the board
+     *         already held the values.
+     **/
+    bool last_write_skipped();
+
+    /**
+     * Discard the shadow copy. The next read of each value goes to the
+     * hardware.
+     **/
+    void invalidate();
+
+    /**
+     * Re-read the register blocks, reference frequency and VCO ranges from
+     * the hardware into the shadow copy.
+     * @return True on successful completion.
+     **/
+    bool refresh();
+
+    /**
+     * \}
+     **/
+
+private:
     struct registers
     {
         uint32_t ncount;
@@ -364,25 +872,179 @@ private:
         uint32_t dbf;
     };
 
-    // Calculate effective phase detector frequency
-    float getEPDF(enum Synthesizer synth);
+    // Shadow copy of the board state, indexed by synth >> 3
+    struct shadow
+    {
+        ValonFrame::register_image regs;
+        bool regs_valid;
+        vco_range vcor;
+        bool vcor_valid;
+    };
+
+    // Register block transfers, kept in step with the shadow copy
+    bool read_registers(enum Synthesizer synth,
+                        ValonFrame::register_image &regs);
+    bool write_registers(enum Synthesizer synth,
+                         const ValonFrame::register_image &regs);
 
-    // Checksum
-    uint8_t generate_checksum(const uint8_t*, size_t);
-    bool verify_checksum(const uint8_t*, size_t, uint8_t);
+    // A single query or command frame exchange
+    template<class Query>
+    bool query(typename Query::reply_frame &reply, uint8_t synth = 0);
+    template<class Command>
+    bool command(const typename Command::payload &data, uint8_t synth = 0);
+    bool send_frame(const uint8_t *frame, size_t size);
+
+    // Runs an exchange until it succeeds, resynchronizing between attempts
+    // unless retry is false. An attempt that fails says why through
+    // failed(), and each failure is reported with the opcode.
+    template<class Attempt>
+    bool with_retries(uint8_t opcode, Attempt attempt, bool retry = true);
+    bool failed(error_code code);
+    bool resync();
+    void report(error_code code, int detail);
+
+    // All port traffic goes through these, so that exchanges can be
+    // measured for the observer
+    int transmit(const uint8_t *data, size_t size);
+    int receive(uint8_t *data, size_t size, int timeout_usec);
+    void cache_used(uint8_t opcode, bool hit);
+    static int64_t monotonic_ns();
+    static void report_port_error(void *context, Serial::error_codes code,
+                                  int error_number);
+    // Port errors go through report() while either hook is set, and to
+    // cerr otherwise
+    void forward_port_errors();
+    enum { RESYNC_ATTEMPTS = 3, RESYNC_QUIET_USEC = 5000 };
+
+    // Brings the register blocks of both synthesizers, the reference and,
+    // if asked, both VCO ranges into the shadow copy with one burst of
+    // queries, skipping whatever the shadow copy can already answer
+    bool read_pair(bool vco_ranges, ValonFrame::register_image image[2],
+                   uint32_t &reference);
+
+    // Reads the registers into bytes and fills in the frequency calculation
+    // settings for them
+    bool tuning_config(enum Synthesizer synth, uint32_t chan_spacing,
+                       ValonFrame::register_image &image,
+                       FrequencyPlanner::config &cfg);
+
+    // Frequency calculation settings for a reference and options
+    static void planner_config(uint32_t reference, const options &opts,
+                               FrequencyPlanner::config &cfg);
 
     // Register formatting
-    void pack_freq_registers(const registers &regs, uint8_t *bytes);
-    void unpack_freq_registers(const uint8_t *bytes, registers &regs);
+    static void pack_freq_registers(const registers &regs,
+                                    ValonFrame::register_image &image);
+    static void unpack_freq_registers(const ValonFrame::register_image &image,
+                                      registers &regs);
+    static void pack_tuning(const FrequencyPlanner::tuning &t,
+                            ValonFrame::register_image &image);
 
-    void pack_int(uint32_t num, uint8_t *bytes);
-    void pack_short(uint16_t num, uint8_t *bytes);
-    void unpack_int(const uint8_t *bytes, uint32_t &num);
-    void unpack_short(const uint8_t *bytes, uint16_t &num);
-    
-    Serial s;
+    std::unique_ptr<Serial> transport;
+    Serial &s;
+
+    shadow cache[2];
+    uint32_t cached_reference;
+    bool reference_valid;
+    bool caching;
+    bool force_writes;
+    bool write_skipped;
+    int timeout;
+    bool verify_checksums;
+    int retries;
+    error_code failure;
+    error_handler on_error;
+    void *error_context;
+    observer *watcher;
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    // Last lock state seen by get_phase_lock, indexed by synth >> 3; -1
+    // until first read
+    int8_t last_lock[2];
+
+    // Shadow state persisted between processes
+    enum { STATE_FILE_SIZE = 1 + 16 + 2 * 24 + 2 * 4 + 4 };
+    void load_state();
+    void save_state();
+    std::string state_path;
+    std::string state_temp_path;
+    char state_label[16];
+    bool state_label_valid;
+    bool state_loaded;
+    uint8_t saved_state[STATE_FILE_SIZE];
 };
 
+inline bool
+ValonSynth::is_open()
+{
+    return s.is_open();
+}
+
+inline void
+ValonSynth::set_timeout(int timeout_usec)
+{
+    timeout = timeout_usec;
+}
+
+inline void
+ValonSynth::set_verify_checksums(bool verify)
+{
+    verify_checksums = verify;
+}
+
+inline void
+ValonSynth::set_retries(int count)
+{
+    retries = count;
+}
+
+inline ValonSynth::error_code
+ValonSynth::last_error() const
+{
+    return failure;
+}
+
+inline int
+ValonSynth::transmit(const uint8_t *data, size_t size)
+{
+    int n = s.write(data, int(size));
+    if(n > 0) bytes_written += n;
+    return n;
+}
+
+inline int
+ValonSynth::receive(uint8_t *data, size_t size, int timeout_usec)
+{
+    int n = s.read(data, int(size), timeout_usec);
+    if(n > 0) bytes_read += n;
+    return n;
+}
+
+inline void
+ValonSynth::cache_used(uint8_t opcode, bool hit)
+{
+    if(watcher != NULL) watcher->cache_used(*this, opcode, hit);
+}
+
+inline bool
+ValonSynth::failed(error_code code)
+{
+    failure = code;
+    return false;
+}
+
+inline void
+ValonSynth::set_force_writes(bool force)
+{
+    force_writes = force;
+}
+
+inline bool
+ValonSynth::last_write_skipped()
+{
+    return write_skipped;
+}
+
 inline float
 ValonSynth::get_frequency(enum ValonSynth::Synthesizer synth)
 {
@@ -415,6 +1077,13 @@ ValonSynth::get_ref_select()
     return e_not_i;
 }
 
+inline bool
+ValonSynth::get_registers(enum ValonSynth::Synthesizer synth,
+                          ValonFrame::register_image &image)
+{
+    return read_registers(synth, image);
+}
+
 inline bool
 ValonSynth::get_phase_lock(enum ValonSynth::Synthesizer synth)
 {
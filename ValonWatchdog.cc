@@ -0,0 +1,231 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+#include "ValonWatchdog.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+// Time between lock reads while waiting for a rewrite to take
+static const int64_t RELOCK_POLL_NS = 1000000;
+
+static int64_t
+now_ns()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return int64_t(t.tv_sec) * 1000000000 + t.tv_nsec;
+}
+
+ValonWatchdog::ValonWatchdog(ValonSynth &vs, escalation handler,
+                             void *context)
+    :
+    synth(vs),
+    on_escalation(handler),
+    escalation_context(context),
+    interval(100000000),
+    relock(100000000),
+    rewrites(3),
+    stopping(false)
+{
+    for(int i = 0; i < 2; ++i)
+    {
+        watches[i].watched = true;
+        watches[i].escalated = false;
+        watches[i].good_valid = false;
+        watches[i].settle_until = 0;
+    }
+    memset(&count, 0, sizeof(count));
+    worker = std::thread(&ValonWatchdog::run, this);
+}
+
+ValonWatchdog::~ValonWatchdog()
+{
+    {
+        std::lock_guard<std::mutex> hold(lock);
+        stopping = true;
+    }
+    changed.notify_all();
+    worker.join();
+}
+
+void
+ValonWatchdog::set_interval(uint32_t usec)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    interval = int64_t(usec) * 1000;
+    changed.notify_all();
+}
+
+void
+ValonWatchdog::set_relock_deadline(uint32_t usec)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    relock = int64_t(usec) * 1000;
+}
+
+void
+ValonWatchdog::set_rewrites(int n)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    rewrites = n;
+}
+
+void
+ValonWatchdog::set_watched(ValonSynth::Synthesizer s, bool watched)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    watches[s >> 3].watched = watched;
+}
+
+ValonWatchdog::counters
+ValonWatchdog::get_counters()
+{
+    std::lock_guard<std::mutex> hold(lock);
+    return count;
+}
+
+void
+ValonWatchdog::after_call()
+{
+    for(int i = 0; i < 2; ++i)
+    {
+        watch &w = watches[i];
+        ValonFrame::register_image image;
+        if(w.good_valid &&
+           synth.get_registers(ValonSynth::Synthesizer(i << 3), image) &&
+           (image == w.good.image))
+        {
+            continue;
+        }
+        // Retuned, or not known: wait to see what it locks to
+        w.good_valid = false;
+        w.escalated = false;
+        w.settle_until = now_ns() + relock;
+    }
+}
+
+void
+ValonWatchdog::run()
+{
+    std::unique_lock<std::mutex> hold(lock);
+    int64_t next = now_ns();
+    while(!stopping)
+    {
+        int64_t remaining = next - now_ns();
+        if(remaining > 0)
+        {
+            changed.wait_for(hold, std::chrono::nanoseconds(remaining));
+            continue;
+        }
+        // Skip polls missed during a recovery rather than catching up
+        next = std::max(next + interval, now_ns());
+        for(int i = 0; (i < 2) && !stopping; ++i)
+        {
+            if(watches[i].watched) check(i, hold);
+        }
+    }
+}
+
+void
+ValonWatchdog::check(int i, std::unique_lock<std::mutex> &hold)
+{
+    ValonSynth::Synthesizer s = ValonSynth::Synthesizer(i << 3);
+    watch &w = watches[i];
+    bool locked;
+    ++count.polls;
+    if(!synth.get_phase_lock(s, locked))
+    {
+        ++count.failed_polls;
+        return;
+    }
+    if(locked)
+    {
+        w.escalated = false;
+        ValonFrame::register_image image;
+        if(!w.good_valid && synth.get_registers(s, image))
+        {
+            ValonSynth::stage_registers(s, image, w.good);
+            w.good_valid = true;
+        }
+        return;
+    }
+    if(w.escalated || (now_ns() < w.settle_until)) return;
+
+    incident what;
+    what.synth = s;
+    clock_gettime(CLOCK_MONOTONIC, &what.lost);
+    what.relocked.tv_sec = 0;
+    what.relocked.tv_nsec = 0;
+    what.rewrites = 0;
+    what.had_registers = w.good_valid;
+    what.recovered = false;
+    ++count.losses;
+    if(recover(i, what, hold))
+    {
+        ++count.recoveries;
+        return;
+    }
+    // A call() retuned it while the lock was released; let it settle
+    if(what.had_registers && !w.good_valid) return;
+    w.escalated = true;
+    ++count.escalations;
+    if(on_escalation != NULL)
+    {
+        hold.unlock();
+        on_escalation(escalation_context, what);
+        hold.lock();
+    }
+}
+
+bool
+ValonWatchdog::recover(int i, incident &what,
+                       std::unique_lock<std::mutex> &hold)
+{
+    const watch &w = watches[i];
+    for(int k = 0; (k < rewrites) && !stopping && w.good_valid; ++k)
+    {
+        ++what.rewrites;
+        if(!synth.commit(w.good)) continue;
+        int64_t deadline = now_ns() + relock;
+        for(;;)
+        {
+            bool locked;
+            if(synth.get_phase_lock(what.synth, locked) && locked)
+            {
+                clock_gettime(CLOCK_MONOTONIC, &what.relocked);
+                what.recovered = true;
+                return true;
+            }
+            if(now_ns() >= deadline) break;
+            // Let call() in between polls; it may retune the synthesizer
+            hold.unlock();
+            std::this_thread::sleep_for(std::chrono::nanoseconds(
+                std::min(RELOCK_POLL_NS, deadline - now_ns())));
+            hold.lock();
+            if(stopping || !w.good_valid) return false;
+        }
+    }
+    return false;
+}
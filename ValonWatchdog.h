@@ -0,0 +1,192 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#	GBT Operations
+//#	National Radio Astronomy Observatory
+//#	P. O. Box 2
+//#	Green Bank, WV 24944-0002 USA
+
+
+#ifndef VALONWATCHDOG_H
+#define VALONWATCHDOG_H
+
+#include "ValonSynth.h"
+
+#include <time.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+/**
+ * Watches both synthesizers of a board for loss of lock and puts back the
+ * last registers they were locked with.
+ *
+ * A watchdog thread reads each synthesizer's lock bit from the status
+ * query at a fixed interval. Whenever a synthesizer is seen locked its
+ * register block is kept as a prepared write (see
+ * ValonSynth::stage_registers()). When it is seen unlocked that write is
+ * sent again, and the lock polled until a deadline; this repeats a few
+ * times, and if the synthesizer still has not relocked the escalation
+ * handler is called. The synthesizer is not rewritten again until it has
+ * been seen locked.
+ *
+ * While a watchdog exists it must be the only user of its ValonSynth;
+ * other operations, such as retuning, are run through call(). After each
+ * call() the registers are read back, from the shadow copy if caching is
+ * enabled. If they changed, the registers kept for that synthesizer are
+ * forgotten, and since a retune unlocks it for a moment, its unlock is not
+ * acted on until the relock deadline has passed. The watchdog's lock is
+ * released while it waits for a rewrite to take, so call() is not held up
+ * by a recovery; a recovery whose synthesizer is retuned meanwhile is
+ * abandoned without escalating.
+ **/
+class ValonWatchdog
+{
+public:
+    /**
+     * One loss of lock and what was done about it. Times are on
+     * CLOCK_MONOTONIC.
+     **/
+    struct incident
+    {
+        ValonSynth::Synthesizer synth;
+        timespec lost;       ///< When the loss was seen
+        timespec relocked;   ///< When lock was seen again; zero if not
+        int rewrites;        ///< Register writes sent
+        bool had_registers;  ///< False if no locked registers were known
+        bool recovered;
+    };
+
+    /**
+     * What the watchdog has done so far.
+     **/
+    struct counters
+    {
+        unsigned polls;
+        unsigned failed_polls;  ///< Status reads that failed
+        unsigned losses;
+        unsigned recoveries;
+        unsigned escalations;
+    };
+
+    /**
+     * Called from the watchdog thread when a synthesizer cannot be brought
+     * back into lock. The watchdog's lock is not held, so the handler may
+     * use call().
+     * @param[in] context As given to the constructor.
+     * @param[in] what The incident, with recovered false.
+     **/
+    typedef void (*escalation)(void *context, const incident &what);
+
+    /**
+     * Constructor. Starts the watchdog thread.
+     * @param[in] vs The synthesizer to watch.
+     * @param[in] handler Called when recovery fails, or NULL.
+     * @param[in] context Passed to the handler.
+     **/
+    ValonWatchdog(ValonSynth &vs, escalation handler = NULL,
+                  void *context = NULL);
+
+    /**
+     * Destructor. Stops the watchdog thread.
+     **/
+    ~ValonWatchdog();
+
+    /**
+     * Set how often the lock is read. The default is 100ms.
+     * @param[in] usec The interval in microseconds.
+     **/
+    void set_interval(uint32_t usec);
+
+    /**
+     * Set how long a synthesizer is given to relock after each rewrite,
+     * and after each call(). The default is 100ms.
+     * @param[in] usec The deadline in microseconds.
+     **/
+    void set_relock_deadline(uint32_t usec);
+
+    /**
+     * Set how many times the registers are rewritten before escalating.
+     * The default is 3.
+     **/
+    void set_rewrites(int count);
+
+    /**
+     * Choose which synthesizers are watched; both are by default.
+     **/
+    void set_watched(ValonSynth::Synthesizer synth, bool watched);
+
+    /**
+     * @return What the watchdog has done so far.
+     **/
+    counters get_counters();
+
+    /**
+     * Run an operation on the synthesizer between polls.
+     * @param[in] op Called with the synthesizer.
+     * @return What op returns.
+     **/
+    template<class Op>
+    bool call(Op op);
+
+private:
+    ValonWatchdog(const ValonWatchdog &);
+    ValonWatchdog &operator=(const ValonWatchdog &);
+
+    // What is known about one synthesizer
+    struct watch
+    {
+        bool watched;
+        bool escalated;
+        bool good_valid;
+        ValonSynth::staged_write good;
+        int64_t settle_until;  // Unlocks are ignored until then
+    };
+
+    void run();
+    void check(int i, std::unique_lock<std::mutex> &hold);
+    bool recover(int i, incident &what, std::unique_lock<std::mutex> &hold);
+    void after_call();
+
+    ValonSynth &synth;
+    escalation on_escalation;
+    void *escalation_context;
+
+    // Guards everything below and the use of synth
+    std::mutex lock;
+    std::condition_variable changed;
+    watch watches[2];
+    counters count;
+    int64_t interval;
+    int64_t relock;
+    int rewrites;
+    bool stopping;
+    std::thread worker;
+};
+
+template<class Op>
+bool
+ValonWatchdog::call(Op op)
+{
+    std::lock_guard<std::mutex> hold(lock);
+    bool result = op(synth);
+    after_call();
+    return result;
+}
+
+#endif//VALONWATCHDOG_H
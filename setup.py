@@ -8,4 +8,12 @@ setup(name        = 'ValonSynth',
       packages    = ['valon_synth'],
       package_dir = {'valon_synth': 'src'},
       requires    = ['pyserial'],
+      ext_modules = [Extension('valon_synth._valonsynth',
+                               sources = ['src/_valonsynth.cc',
+                                          'ValonSynth.cc', 'Serial.cc',
+                                          'FrequencyPlanner.cc'],
+                               include_dirs = ['.'],
+                               define_macros = [('LINUX', None)],
+                               extra_compile_args = ['-std=c++17'],
+                               libraries = ['stdc++'])],
       )
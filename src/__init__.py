@@ -20,4 +20,14 @@
 #	P. O. Box 2
 #	Green Bank, WV 24944-0002 USA
 
-from valon_synth import Synthesizer, SYNTH_A, SYNTH_B, INT_REF, EXT_REF
+from .valon_synth import Synthesizer, SYNTH_A, SYNTH_B, INT_REF, EXT_REF
+from .valond import DaemonSynthesizer
+try:
+    from ._valonsynth import NativeSynthesizer
+except ImportError:
+    pass
+try:
+    from .async_synth import AsyncSynthesizer
+except SyntaxError:
+    # The asyncio interface requires Python 3.7 or later
+    pass
@@ -0,0 +1,706 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+// Python extension module exposing the C++ ValonSynth class as
+// valon_synth.NativeSynthesizer. The methods take and return the same values
+// as valon_synth.Synthesizer. The interpreter lock is released for every
+// serial transaction, and a per-object mutex serializes access to the port
+// between Python threads.
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "ValonSynth.h"
+
+typedef struct
+{
+    PyObject_HEAD
+    ValonSynth *synth;
+    pthread_mutex_t lock;
+} NativeSynthesizer;
+
+// Run a ValonSynth call with the interpreter lock released; the mutex may
+// be held by a thread waiting on the port, so it is never taken while
+// holding the interpreter lock
+#define SYNTH_CALL(self, ok, call)                  \
+    Py_BEGIN_ALLOW_THREADS                          \
+    pthread_mutex_lock(&(self)->lock);              \
+    ok = (self)->synth->call;                       \
+    pthread_mutex_unlock(&(self)->lock);            \
+    Py_END_ALLOW_THREADS
+
+// The same for calls with no result
+#define SYNTH_DO(self, call)                        \
+    Py_BEGIN_ALLOW_THREADS                          \
+    pthread_mutex_lock(&(self)->lock);              \
+    (self)->synth->call;                            \
+    pthread_mutex_unlock(&(self)->lock);            \
+    Py_END_ALLOW_THREADS
+
+static PyObject *
+io_error()
+{
+    PyErr_SetString(PyExc_IOError, "No valid reply from synthesizer");
+    return NULL;
+}
+
+// Raises unless __init__ has opened the port
+static bool
+is_ready(NativeSynthesizer *self)
+{
+    if(self->synth != NULL) return true;
+    PyErr_SetString(PyExc_IOError, "Synthesizer port is not open");
+    return false;
+}
+
+static enum ValonSynth::Synthesizer
+to_synth(int synth)
+{
+    return synth ? ValonSynth::B : ValonSynth::A;
+}
+
+// Frequencies cross to the exact integer overloads in whole Hz, rounded to
+// nearest; false if the value is out of range (or NaN) for the type
+static bool
+to_hz(double mhz, uint64_t &hz)
+{
+    double value = round(mhz * 1e6);
+    if(!((value > 0.0) && (value < 18446744073709551616.0))) return false;
+    hz = uint64_t(value);
+    return true;
+}
+
+static bool
+to_hz(double mhz, uint32_t &hz)
+{
+    double value = round(mhz * 1e6);
+    if(!((value >= 0.0) && (value < 4294967296.0))) return false;
+    hz = uint32_t(value);
+    return true;
+}
+
+static double
+to_mhz(const FrequencyPlanner::rational &frequency)
+{
+    return FrequencyPlanner::to_hz(frequency) / 1e6;
+}
+
+//----------------//
+// Object Methods //
+//----------------//
+static int
+NativeSynthesizer_init(NativeSynthesizer *self, PyObject *args,
+                       PyObject *kwds)
+{
+    static const char *kwlist[] = {"port", "state_dir", NULL};
+    const char *port;
+    const char *state_dir = NULL;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "s|z", (char **)kwlist,
+                                    &port, &state_dir))
+    {
+        return -1;
+    }
+    ValonSynth *synth;
+    ValonSynth *old;
+    bool open;
+    int error_number;
+    Py_BEGIN_ALLOW_THREADS
+    synth = new ValonSynth(port, state_dir);
+    open = synth->is_open();
+    error_number = errno;
+    if(!open)
+    {
+        delete synth;
+        synth = NULL;
+    }
+    pthread_mutex_lock(&self->lock);
+    old = self->synth;
+    self->synth = synth;
+    pthread_mutex_unlock(&self->lock);
+    delete old;
+    Py_END_ALLOW_THREADS
+    if(!open)
+    {
+        errno = error_number;
+        PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *)port);
+        return -1;
+    }
+    return 0;
+}
+
+static PyObject *
+NativeSynthesizer_new(PyTypeObject *type, PyObject *, PyObject *)
+{
+    NativeSynthesizer *self = (NativeSynthesizer *)type->tp_alloc(type, 0);
+    if(self != NULL)
+    {
+        self->synth = NULL;
+        pthread_mutex_init(&self->lock, NULL);
+    }
+    return (PyObject *)self;
+}
+
+static void
+NativeSynthesizer_dealloc(NativeSynthesizer *self)
+{
+    delete self->synth;
+    pthread_mutex_destroy(&self->lock);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+//------------------//
+// Output Frequency //
+//------------------//
+static PyObject *
+get_frequency(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    FrequencyPlanner::rational frequency;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "i", &synth)) return NULL;
+    SYNTH_CALL(self, ok, get_frequency(to_synth(synth), frequency));
+    if(!ok) return io_error();
+    return PyFloat_FromDouble(to_mhz(frequency));
+}
+
+static PyObject *
+set_frequency(NativeSynthesizer *self, PyObject *args, PyObject *kwds)
+{
+    if(!is_ready(self)) return NULL;
+    static const char *kwlist[] = {"synth", "freq", "chan_spacing", NULL};
+    int synth;
+    double frequency;
+    double chan_spacing = 10.0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "id|d", (char **)kwlist,
+                                    &synth, &frequency, &chan_spacing))
+    {
+        return NULL;
+    }
+    uint64_t hz;
+    uint32_t spacing_hz;
+    if(!to_hz(frequency, hz) || !to_hz(chan_spacing, spacing_hz))
+    {
+        Py_RETURN_FALSE;
+    }
+    FrequencyPlanner::tuning t;
+    bool ok;
+    SYNTH_CALL(self, ok, set_frequency(to_synth(synth), hz, spacing_hz, t));
+    return PyBool_FromLong(ok);
+}
+
+static PyObject *
+get_frequency_pair(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    FrequencyPlanner::rational frequency_a, frequency_b;
+    bool ok;
+    SYNTH_CALL(self, ok, get_frequency_pair(frequency_a, frequency_b));
+    if(!ok) return io_error();
+    return Py_BuildValue("(dd)", to_mhz(frequency_a), to_mhz(frequency_b));
+}
+
+static PyObject *
+set_frequency_pair(NativeSynthesizer *self, PyObject *args, PyObject *kwds)
+{
+    if(!is_ready(self)) return NULL;
+    static const char *kwlist[] = {"freq_a", "freq_b", "chan_spacing", NULL};
+    double frequency_a, frequency_b;
+    double chan_spacing = 10.0;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "dd|d", (char **)kwlist,
+                                    &frequency_a, &frequency_b,
+                                    &chan_spacing))
+    {
+        return NULL;
+    }
+    uint64_t hz_a, hz_b;
+    uint32_t spacing_hz;
+    if(!to_hz(frequency_a, hz_a) || !to_hz(frequency_b, hz_b) ||
+       !to_hz(chan_spacing, spacing_hz))
+    {
+        Py_RETURN_FALSE;
+    }
+    FrequencyPlanner::tuning ta, tb;
+    bool ok;
+    SYNTH_CALL(self, ok, set_frequency_pair(hz_a, hz_b, spacing_hz, ta, tb));
+    return PyBool_FromLong(ok);
+}
+
+//---------------------//
+// Reference Frequency //
+//---------------------//
+static PyObject *
+get_reference(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    uint32_t reference;
+    bool ok;
+    SYNTH_CALL(self, ok, get_reference(reference));
+    if(!ok) return io_error();
+    return PyLong_FromUnsignedLong(reference);
+}
+
+static PyObject *
+set_reference(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    unsigned long reference;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "k", &reference)) return NULL;
+    SYNTH_CALL(self, ok, set_reference(reference));
+    return PyBool_FromLong(ok);
+}
+
+//----------//
+// RF Level //
+//----------//
+static PyObject *
+get_rf_level(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    int32_t rf_level;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "i", &synth)) return NULL;
+    SYNTH_CALL(self, ok, get_rf_level(to_synth(synth), rf_level));
+    if(!ok) return io_error();
+    return PyLong_FromLong(rf_level);
+}
+
+static PyObject *
+set_rf_level(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    int rf_level;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "ii", &synth, &rf_level)) return NULL;
+    SYNTH_CALL(self, ok, set_rf_level(to_synth(synth), rf_level));
+    return PyBool_FromLong(ok);
+}
+
+//---------//
+// Options //
+//---------//
+static PyObject *
+get_options(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    ValonSynth::options opts;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "i", &synth)) return NULL;
+    SYNTH_CALL(self, ok, get_options(to_synth(synth), opts));
+    if(!ok) return io_error();
+    return Py_BuildValue("(iiki)", int(opts.double_ref), int(opts.half_ref),
+                         (unsigned long)opts.r, int(opts.low_spur));
+}
+
+static PyObject *
+set_options(NativeSynthesizer *self, PyObject *args, PyObject *kwds)
+{
+    if(!is_ready(self)) return NULL;
+    static const char *kwlist[] = {"synth", "double", "half", "divider",
+                                   "low_spur", NULL};
+    int synth;
+    int double_ref = 0;
+    int half_ref = 0;
+    unsigned long divider = 1;
+    int low_spur = 0;
+    bool ok;
+    if(!PyArg_ParseTupleAndKeywords(args, kwds, "i|iiki", (char **)kwlist,
+                                    &synth, &double_ref, &half_ref, &divider,
+                                    &low_spur))
+    {
+        return NULL;
+    }
+    ValonSynth::options opts;
+    opts.double_ref = double_ref;
+    opts.half_ref = half_ref;
+    opts.r = divider;
+    opts.low_spur = low_spur;
+    SYNTH_CALL(self, ok, set_options(to_synth(synth), opts));
+    return PyBool_FromLong(ok);
+}
+
+//------------------//
+// Reference Select //
+//------------------//
+static PyObject *
+get_ref_select(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    bool e_not_i;
+    bool ok;
+    SYNTH_CALL(self, ok, get_ref_select(e_not_i));
+    if(!ok) return io_error();
+    return PyLong_FromLong(e_not_i);
+}
+
+static PyObject *
+set_ref_select(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int e_not_i = 1;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "|i", &e_not_i)) return NULL;
+    SYNTH_CALL(self, ok, set_ref_select(e_not_i & 1));
+    return PyBool_FromLong(ok);
+}
+
+//-----------//
+// VCO Range //
+//-----------//
+static PyObject *
+get_vco_range(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    ValonSynth::vco_range vcor;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "i", &synth)) return NULL;
+    SYNTH_CALL(self, ok, get_vco_range(to_synth(synth), vcor));
+    if(!ok) return io_error();
+    return Py_BuildValue("(ii)", int(vcor.min), int(vcor.max));
+}
+
+static PyObject *
+set_vco_range(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    ValonSynth::vco_range vcor;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "iHH", &synth, &vcor.min, &vcor.max))
+    {
+        return NULL;
+    }
+    SYNTH_CALL(self, ok, set_vco_range(to_synth(synth), vcor));
+    return PyBool_FromLong(ok);
+}
+
+//------------//
+// Phase Lock //
+//------------//
+static PyObject *
+get_phase_lock(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    bool locked;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "i", &synth)) return NULL;
+    SYNTH_CALL(self, ok, get_phase_lock(to_synth(synth), locked));
+    if(!ok) return io_error();
+    return PyBool_FromLong(locked);
+}
+
+//--------//
+// Labels //
+//--------//
+static PyObject *
+get_label(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    char label[16];
+    bool ok;
+    if(!PyArg_ParseTuple(args, "i", &synth)) return NULL;
+    SYNTH_CALL(self, ok, get_label(to_synth(synth), label));
+    if(!ok) return io_error();
+    return PyBytes_FromStringAndSize(label, 16);
+}
+
+static PyObject *
+set_label(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int synth;
+    const char *text;
+    Py_ssize_t length;
+    char label[16];
+    bool ok;
+    if(!PyArg_ParseTuple(args, "is#", &synth, &text, &length)) return NULL;
+    memset(label, 0, sizeof(label));
+    memcpy(label, text, length < 16 ? length : 16);
+    SYNTH_CALL(self, ok, set_label(to_synth(synth), label));
+    return PyBool_FromLong(ok);
+}
+
+//-------//
+// Flash //
+//-------//
+static PyObject *
+flash(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    bool ok;
+    SYNTH_CALL(self, ok, flash());
+    return PyBool_FromLong(ok);
+}
+
+//-----------//
+// Snapshots //
+//-----------//
+static PyObject *
+snapshot(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    ValonSynth::board_state state;
+    uint8_t bytes[ValonSynth::STATE_SIZE];
+    bool ok;
+    SYNTH_CALL(self, ok, snapshot(state));
+    if(!ok) return io_error();
+    ValonSynth::encode_state(state, bytes);
+    return PyBytes_FromStringAndSize((const char *)bytes, sizeof(bytes));
+}
+
+static PyObject *
+restore(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    const char *bytes;
+    Py_ssize_t length;
+    ValonSynth::board_state state;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "s#", &bytes, &length)) return NULL;
+    if((length != ValonSynth::STATE_SIZE) ||
+       !ValonSynth::decode_state((const uint8_t *)bytes, state))
+    {
+        PyErr_SetString(PyExc_ValueError, "Not a ValonSynth snapshot");
+        return NULL;
+    }
+    SYNTH_CALL(self, ok, restore(state));
+    return PyBool_FromLong(ok);
+}
+
+//-------------------------//
+// Register Cache, Timeout //
+//-------------------------//
+static PyObject *
+set_caching(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int enable;
+    if(!PyArg_ParseTuple(args, "i", &enable)) return NULL;
+    SYNTH_DO(self, set_caching(enable));
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+set_force_writes(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int force;
+    if(!PyArg_ParseTuple(args, "i", &force)) return NULL;
+    SYNTH_DO(self, set_force_writes(force));
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+last_write_skipped(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    bool skipped;
+    SYNTH_CALL(self, skipped, last_write_skipped());
+    return PyBool_FromLong(skipped);
+}
+
+static PyObject *
+set_verify_checksums(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int verify;
+    if(!PyArg_ParseTuple(args, "i", &verify)) return NULL;
+    SYNTH_DO(self, set_verify_checksums(verify));
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+set_retries(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    int count;
+    if(!PyArg_ParseTuple(args, "i", &count)) return NULL;
+    SYNTH_DO(self, set_retries(count));
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+set_trace(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    const char *path;
+    bool ok;
+    if(!PyArg_ParseTuple(args, "z", &path)) return NULL;
+    SYNTH_CALL(self, ok, set_trace(path));
+    return PyBool_FromLong(ok);
+}
+
+static PyObject *
+invalidate(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    SYNTH_DO(self, invalidate());
+    Py_RETURN_NONE;
+}
+
+static PyObject *
+refresh(NativeSynthesizer *self, PyObject *)
+{
+    if(!is_ready(self)) return NULL;
+    bool ok;
+    SYNTH_CALL(self, ok, refresh());
+    return PyBool_FromLong(ok);
+}
+
+static PyObject *
+set_timeout(NativeSynthesizer *self, PyObject *args)
+{
+    if(!is_ready(self)) return NULL;
+    double seconds;
+    if(!PyArg_ParseTuple(args, "d", &seconds)) return NULL;
+    SYNTH_DO(self, set_timeout(int(seconds * 1e6)));
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef NativeSynthesizer_methods[] = {
+    {"get_frequency", (PyCFunction)get_frequency, METH_VARARGS,
+     "Returns the current output frequency in MHz."},
+    {"set_frequency", (PyCFunction)set_frequency,
+     METH_VARARGS | METH_KEYWORDS,
+     "set_frequency(synth, freq, chan_spacing=10.) -> bool"},
+    {"get_frequency_pair", (PyCFunction)get_frequency_pair, METH_NOARGS,
+     "Returns both output frequencies in MHz, read in one exchange."},
+    {"set_frequency_pair", (PyCFunction)set_frequency_pair,
+     METH_VARARGS | METH_KEYWORDS,
+     "set_frequency_pair(freq_a, freq_b, chan_spacing=10.) -> bool"},
+    {"get_reference", (PyCFunction)get_reference, METH_NOARGS,
+     "Get reference frequency in Hz."},
+    {"set_reference", (PyCFunction)set_reference, METH_VARARGS,
+     "Set reference frequency in Hz."},
+    {"get_rf_level", (PyCFunction)get_rf_level, METH_VARARGS,
+     "Returns RF level in dBm."},
+    {"set_rf_level", (PyCFunction)set_rf_level, METH_VARARGS,
+     "Set RF level in dBm."},
+    {"get_options", (PyCFunction)get_options, METH_VARARGS,
+     "Returns (double, half, r, low_spur)."},
+    {"set_options", (PyCFunction)set_options, METH_VARARGS | METH_KEYWORDS,
+     "set_options(synth, double=0, half=0, divider=1, low_spur=0) -> bool"},
+    {"get_ref_select", (PyCFunction)get_ref_select, METH_NOARGS,
+     "Returns 1 if the external reference is selected, 0 otherwise."},
+    {"set_ref_select", (PyCFunction)set_ref_select, METH_VARARGS,
+     "set_ref_select(e_not_i=1) -> bool"},
+    {"get_vco_range", (PyCFunction)get_vco_range, METH_VARARGS,
+     "Returns (min, max) VCO range tuple."},
+    {"set_vco_range", (PyCFunction)set_vco_range, METH_VARARGS,
+     "set_vco_range(synth, low, high) -> bool"},
+    {"get_phase_lock", (PyCFunction)get_phase_lock, METH_VARARGS,
+     "Returns True if locked."},
+    {"get_label", (PyCFunction)get_label, METH_VARARGS,
+     "Get synthesizer label or name."},
+    {"set_label", (PyCFunction)set_label, METH_VARARGS,
+     "Set synthesizer label or name."},
+    {"flash", (PyCFunction)flash, METH_NOARGS,
+     "Flash current settings for both synthesizers into non-volatile memory."},
+    {"snapshot", (PyCFunction)snapshot, METH_NOARGS,
+     "Capture the complete board state as bytes."},
+    {"restore", (PyCFunction)restore, METH_VARARGS,
+     "Write only the settings that differ from a snapshot."},
+    {"set_caching", (PyCFunction)set_caching, METH_VARARGS,
+     "Answer register, reference and VCO range reads from the cache."},
+    {"set_force_writes", (PyCFunction)set_force_writes, METH_VARARGS,
+     "Send writes even when the board already holds the values."},
+    {"last_write_skipped", (PyCFunction)last_write_skipped, METH_NOARGS,
+     "True if the most recent write was skipped as a no-op."},
+    {"set_verify_checksums", (PyCFunction)set_verify_checksums, METH_VARARGS,
+     "Check the checksum of every reply (on by default)."},
+    {"set_retries", (PyCFunction)set_retries, METH_VARARGS,
+     "Retries after a failed exchange, with resynchronization (default 2)."},
+    {"set_trace", (PyCFunction)set_trace, METH_VARARGS,
+     "Record serial traffic to a file for valontrace; None stops."},
+    {"invalidate", (PyCFunction)invalidate, METH_NOARGS,
+     "Discard the register cache."},
+    {"refresh", (PyCFunction)refresh, METH_NOARGS,
+     "Re-read the register cache from the hardware."},
+    {"set_timeout", (PyCFunction)set_timeout, METH_VARARGS,
+     "Set the reply timeout in seconds."},
+    {NULL, NULL, 0, NULL}
+};
+
+static PyTypeObject NativeSynthesizerType = {
+    PyVarObject_HEAD_INIT(NULL, 0)
+    "valon_synth._valonsynth.NativeSynthesizer",
+};
+
+//--------//
+// Module //
+//--------//
+#if PY_MAJOR_VERSION >= 3
+static struct PyModuleDef valonsynth_module = {
+    PyModuleDef_HEAD_INIT, "_valonsynth",
+    "Interface to the C++ ValonSynth library.", -1, NULL
+};
+#endif
+
+static PyObject *
+init_module()
+{
+    NativeSynthesizerType.tp_basicsize = sizeof(NativeSynthesizer);
+    NativeSynthesizerType.tp_flags = Py_TPFLAGS_DEFAULT;
+    NativeSynthesizerType.tp_doc = "Interface to a Valon 5007 synthesizer.";
+    NativeSynthesizerType.tp_methods = NativeSynthesizer_methods;
+    NativeSynthesizerType.tp_init = (initproc)NativeSynthesizer_init;
+    NativeSynthesizerType.tp_new = NativeSynthesizer_new;
+    NativeSynthesizerType.tp_dealloc = (destructor)NativeSynthesizer_dealloc;
+    if(PyType_Ready(&NativeSynthesizerType) < 0) return NULL;
+
+#if PY_MAJOR_VERSION >= 3
+    PyObject *module = PyModule_Create(&valonsynth_module);
+#else
+    PyObject *module = Py_InitModule3("_valonsynth", NULL,
+                                      "Interface to the C++ ValonSynth library.");
+#endif
+    if(module == NULL) return NULL;
+    Py_INCREF(&NativeSynthesizerType);
+    PyModule_AddObject(module, "NativeSynthesizer",
+                       (PyObject *)&NativeSynthesizerType);
+    return module;
+}
+
+#if PY_MAJOR_VERSION >= 3
+PyMODINIT_FUNC
+PyInit__valonsynth()
+{
+    return init_module();
+}
+#else
+PyMODINIT_FUNC
+init_valonsynth()
+{
+    init_module();
+}
+#endif
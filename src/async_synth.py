@@ -0,0 +1,396 @@
+# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+# 
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+# 
+# Correspondence concerning GBT software should be addressed as follows:
+#	GBT Operations
+#	National Radio Astronomy Observatory
+#	P. O. Box 2
+#	Green Bank, WV 24944-0002 USA
+
+
+"""
+Provides an asyncio interface to the Valon 500x.
+
+AsyncSynthesizer has awaitable versions of the Synthesizer methods. It drives
+the tty through a non-blocking file descriptor registered with the event loop,
+so any number of boards can be operated concurrently from one loop without a
+thread per board:
+
+    async def retune(ports, freq):
+        synths = [AsyncSynthesizer(port) for port in ports]
+        await asyncio.gather(*[s.set_frequency(SYNTH_A, freq) for s in synths])
+        return await asyncio.gather(*[s.wait_for_lock(SYNTH_A) for s in synths])
+
+Requires Python 3.7 or later.
+"""
+
+# Python modules
+import asyncio
+import os
+import struct
+import termios
+# Local modules
+from .valon_synth import (ACK, _pack_freq_registers, _unpack_freq_registers)
+
+
+def _checksum(data):
+    "Generate a checksum for the data provided."
+    return bytes([sum(data) % 256])
+
+class AsyncSynthesizer:
+    """
+    An asyncio interface to the Valon 500x synthesizer.
+
+    The port is opened on first use and held until close(). Commands on one
+    object are serialized, and each read-modify-write runs as one unit, so
+    concurrent setters on one board do not undo each other; commands on
+    different objects run concurrently.
+    A read or write that gets no valid reply raises IOError, so setters
+    return True or raise.
+
+    @param port : serial port device node
+    @type  port : str
+
+    @param timeout : seconds to wait for each reply; default 0.2
+    @type  timeout : float
+    """
+    def __init__(self, port, timeout = 0.2):
+        self.port = port
+        self.timeout = timeout
+        self._fd = None
+        self._loop = None
+        self._buffer = bytearray()
+        self._waiter = None
+        self._lock = None
+
+    async def __aenter__(self):
+        self.open()
+        return self
+
+    async def __aexit__(self, *exc):
+        self.close()
+        return False
+
+    def open(self):
+        """
+        Open and configure the port (9600 8N1, raw) and register it with the
+        running event loop; call it from a coroutine or callback on that loop.
+        """
+        if self._fd is not None:
+            return
+        fd = os.open(self.port, os.O_RDWR | os.O_NOCTTY | os.O_NONBLOCK)
+        iflag, oflag, cflag, lflag, _, _, cc = termios.tcgetattr(fd)
+        iflag &= ~(termios.IGNBRK | termios.BRKINT | termios.PARMRK |
+                   termios.ISTRIP | termios.INLCR | termios.IGNCR |
+                   termios.ICRNL | termios.IXON | termios.IXOFF |
+                   termios.IXANY)
+        oflag &= ~termios.OPOST
+        lflag &= ~(termios.ECHO | termios.ECHONL | termios.ICANON |
+                   termios.ISIG | termios.IEXTEN)
+        cflag &= ~(termios.CSIZE | termios.PARENB | termios.CSTOPB |
+                   termios.CRTSCTS)
+        cflag |= termios.CS8 | termios.CLOCAL | termios.CREAD
+        cc[termios.VMIN] = 0
+        cc[termios.VTIME] = 0
+        termios.tcsetattr(fd, termios.TCSANOW,
+                          [iflag, oflag, cflag, lflag,
+                           termios.B9600, termios.B9600, cc])
+        termios.tcflush(fd, termios.TCIOFLUSH)
+        self._fd = fd
+        self._loop = asyncio.get_running_loop()
+        self._loop.add_reader(fd, self._on_readable)
+
+    def close(self):
+        "Unregister and close the port."
+        if self._fd is None:
+            return
+        self._loop.remove_reader(self._fd)
+        os.close(self._fd)
+        self._fd = None
+
+    def _locked(self):
+        """
+        The lock serializing commands on this object, created on first use so
+        that it belongs to the running loop.
+        """
+        if self._lock is None:
+            self._lock = asyncio.Lock()
+        return self._lock
+
+    def _on_readable(self):
+        "Event loop callback: move pending input into the buffer."
+        try:
+            data = os.read(self._fd, 1024)
+        except (BlockingIOError, InterruptedError):
+            return
+        except OSError:
+            data = b''
+        if not data:
+            # The port has gone away; a closed fd stays readable, so stop
+            # watching it and fail the pending read. The next command reopens.
+            self.close()
+            if self._waiter is not None and not self._waiter.done():
+                self._waiter.set_exception(
+                    IOError('Synthesizer port was closed'))
+            return
+        self._buffer += data
+        if self._waiter is not None and not self._waiter.done():
+            self._waiter.set_result(None)
+
+    async def _write(self, data):
+        "Write all of data, waiting for the port to drain when it is full."
+        while data:
+            try:
+                n = os.write(self._fd, data)
+                data = data[n:]
+            except BlockingIOError:
+                ready = self._loop.create_future()
+                self._loop.add_writer(self._fd, ready.set_result, None)
+                try:
+                    await ready
+                finally:
+                    self._loop.remove_writer(self._fd)
+
+    async def _read(self, n):
+        "Read n bytes, or fewer if the reply timeout expires."
+        deadline = self._loop.time() + self.timeout
+        while len(self._buffer) < n:
+            remaining = deadline - self._loop.time()
+            if remaining <= 0:
+                break
+            self._waiter = self._loop.create_future()
+            try:
+                await asyncio.wait_for(self._waiter, remaining)
+            except asyncio.TimeoutError:
+                break
+            finally:
+                self._waiter = None
+        data = bytes(self._buffer[:n])
+        del self._buffer[:n]
+        return data
+
+    async def _query_locked(self, command, length):
+        "_query with the lock already held."
+        self.open()
+        del self._buffer[:]
+        await self._write(struct.pack('>B', command))
+        data = await self._read(length + 1)
+        if len(data) != length + 1 or _checksum(data[:-1]) != data[-1:]:
+            raise IOError('No valid reply from synthesizer')
+        return data[:-1]
+
+    async def _command_locked(self, data):
+        "_command with the lock already held."
+        self.open()
+        del self._buffer[:]
+        await self._write(data + _checksum(data))
+        ack = await self._read(1)
+        if ack != struct.pack('>B', ACK):
+            raise IOError('Synthesizer did not acknowledge the command')
+        return True
+
+    async def _query(self, command, length):
+        "Send a read command and return the verified reply payload."
+        async with self._locked():
+            return await self._query_locked(command, length)
+
+    async def _command(self, data):
+        "Send a write command with checksum; True on ACK, IOError otherwise."
+        async with self._locked():
+            return await self._command_locked(data)
+
+    def _epdf(self, reference, data):
+        "Effective phase detector frequency from a register block."
+        _, _, reg2, _, _, _ = struct.unpack('>IIIIII', data)
+        epdf = reference / 1e6
+        if (reg2 >> 25) & 1:
+            epdf *= 2.0
+        if (reg2 >> 24) & 1:
+            epdf /= 2.0
+        divider = (reg2 >> 14) & 0x03ff
+        if divider > 1:
+            epdf /= divider
+        return epdf
+
+    async def get_frequency(self, synth):
+        """
+        Returns the current output frequency in MHz (float).
+        """
+        async with self._locked():
+            data = await self._query_locked(0x80 | synth, 24)
+            reference = await self._query_locked(0x81, 4)
+        epdf = self._epdf(struct.unpack('>I', reference)[0], data)
+        ncount, frac, mod, dbf = _unpack_freq_registers(data)
+        return (ncount + float(frac) / mod) * epdf / dbf
+
+    async def set_frequency(self, synth, freq, chan_spacing = 10.):
+        """
+        Sets the synthesizer to the desired frequency in MHz, or the closest
+        possible frequency depending on the channel spacing.
+
+        @return: True if success (bool)
+        """
+        async with self._locked():
+            low, _ = struct.unpack('>HH',
+                                   await self._query_locked(0x83 | synth, 4))
+            dbf = 1
+            while (freq * dbf) <= low and dbf <= 16:
+                dbf *= 2
+            if dbf > 16:
+                dbf = 16
+            vco = freq * dbf
+            old_data = await self._query_locked(0x80 | synth, 24)
+            reference = await self._query_locked(0x81, 4)
+            epdf = self._epdf(struct.unpack('>I', reference)[0], old_data)
+            ncount = int(vco / epdf)
+            frac = int((vco - ncount * float(epdf)) / chan_spacing + 0.5)
+            mod = int(epdf / float(chan_spacing) + 0.5)
+            if frac != 0 and mod != 0:
+                while not (frac & 1) and not (mod & 1):
+                    frac //= 2
+                    mod //= 2
+            else:
+                frac = 0
+                mod = 1
+            data = struct.pack('>B24s', 0x00 | synth,
+                               _pack_freq_registers(ncount, frac, mod,
+                                                    dbf, old_data))
+            return await self._command_locked(data)
+
+    async def get_reference(self):
+        "Get reference frequency in Hz."
+        data = await self._query(0x81, 4)
+        return struct.unpack('>I', data)[0]
+
+    async def set_reference(self, freq):
+        "Set reference frequency in Hz."
+        return await self._command(struct.pack('>BI', 0x01, freq))
+
+    async def get_rf_level(self, synth):
+        "Returns RF level in dBm (int)."
+        rfl_table = {0: -4, 1: -1, 2: 2, 3: 5}
+        data = await self._query(0x80 | synth, 24)
+        _, _, _, _, reg4, _ = struct.unpack('>IIIIII', data)
+        return rfl_table.get((reg4 >> 3) & 0x03)
+
+    async def set_rf_level(self, synth, rf_level):
+        "Set RF level in dBm; -4, -1, 2 or 5."
+        rfl_rev_table = {-4: 0, -1: 1, 2: 2, 5: 3}
+        rfl = rfl_rev_table.get(rf_level)
+        if rfl is None:
+            raise ValueError('RF level must be -4, -1, 2 or 5 dBm')
+        async with self._locked():
+            data = await self._query_locked(0x80 | synth, 24)
+            reg0, reg1, reg2, reg3, reg4, reg5 = struct.unpack('>IIIIII',
+                                                               data)
+            reg4 &= 0xffffffe7
+            reg4 |= (rfl & 0x03) << 3
+            return await self._command_locked(
+                struct.pack('>BIIIIII', 0x00 | synth,
+                            reg0, reg1, reg2, reg3, reg4, reg5))
+
+    async def get_options(self, synth):
+        "Returns double (bool), half (bool), r (int), low_spur (bool)."
+        data = await self._query(0x80 | synth, 24)
+        _, _, reg2, _, _, _ = struct.unpack('>IIIIII', data)
+        low_spur = ((reg2 >> 30) & 1) & ((reg2 >> 29) & 1)
+        double = (reg2 >> 25) & 1
+        half = (reg2 >> 24) & 1
+        divider = (reg2 >> 14) & 0x03ff
+        return double, half, divider, low_spur
+
+    async def set_options(self, synth, double = 0, half = 0, divider = 1,
+                          low_spur = 0):
+        "Set options. double and half both True is same as both False."
+        async with self._locked():
+            data = await self._query_locked(0x80 | synth, 24)
+            reg0, reg1, reg2, reg3, reg4, reg5 = struct.unpack('>IIIIII',
+                                                               data)
+            reg2 &= 0x9c003fff
+            reg2 |= (((low_spur & 1) << 30) | ((low_spur & 1) << 29) |
+                     ((double & 1) << 25) | ((half & 1) << 24) |
+                     ((divider & 0x03ff) << 14))
+            return await self._command_locked(
+                struct.pack('>BIIIIII', 0x00 | synth,
+                            reg0, reg1, reg2, reg3, reg4, reg5))
+
+    async def get_ref_select(self):
+        "Returns 1 if the external reference is selected, 0 otherwise."
+        data = await self._query(0x86, 1)
+        return struct.unpack('>B', data)[0] & 1
+
+    async def set_ref_select(self, e_not_i = 1):
+        "Selects either internal (0) or external (1) reference clock."
+        return await self._command(struct.pack('>BB', 0x06, e_not_i & 1))
+
+    async def get_vco_range(self, synth):
+        "Returns (min, max) VCO range tuple in MHz."
+        data = await self._query(0x83 | synth, 4)
+        return struct.unpack('>HH', data)
+
+    async def set_vco_range(self, synth, low, high):
+        "Sets VCO range."
+        return await self._command(struct.pack('>BHH', 0x03 | synth,
+                                               low, high))
+
+    async def get_phase_lock(self, synth):
+        "Returns True if locked (bool)."
+        data = await self._query(0x86 | synth, 1)
+        mask = (synth << 1) or 0x20
+        return (struct.unpack('>B', data)[0] & mask) > 0
+
+    async def wait_for_lock(self, synth, timeout = 1.0, interval = 0.01):
+        """
+        Poll the phase lock status until the synthesizer locks.
+
+        @param timeout : seconds to wait for lock; default 1.0
+        @type  timeout : float
+
+        @param interval : seconds between polls; default 0.01
+        @type  interval : float
+
+        @return: True if locked within the timeout (bool)
+        """
+        loop = asyncio.get_running_loop()
+        deadline = loop.time() + timeout
+        while True:
+            if await self.get_phase_lock(synth):
+                return True
+            if loop.time() + interval > deadline:
+                return False
+            await asyncio.sleep(interval)
+
+    async def get_label(self, synth):
+        "Get synthesizer label or name."
+        return await self._query(0x82 | synth, 16)
+
+    async def set_label(self, synth, label):
+        "Set synthesizer label or name, up to 16 bytes."
+        return await self._command(struct.pack('>B16s', 0x02 | synth, label))
+
+    async def flash(self):
+        "Flash current settings for both synthesizers into non-volatile memory."
+        return await self._command(struct.pack('>B', 0x40))
+
+async def gather(synths, method, *args):
+    """
+    Call the same method on several boards concurrently.
+
+        await gather(synths, 'set_frequency', SYNTH_A, 1420.405)
+
+    @return: list of results in the order of synths
+    """
+    return await asyncio.gather(*[getattr(s, method)(*args) for s in synths])
@@ -79,30 +79,169 @@ def _unpack_freq_registers(data):
     return ncount, frac, mod, dbf
 
 class Synthesizer:
-    """A simple interface to the Valon 500x synthesizer."""
-    def __init__(self, port):
+    """
+    A simple interface to the Valon 500x synthesizer.
+
+    By default the serial port is opened and closed around every call. With
+    persistent=True it is opened once and held until close(). The object is
+    also a context manager; the port stays open for the body of the with
+    statement, so a sequence of calls costs a single open.
+
+        with Synthesizer('/dev/ttyUSB0') as synth:
+            synth.set_frequency(SYNTH_A, 1420.405)
+            synth.set_frequency(SYNTH_B, 1420.405)
+
+    A shadow copy of each synthesizer's register block, the reference and the
+    VCO ranges is kept up to date on every successful read and write. With
+    caching=True, reads of these values are answered from the shadow copy
+    without touching the port; this is only safe while this object is the
+    sole user of the board.
+
+    Writes of the register blocks, reference and VCO ranges are skipped when
+    the shadow copy shows the board already holds the values, unless
+    force_writes is set; the reference and VCO ranges are only compared with
+    caching enabled. last_write_skipped tells whether the most recent write
+    was skipped.
+    """
+    def __init__(self, port, persistent = False, caching = False):
         self.conn = serial.Serial(None, 9600, serial.EIGHTBITS,
                                   serial.PARITY_NONE, serial.STOPBITS_ONE)
         self.conn.setPort(port)
+        self.persistent = persistent
+        self.caching = caching
+        self.force_writes = False
+        self.last_write_skipped = False
+        self._held = 0
+        self.invalidate()
+        if persistent:
+            self.conn.open()
 
-    def get_frequency(self, synth):
+    def __enter__(self):
+        self._held += 1
+        self._open()
+        return self
+
+    def __exit__(self, *exc):
+        self._held -= 1
+        self._close()
+        return False
+
+    def close(self):
         """
-        Returns the current output frequency for the selected synthesizer.
+        Close the port. It is reopened by the next call.
+        """
+        self.persistent = False
+        if self.conn.isOpen():
+            self.conn.close()
 
-        @param synth : synthesizer this command affects (0 for 1, 8 for 2).
-        @type  synth : int
+    def _open(self):
+        "Open the port unless it is already held open."
+        if not self.conn.isOpen():
+            self.conn.open()
 
-        @return: the frequency in MHz (float)
+    def _close(self):
+        "Close the port unless it is being held open."
+        if not self._held and not self.persistent:
+            self.conn.close()
+
+    def set_caching(self, enable):
+        """
+        Enable or disable answering reads from the shadow copy.
+
+        @param enable : True to enable caching
+        @type  enable : bool
         """
-        self.conn.open()
+        self.caching = enable
+
+    def set_force_writes(self, force):
+        """
+        Send writes even when the shadow copy shows they would change
+        nothing.
+
+        @param force : True to always write
+        @type  force : bool
+        """
+        self.force_writes = force
+
+    def invalidate(self):
+        """
+        Discard the shadow copy. The next read of each value goes to the
+        hardware.
+        """
+        self._regs = {}
+        self._reference = None
+        self._vco = {}
+
+    def refresh(self):
+        """
+        Re-read the register blocks, reference and VCO ranges from the
+        hardware into the shadow copy.
+
+        @return: True if success (bool)
+        """
+        caching = self.caching
+        self.caching = False
+        try:
+            with self:
+                for synth in (SYNTH_A, SYNTH_B):
+                    self._read_registers(synth)
+                    self.get_vco_range(synth)
+                self.get_reference()
+        finally:
+            self.caching = caching
+        return (len(self._regs) == 2 and len(self._vco) == 2 and
+                self._reference is not None)
+
+    def _read_registers(self, synth):
+        "Read the 24 byte register block, from the shadow copy if allowed."
+        if self.caching and synth in self._regs:
+            return self._regs[synth]
+        self._open()
         data = struct.pack('>B', 0x80 | synth)
         self.conn.write(data)
         data = self.conn.read(24)
         checksum = self.conn.read(1)
-        self.conn.close()
+        self._close()
         #_verify_checksum(data, checksum)
+        if len(data) == 24:
+            self._regs[synth] = data
+        else:
+            self._regs.pop(synth, None)
+        return data
+
+    def _write_registers(self, synth, regs):
+        "Write the 24 byte register block and update the shadow copy."
+        self.last_write_skipped = (not self.force_writes and
+                                   self._regs.get(synth) == regs)
+        if self.last_write_skipped:
+            return True
+        self._open()
+        data = struct.pack('>B24s', 0x00 | synth, regs)
+        checksum = _generate_checksum(data)
+        self.conn.write(data + checksum)
+        data = self.conn.read(1)
+        self._close()
+        ack = struct.unpack('>B', data)[0]
+        if ack == ACK:
+            self._regs[synth] = regs
+        else:
+            # The board state is unknown after a failed write
+            self._regs.pop(synth, None)
+        return ack == ACK
+
+    def get_frequency(self, synth):
+        """
+        Returns the current output frequency for the selected synthesizer.
+
+        @param synth : synthesizer this command affects (0 for 1, 8 for 2).
+        @type  synth : int
+
+        @return: the frequency in MHz (float)
+        """
+        with self:
+            data = self._read_registers(synth)
+            epdf = self._get_epdf(data)
         ncount, frac, mod, dbf = _unpack_freq_registers(data)
-        epdf = self._get_epdf(synth)
         return (ncount + float(frac) / mod) * epdf / dbf
 
     def set_frequency(self, synth, freq, chan_spacing = 10.):
@@ -123,52 +262,46 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        low, _ = self.get_vco_range(synth)
-        dbf = 1
-        while (freq * dbf) <= low and dbf <= 16:
-            dbf *= 2
-        if dbf > 16:
-            dbf = 16
-        vco = freq * dbf
-        epdf = self._get_epdf(synth)
-        ncount = int(vco / epdf)
-        frac = int((vco - ncount * float(epdf)) / chan_spacing + 0.5)
-        mod = int(epdf / float(chan_spacing) + 0.5)
-        if frac != 0 and mod != 0:
-            while not (frac & 1) and not (mod & 1):
-                frac /= 2
-                mod /= 2
-        else:
-            frac = 0
-            mod = 1
-        self.conn.open()
-        data = struct.pack('>B', 0x80 | synth)
-        self.conn.write(data)
-        old_data = self.conn.read(24)
-        checksum = self.conn.read(1)
-        #_verify_checksum(old_data, checksum)
-        data = struct.pack('>B24s', 0x00 | synth,
-                           _pack_freq_registers(ncount, frac, mod,
-                                                dbf, old_data))
-        checksum = _generate_checksum(data)
-        self.conn.write(data + checksum)
-        data = self.conn.read(1)
-        self.conn.close()
-        ack = struct.unpack('>B', data)[0]
-        return ack == ACK
+        with self:
+            low, _ = self.get_vco_range(synth)
+            dbf = 1
+            while (freq * dbf) <= low and dbf <= 16:
+                dbf *= 2
+            if dbf > 16:
+                dbf = 16
+            vco = freq * dbf
+            old_data = self._read_registers(synth)
+            epdf = self._get_epdf(old_data)
+            ncount = int(vco / epdf)
+            frac = int((vco - ncount * float(epdf)) / chan_spacing + 0.5)
+            mod = int(epdf / float(chan_spacing) + 0.5)
+            if frac != 0 and mod != 0:
+                while not (frac & 1) and not (mod & 1):
+                    frac //= 2
+                    mod //= 2
+            else:
+                frac = 0
+                mod = 1
+            return self._write_registers(synth,
+                                         _pack_freq_registers(ncount, frac,
+                                                              mod, dbf,
+                                                              old_data))
 
     def get_reference(self):
         """
         Get reference frequency in MHz
         """
-        self.conn.open()
+        if self.caching and self._reference is not None:
+            return self._reference
+        self._open()
         data = struct.pack('>B', 0x81)
         self.conn.write(data)
         data = self.conn.read(4)
         checksum = self.conn.read(1)
-        self.conn.close()
+        self._close()
         #_verify_checksum(data, checksum)
         freq = struct.unpack('>I', data)[0]
+        self._reference = freq
         return freq
 
     def set_reference(self, freq):
@@ -180,13 +313,18 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        self.conn.open()
+        self.last_write_skipped = (not self.force_writes and self.caching and
+                                   self._reference == freq)
+        if self.last_write_skipped:
+            return True
+        self._open()
         data = struct.pack('>BI', 0x01, freq)
         checksum = _generate_checksum(data)
         self.conn.write(data + checksum)
         data = self.conn.read(1)
-        self.conn.close()
+        self._close()
         ack = struct.unpack('>B', data)[0]
+        self._reference = freq if ack == ACK else None
         return ack == ACK
 
     def get_rf_level(self, synth):
@@ -199,13 +337,7 @@ class Synthesizer:
         @return: dBm (int)
         """
         rfl_table = {0: -4, 1: -1, 2: 2, 3: 5}
-        self.conn.open()
-        data = struct.pack('>B', 0x80 | synth)
-        self.conn.write(data)
-        data = self.conn.read(24)
-        checksum = self.conn.read(1)
-        self.conn.close()
-        #_verify_checksum(data, checksum)
+        data = self._read_registers(synth)
         _, _, _, _, reg4, _ = struct.unpack('>IIIIII', data)
         rfl = (reg4 >> 3) & 0x03
         rf_level = rfl_table.get(rfl)
@@ -227,23 +359,13 @@ class Synthesizer:
         rfl = rfl_rev_table.get(rf_level)
         if(rfl is None):
             return False
-        self.conn.open()
-        data = struct.pack('>B', 0x80 | synth)
-        self.conn.write(data)
-        data = self.conn.read(24)
-        checksum = self.conn.read(1)
-        #_verify_checksum(data, checksum)
-        reg0, reg1, reg2, reg3, reg4, reg5 = struct.unpack('>IIIIII', data)
-        reg4 &= 0xffffffe7
-        reg4 |= (rfl & 0x03) << 3
-        data = struct.pack('>BIIIIII', 0x00 | synth,
-                            reg0, reg1, reg2, reg3, reg4, reg5)
-        checksum = _generate_checksum(data)
-        self.conn.write(data + checksum)
-        data = self.conn.read(1)
-        self.conn.close()
-        ack = struct.unpack('>B', data)[0]
-        return ack == ACK
+        with self:
+            data = self._read_registers(synth)
+            reg0, reg1, reg2, reg3, reg4, reg5 = struct.unpack('>IIIIII', data)
+            reg4 &= 0xffffffe7
+            reg4 |= (rfl & 0x03) << 3
+            data = struct.pack('>IIIIII', reg0, reg1, reg2, reg3, reg4, reg5)
+            return self._write_registers(synth, data)
 
     def get_options(self, synth):
         """
@@ -260,13 +382,7 @@ class Synthesizer:
 
         @return: double (bool), half (bool), r (int), low_spur (bool)
         """
-        self.conn.open()
-        data = struct.pack('>B', 0x80 | synth)
-        self.conn.write(data)
-        data = self.conn.read(24)
-        checksum = self.conn.read(1)
-        self.conn.close()
-        #_verify_checksum(data, checksum)
+        data = self._read_registers(synth)
         _, _, reg2, _, _, _ = struct.unpack('>IIIIII', data)
         low_spur = ((reg2 >> 30) & 1) & ((reg2 >> 29) & 1)
         double = (reg2 >> 25) & 1
@@ -299,37 +415,27 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        self.conn.open()
-        data = struct.pack('>B', 0x80 | synth)
-        self.conn.write(data)
-        data = self.conn.read(24)
-        checksum = self.conn.read(1)
-        #_verify_checksum(data, checksum)
-        reg0, reg1, reg2, reg3, reg4, reg5 = struct.unpack('>IIIIII', data)
-        reg2 &= 0x9c003fff
-        reg2 |= (((low_spur & 1) << 30) | ((low_spur & 1) << 29) |
-                 ((double & 1) << 25) | ((half & 1) << 24) |
-                 ((divider & 0x03ff) << 14))
-        data = struct.pack('>BIIIIII', 0x00 | synth,
-                            reg0, reg1, reg2, reg3, reg4, reg5)
-        checksum = _generate_checksum(data)
-        self.conn.write(data + checksum)
-        data = self.conn.read(1)
-        self.conn.close()
-        ack = struct.unpack('>B', data)[0]
-        return ack == ACK
+        with self:
+            data = self._read_registers(synth)
+            reg0, reg1, reg2, reg3, reg4, reg5 = struct.unpack('>IIIIII', data)
+            reg2 &= 0x9c003fff
+            reg2 |= (((low_spur & 1) << 30) | ((low_spur & 1) << 29) |
+                     ((double & 1) << 25) | ((half & 1) << 24) |
+                     ((divider & 0x03ff) << 14))
+            data = struct.pack('>IIIIII', reg0, reg1, reg2, reg3, reg4, reg5)
+            return self._write_registers(synth, data)
 
     def get_ref_select(self):
         """Returns the currently selected reference clock.
 
         Returns 1 if the external reference is selected, 0 otherwise.
         """
-        self.conn.open()
+        self._open()
         data = struct.pack('>B', 0x86)
         self.conn.write(data)
         data = self.conn.read(1)
         checksum = self.conn.read(1)
-        self.conn.close()
+        self._close()
         #_verify_checksum(data, checksum)
         is_ext = struct.unpack('>B', data)[0]
         return is_ext & 1
@@ -343,12 +449,12 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        self.conn.open()
+        self._open()
         data = struct.pack('>BB', 0x06, e_not_i & 1)
         checksum = _generate_checksum(data)
         self.conn.write(data + checksum)
         data = self.conn.read(1)
-        self.conn.close()
+        self._close()
         ack = struct.unpack('>B', data)[0]
         return ack == ACK
 
@@ -361,14 +467,18 @@ class Synthesizer:
 
         @return: min,max in MHz
         """
-        self.conn.open()
+        if self.caching and synth in self._vco:
+            return self._vco[synth]
+        self._open()
         data = struct.pack('>B', 0x83 | synth)
         self.conn.write(data)
         data = self.conn.read(4)
         checksum = self.conn.read(1)
-        self.conn.close()
+        self._close()
         #_verify_checksum(data, checksum)
-        return struct.unpack('>HH', data)
+        vcor = struct.unpack('>HH', data)
+        self._vco[synth] = vcor
+        return vcor
 
     def set_vco_range(self, synth, low, high):
         """
@@ -385,13 +495,21 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        self.conn.open()
+        self.last_write_skipped = (not self.force_writes and self.caching and
+                                   self._vco.get(synth) == (low, high))
+        if self.last_write_skipped:
+            return True
+        self._open()
         data = struct.pack('>BHH', 0x03 | synth, low, high)
         checksum = _generate_checksum(data)
         self.conn.write(data + checksum)
         data = self.conn.read(1)
-        self.conn.close()
+        self._close()
         ack = struct.unpack('>B', data)[0]
+        if ack == ACK:
+            self._vco[synth] = (low, high)
+        else:
+            self._vco.pop(synth, None)
         return ack == ACK
 
     def get_phase_lock(self, synth):
@@ -403,12 +521,12 @@ class Synthesizer:
 
         @return: True if locked (bool)
         """
-        self.conn.open()
+        self._open()
         data = struct.pack('>B', 0x86 | synth)
         self.conn.write(data)
         data = self.conn.read(1)
         checksum = self.conn.read(1)
-        self.conn.close()
+        self._close()
         #_verify_checksum(data, checksum)
         mask = (synth << 1) or 0x20
         lock = struct.unpack('>B', data)[0] & mask
@@ -423,12 +541,12 @@ class Synthesizer:
 
         @return: str
         """
-        self.conn.open()
+        self._open()
         data = struct.pack('>B', 0x82 | synth)
         self.conn.write(data)
         data = self.conn.read(16)
         checksum = self.conn.read(1)
-        self.conn.close()
+        self._close()
         #_verify_checksum(data, checksum)
         return data
 
@@ -444,12 +562,12 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        self.conn.open()
+        self._open()
         data = struct.pack('>B16s', 0x02 | synth, label)
         checksum = _generate_checksum(data)
         self.conn.write(data + checksum)
         data = self.conn.read(1)
-        self.conn.close()
+        self._close()
         ack = struct.unpack('>B', data)[0]
         return ack == ACK
 
@@ -459,23 +577,27 @@ class Synthesizer:
 
         @return: True if success (bool)
         """
-        self.conn.open()
+        self._open()
         data = struct.pack('>B', 0x40)
         checksum = _generate_checksum(data)
         self.conn.write(data + checksum)
         data = self.conn.read(1)
-        self.conn.close()
+        self._close()
         ack = struct.unpack('>B', data)[0]
         return ack == ACK
 
-    def _get_epdf(self, synth):
+    def _get_epdf(self, data):
         """
         Returns effective phase detector frequency.
 
-        This is the reference frequency with options applied.
+        This is the reference frequency with the options from the register
+        block applied.
         """
         reference = self.get_reference() / 1e6
-        double, half, divider, _ = self.get_options(synth)
+        _, _, reg2, _, _, _ = struct.unpack('>IIIIII', data)
+        double = (reg2 >> 25) & 1
+        half = (reg2 >> 24) & 1
+        divider = (reg2 >> 14) & 0x03ff
         if(double):
             reference *= 2.0
         if(half):
@@ -0,0 +1,186 @@
+# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+# 
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+# 
+# This program is distributed in the hope that it will be useful, but
+# WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+# General Public License for more details.
+# 
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+# 
+# Correspondence concerning GBT software should be addressed as follows:
+#	GBT Operations
+#	National Radio Astronomy Observatory
+#	P. O. Box 2
+#	Green Bank, WV 24944-0002 USA
+
+
+"""
+Client for valond, the daemon that owns a Valon 500x serial port and shares
+it between processes. See valond.h for the wire protocol.
+"""
+
+# Python modules
+import socket
+import struct
+
+
+# Operation codes
+GET_FREQUENCY = 0x01
+SET_FREQUENCY = 0x02
+GET_REFERENCE = 0x03
+SET_REFERENCE = 0x04
+GET_RF_LEVEL = 0x05
+SET_RF_LEVEL = 0x06
+GET_OPTIONS = 0x07
+SET_OPTIONS = 0x08
+GET_REF_SELECT = 0x09
+SET_REF_SELECT = 0x0a
+GET_VCO_RANGE = 0x0b
+SET_VCO_RANGE = 0x0c
+GET_PHASE_LOCK = 0x0d
+GET_LABEL = 0x0f
+SET_LABEL = 0x10
+FLASH = 0x12
+REFRESH = 0x14
+
+ACK = 0x06
+
+REQUEST_SIZE = 18
+REPLY_SIZE = 17
+
+class DaemonSynthesizer:
+    """
+    Same interface as valon_synth.Synthesizer, served by valond. As with
+    NativeSynthesizer, getters raise IOError when the daemon reports that
+    the read failed, and setters return False.
+
+    @param path : path of the valond Unix domain socket
+    @type  path : str
+    """
+    def __init__(self, path):
+        self.sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+        self.sock.connect(path)
+
+    def close(self):
+        "Disconnect from the daemon."
+        self.sock.close()
+
+    def _call(self, op, synth = 0, payload = b''):
+        "Send one request and return (success, reply payload)."
+        self.sock.sendall(struct.pack('>BB16s', op, synth, payload))
+        data = b''
+        while len(data) < REPLY_SIZE:
+            chunk = self.sock.recv(REPLY_SIZE - len(data))
+            if not chunk:
+                raise IOError('valond closed the connection')
+            data += chunk
+        status, payload = struct.unpack('>B16s', data)
+        return status == ACK, payload
+
+    def _query(self, op, synth = 0):
+        "Send a read request and return its payload, or raise IOError."
+        ok, payload = self._call(op, synth)
+        if not ok:
+            raise IOError('No valid reply from synthesizer')
+        return payload
+
+    def get_frequency(self, synth):
+        "Returns the current output frequency in MHz."
+        data = self._query(GET_FREQUENCY, synth)
+        num, den = struct.unpack('>QQ', data)
+        return num / float(den) / 1e6
+
+    def set_frequency(self, synth, freq, chan_spacing = 10.):
+        "Sets the synthesizer to the desired frequency in MHz."
+        if freq <= 0 or chan_spacing < 0:
+            return False
+        ok, _ = self._call(SET_FREQUENCY, synth,
+                           struct.pack('>QI', int(round(freq * 1e6)),
+                                       int(round(chan_spacing * 1e6))))
+        return ok
+
+    def get_reference(self):
+        "Get reference frequency in Hz."
+        data = self._query(GET_REFERENCE)
+        return struct.unpack('>I', data[:4])[0]
+
+    def set_reference(self, freq):
+        "Set reference frequency in Hz."
+        ok, _ = self._call(SET_REFERENCE, 0, struct.pack('>I', freq))
+        return ok
+
+    def get_rf_level(self, synth):
+        "Returns RF level in dBm."
+        data = self._query(GET_RF_LEVEL, synth)
+        return struct.unpack('>i', data[:4])[0]
+
+    def set_rf_level(self, synth, rf_level):
+        "Set RF level in dBm."
+        ok, _ = self._call(SET_RF_LEVEL, synth, struct.pack('>i', rf_level))
+        return ok
+
+    def get_options(self, synth):
+        "Returns double (bool), half (bool), r (int), low_spur (bool)."
+        data = self._query(GET_OPTIONS, synth)
+        low_spur, double, half, _, divider = struct.unpack('>BBBBI', data[:8])
+        return double, half, divider, low_spur
+
+    def set_options(self, synth, double = 0, half = 0, divider = 1,
+                    low_spur = 0):
+        "Set options."
+        ok, _ = self._call(SET_OPTIONS, synth,
+                           struct.pack('>BBBBI', low_spur & 1, double & 1,
+                                       half & 1, 0, divider))
+        return ok
+
+    def get_ref_select(self):
+        "Returns 1 if the external reference is selected, 0 otherwise."
+        data = self._query(GET_REF_SELECT)
+        return struct.unpack('>B', data[:1])[0] & 1
+
+    def set_ref_select(self, e_not_i = 1):
+        "Selects either internal or external reference clock."
+        ok, _ = self._call(SET_REF_SELECT, 0, struct.pack('>B', e_not_i & 1))
+        return ok
+
+    def get_vco_range(self, synth):
+        "Returns (min, max) VCO range tuple."
+        data = self._query(GET_VCO_RANGE, synth)
+        return struct.unpack('>HH', data[:4])
+
+    def set_vco_range(self, synth, low, high):
+        "Sets VCO range."
+        ok, _ = self._call(SET_VCO_RANGE, synth, struct.pack('>HH', low, high))
+        return ok
+
+    def get_phase_lock(self, synth):
+        "Returns True if locked."
+        data = self._query(GET_PHASE_LOCK, synth)
+        return struct.unpack('>B', data[:1])[0] > 0
+
+    def get_label(self, synth):
+        "Get synthesizer label or name."
+        data = self._query(GET_LABEL, synth)
+        return data
+
+    def set_label(self, synth, label):
+        "Set synthesizer label or name."
+        ok, _ = self._call(SET_LABEL, synth, label)
+        return ok
+
+    def flash(self):
+        "Flash current settings for both synthesizers into non-volatile memory."
+        ok, _ = self._call(FLASH)
+        return ok
+
+    def refresh(self):
+        "Have the daemon re-read its register cache from the hardware."
+        ok, _ = self._call(REFRESH)
+        return ok
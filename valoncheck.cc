@@ -0,0 +1,395 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+
+// valoncheck: drives ValonSynth against a ValonEmulator, and the frequency
+// planner and trace replay offline, and checks the results. Run by
+// "make check"; prints one line per check and exits nonzero on failure.
+
+#include "FrequencyPlanner.h"
+#include "SerialReplay.h"
+#include "ValonEmulator.h"
+#include "ValonSynth.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+static void
+check(bool ok, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    printf("%s ", ok ? "PASS" : "FAIL");
+    vprintf(format, args);
+    printf("\n");
+    va_end(args);
+    if(!ok) ++failures;
+}
+
+static void
+count_failure(void *context, ValonSynth &, ValonSynth::error_code, int)
+{
+    ++*static_cast<unsigned *>(context);
+}
+
+// Counts the exchanges that send a command rather than a query
+class command_counter : public ValonSynth::observer
+{
+public:
+    command_counter() : commands(0) {}
+
+    void exchanged(ValonSynth &, const ValonSynth::exchange &e)
+    {
+        if(!(e.opcode & 0x80)) ++commands;
+    }
+
+    unsigned commands;
+};
+
+// An emulator without wire time, and a synthesizer on it with a short
+// timeout, so that faults cost little time
+static ValonSynth *
+emulated(ValonEmulator *&emu, uint32_t seed = 1)
+{
+    emu = new ValonEmulator(seed);
+    emu->set_wire_time(false);
+    ValonSynth *vs = new ValonSynth(emu);
+    vs->set_timeout(20000);
+    return vs;
+}
+
+//----------//
+// Recovery //
+//----------//
+// Every operation must succeed through drops, bad checksums, refusals and
+// stray bytes by retrying after a resync, and leave the board as asked. At
+// one fault in ten frames two retries run out every few hundred exchanges,
+// so this allows five.
+static void
+check_recovery()
+{
+    static const char *specs[] =
+    {
+        "drop=0.1", "corrupt=0.1", "nack=0.1", "stray=0.1"
+    };
+    for(size_t k = 0; k < sizeof(specs) / sizeof(specs[0]); ++k)
+    {
+        ValonEmulator *emu;
+        ValonSynth *vs = emulated(emu);
+        ValonEmulator::faults f;
+        f.parse(specs[k]);
+        emu->set_faults(f);
+        vs->set_retries(5);
+        unsigned failed_attempts = 0;
+        vs->set_error_handler(count_failure, &failed_attempts);
+
+        int ok = 0, ops = 0, wrong = 0;
+        for(int i = 0; i < 100; ++i)
+        {
+            ValonSynth::Synthesizer synth = (i & 1) ? ValonSynth::B
+                                                    : ValonSynth::A;
+            float wanted = 1000.0f + 10.0f * i, frequency = 0.0f;
+            ok += vs->set_frequency(synth, wanted);
+            ok += vs->get_frequency(synth, frequency);
+            ops += 2;
+            wrong += (frequency != wanted);
+        }
+        const ValonEmulator::counters &c = emu->injected();
+        unsigned injected = c.drops + c.corrupts + c.nacks + c.strays;
+        check((ok == ops) && (wrong == 0) && (injected > 0) &&
+              (failed_attempts > 0),
+              "recovery %s: %d/%d operations, %d wrong, %u faults, "
+              "%u failed attempts", specs[k], ok, ops, wrong, injected,
+              failed_attempts);
+        delete vs;
+    }
+}
+
+//-------------------//
+// Snapshot, Restore //
+//-------------------//
+// restore() must write only what differs from the snapshot
+static void
+check_restore()
+{
+    ValonEmulator *emu;
+    ValonSynth *vs = emulated(emu);
+    command_counter counter;
+    vs->set_observer(&counter);
+
+    ValonSynth::board_state saved, now;
+    uint8_t saved_bytes[ValonSynth::STATE_SIZE];
+    uint8_t now_bytes[ValonSynth::STATE_SIZE];
+    bool ok = vs->snapshot(saved);
+    ValonSynth::encode_state(saved, saved_bytes);
+
+    struct change
+    {
+        const char *what;
+        unsigned writes;
+    };
+    static const change changes[] =
+    {
+        { "nothing", 0 },
+        { "RF level of A", 1 },
+        { "label of B and reference select", 2 },
+        { "frequencies of A and B", 2 },
+        { "VCO range and frequency of A, reference", 3 },
+    };
+    for(int i = 0; i < int(sizeof(changes) / sizeof(changes[0])); ++i)
+    {
+        ValonSynth::vco_range vcor = { 2300, 4500 };
+        bool changed = true;
+        switch(i)
+        {
+        case 1:
+            changed = vs->set_rf_level(ValonSynth::A, -4);
+            break;
+        case 2:
+            changed = (vs->set_label(ValonSynth::B, "changed label   ") &&
+                       vs->set_ref_select(!saved.e_not_i));
+            break;
+        case 3:
+            changed = (vs->set_frequency(ValonSynth::A, 1500.0f) &&
+                       vs->set_frequency(ValonSynth::B, 2500.0f));
+            break;
+        case 4:
+            changed = (vs->set_vco_range(ValonSynth::A, vcor) &&
+                       vs->set_frequency(ValonSynth::A, 3000.0f) &&
+                       vs->set_reference(20000000));
+            break;
+        }
+        counter.commands = 0;
+        bool restored = vs->restore(saved);
+        unsigned writes = counter.commands;
+        bool same = vs->snapshot(now);
+        ValonSynth::encode_state(now, now_bytes);
+        same = same && !memcmp(saved_bytes, now_bytes, sizeof(now_bytes));
+        check(ok && changed && restored && same &&
+              (writes == changes[i].writes),
+              "restore after changing %s: %u writes, expected %u%s",
+              changes[i].what, writes, changes[i].writes,
+              same ? "" : ", state differs");
+    }
+    vs->set_observer(NULL);
+    delete vs;
+}
+
+//----------//
+// Planning //
+//----------//
+// Distance of frac/mod from num/den, scaled by den * mod
+static uint64_t
+distance(uint64_t num, uint64_t den, uint64_t frac, uint64_t mod)
+{
+    uint64_t a = frac * den, b = num * mod;
+    return (a > b) ? a - b : b - a;
+}
+
+// best_fraction() against every denominator up to max_den
+static void
+check_best_fraction()
+{
+    std::mt19937_64 random(1);
+    int wrong = 0, cases = 2000;
+    for(int i = 0; i < cases; ++i)
+    {
+        uint64_t den = 1 + random() % 1000000000;
+        uint64_t num = random() % den;
+        uint64_t max_den = 1 + random() % 4095;
+        uint64_t frac, mod;
+        FrequencyPlanner::best_fraction(num, den, max_den, frac, mod);
+
+        uint64_t best_frac = 0, best_mod = 1;
+        for(uint64_t m = 1; m <= max_den; ++m)
+        {
+            for(uint64_t f = num * m / den; f <= num * m / den + 1; ++f)
+            {
+                // Compare f/m with the best so far without dividing
+                if(distance(num, den, f, m) * best_mod <
+                   distance(num, den, best_frac, best_mod) * m)
+                {
+                    best_frac = f;
+                    best_mod = m;
+                }
+            }
+        }
+        bool same = (distance(num, den, frac, mod) * best_mod ==
+                     distance(num, den, best_frac, best_mod) * mod);
+        bool lowest = (mod <= max_den) &&
+                      (FrequencyPlanner::gcd(frac, mod) == 1);
+        if(!same || !lowest) ++wrong;
+    }
+    check(wrong == 0, "best_fraction matches brute force: %d/%d wrong",
+          wrong, cases);
+}
+
+// The batch planner must give exactly the scalar planner's registers
+static void
+check_batch_plan()
+{
+    static const FrequencyPlanner::solver modes[] =
+    {
+        FrequencyPlanner::CHANNEL_SPACING,
+        FrequencyPlanner::BEST_APPROXIMATION
+    };
+    for(int k = 0; k < 2; ++k)
+    {
+        FrequencyPlanner::config cfg;
+        cfg.reference = 10000000;
+        cfg.double_ref = false;
+        cfg.half_ref = false;
+        cfg.r = 1;
+        cfg.vco_min = 2200;
+        cfg.chan_spacing = 10000;
+        cfg.mode = modes[k];
+        FrequencyPlanner planner(cfg);
+
+        std::mt19937_64 random(2);
+        std::vector<uint64_t> frequencies(5000);
+        for(size_t i = 0; i < frequencies.size(); ++i)
+        {
+            frequencies[i] = 137500000 + random() % 4262500000ULL;
+        }
+        FrequencyPlanner::batch out;
+        size_t valid = planner.plan(frequencies.data(), frequencies.size(),
+                                    out);
+        size_t scalar_valid = 0;
+        int wrong = 0;
+        for(size_t i = 0; i < frequencies.size(); ++i)
+        {
+            FrequencyPlanner::tuning t;
+            bool ok = planner.plan(frequencies[i], t);
+            scalar_valid += ok;
+            if(ok != bool(out.valid[i]))
+            {
+                ++wrong;
+            }
+            else if(ok &&
+                    ((t.ncount != out.ncount[i]) || (t.frac != out.frac[i]) ||
+                     (t.mod != out.mod[i]) || (t.dbf != out.dbf[i]) ||
+                     (FrequencyPlanner::to_hz(t.actual) != out.actual[i])))
+            {
+                ++wrong;
+            }
+        }
+        check((wrong == 0) && (valid == scalar_valid),
+              "batch plan matches scalar plan (%s): %d/%zu differ",
+              k ? "best approximation" : "channel spacing", wrong,
+              frequencies.size());
+    }
+}
+
+//--------------------//
+// Recording, Replay //
+//--------------------//
+// A session recorded against the emulator must replay with the same results
+// and no skipped or unmatched writes, and reads may split recorded replies
+static void
+check_replay()
+{
+    char path[] = "/tmp/valoncheck-XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+    {
+        check(false, "replay: cannot create a trace file");
+        return;
+    }
+    close(fd);
+
+    ValonEmulator *emu;
+    ValonSynth *vs = emulated(emu);
+    float recorded[2] = { 0.0f, 0.0f }, replayed[2] = { 0.0f, 0.0f };
+    ValonSynth::board_state recorded_state, replayed_state;
+    bool ok = (vs->set_trace(path) &&
+               vs->get_frequency(ValonSynth::A, recorded[0]) &&
+               vs->set_frequency(ValonSynth::B, 1234.5f) &&
+               vs->get_frequency(ValonSynth::B, recorded[1]) &&
+               vs->snapshot(recorded_state) &&
+               vs->set_trace(NULL));
+    delete vs;
+
+    SerialReplay *replay = new SerialReplay(path);
+    ValonSynth rs(replay);
+    bool replay_ok = (replay->is_open() &&
+                      rs.get_frequency(ValonSynth::A, replayed[0]) &&
+                      rs.set_frequency(ValonSynth::B, 1234.5f) &&
+                      rs.get_frequency(ValonSynth::B, replayed[1]) &&
+                      rs.snapshot(replayed_state));
+    uint8_t a[ValonSynth::STATE_SIZE], b[ValonSynth::STATE_SIZE];
+    ValonSynth::encode_state(recorded_state, a);
+    ValonSynth::encode_state(replayed_state, b);
+    check(ok && replay_ok && (recorded[0] == replayed[0]) &&
+          (recorded[1] == replayed[1]) && !memcmp(a, b, sizeof(a)) &&
+          (replay->skipped() == 0) && (replay->mismatched() == 0),
+          "replay of a recorded session: %zu skipped, %zu mismatched",
+          replay->skipped(), replay->mismatched());
+
+    // Read the first reply back in two pieces
+    std::vector<SerialReplay::record> records;
+    SerialReplay::load(path, records);
+    size_t w = 0;
+    while((w + 1 < records.size()) &&
+          !((records[w].kind == 'W') && (records[w + 1].kind == 'R') &&
+            (records[w + 1].data.size() > 1)))
+    {
+        ++w;
+    }
+    bool split = false;
+    if(w + 1 < records.size())
+    {
+        const std::vector<uint8_t> &reply = records[w + 1].data;
+        SerialReplay pieces(path);
+        std::vector<uint8_t> bytes(reply.size());
+        int half = int(reply.size() / 2);
+        pieces.write(records[w].data.data(), int(records[w].data.size()));
+        split = ((pieces.read(bytes.data(), half, 0) == half) &&
+                 (pieces.read(&bytes[half], int(reply.size()) - half, 0) ==
+                  int(reply.size()) - half) &&
+                 (bytes == reply));
+    }
+    check(split, "replayed reply read in two pieces");
+    unlink(path);
+}
+
+int
+main()
+{
+    check_recovery();
+    check_restore();
+    check_best_fraction();
+    check_batch_plan();
+    check_replay();
+    printf("%d check%s failed\n", failures, (failures == 1) ? "" : "s");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,526 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+// valond: owns a Valon 5007 serial port and serves ValonSynth operations to
+// local clients over a Unix domain socket. See valond.h for the protocol.
+//
+// Requests are gathered from all clients each time round the poll loop and
+// executed in order. Identical reads in the same batch are answered by a
+// single call, and the register cache answers repeated reads of the register
+// blocks, reference and VCO ranges without touching the serial line. Client
+// sockets are non-blocking and replies are queued per client, so a client
+// that stops reading holds up nobody else.
+//
+// With -m or -f the daemon also exports ValonMetrics for the board, over
+// HTTP on a loopback port or as a node_exporter textfile. With -w a
+// ValonWatchdog rewrites a synthesizer's registers if it loses lock, and
+// requests are run between its polls.
+
+#include "ValonMetrics.h"
+#include "ValonSynth.h"
+#include "ValonWatchdog.h"
+#include "valond.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+static volatile sig_atomic_t done = 0;
+
+// How often the metrics textfile is rewritten
+static const int TEXTFILE_INTERVAL_MS = 10000;
+
+// A client with this many reply bytes unsent is not read from until it
+// catches up
+static const size_t MAX_UNSENT_BYTES = 64 * VALOND_REPLY_SIZE;
+
+static void
+on_signal(int)
+{
+    done = 1;
+}
+
+//-----------------//
+// Payload Packing //
+//-----------------//
+static void
+put_u32(uint32_t num, uint8_t *bytes)
+{
+    bytes[0] = (num >> 24) & 0xff;
+    bytes[1] = (num >> 16) & 0xff;
+    bytes[2] = (num >> 8) & 0xff;
+    bytes[3] = (num) & 0xff;
+}
+
+static uint32_t
+get_u32(const uint8_t *bytes)
+{
+    return ((uint32_t(bytes[0]) << 24) + (uint32_t(bytes[1]) << 16) +
+            (uint32_t(bytes[2]) <<  8) + (uint32_t(bytes[3])));
+}
+
+static void
+put_u64(uint64_t num, uint8_t *bytes)
+{
+    put_u32(uint32_t(num >> 32), &bytes[0]);
+    put_u32(uint32_t(num), &bytes[4]);
+}
+
+static uint64_t
+get_u64(const uint8_t *bytes)
+{
+    return (uint64_t(get_u32(&bytes[0])) << 32) + get_u32(&bytes[4]);
+}
+
+//-----------//
+// Execution //
+//-----------//
+static bool
+execute(ValonSynth &vs, const uint8_t *req, uint8_t *reply)
+{
+    enum ValonSynth::Synthesizer synth =
+        (req[1] == ValonSynth::B) ? ValonSynth::B : ValonSynth::A;
+    const uint8_t *in = &req[2];
+    uint8_t *out = &reply[1];
+    memset(out, 0, VALOND_PAYLOAD_SIZE);
+
+    switch(req[0])
+    {
+    case VALOND_GET_FREQUENCY:
+    {
+        FrequencyPlanner::rational frequency;
+        if(!vs.get_frequency(synth, frequency)) return false;
+        put_u64(frequency.num, &out[0]);
+        put_u64(frequency.den, &out[8]);
+        return true;
+    }
+    case VALOND_SET_FREQUENCY:
+    {
+        FrequencyPlanner::tuning t;
+        return vs.set_frequency(synth, get_u64(&in[0]), get_u32(&in[8]), t);
+    }
+    case VALOND_GET_REFERENCE:
+    {
+        uint32_t reference;
+        if(!vs.get_reference(reference)) return false;
+        put_u32(reference, out);
+        return true;
+    }
+    case VALOND_SET_REFERENCE:
+        return vs.set_reference(get_u32(in));
+    case VALOND_GET_RF_LEVEL:
+    {
+        int32_t rf_level;
+        if(!vs.get_rf_level(synth, rf_level)) return false;
+        put_u32(uint32_t(rf_level), out);
+        return true;
+    }
+    case VALOND_SET_RF_LEVEL:
+        return vs.set_rf_level(synth, int32_t(get_u32(in)));
+    case VALOND_GET_OPTIONS:
+    {
+        ValonSynth::options opts;
+        if(!vs.get_options(synth, opts)) return false;
+        out[0] = opts.low_spur;
+        out[1] = opts.double_ref;
+        out[2] = opts.half_ref;
+        put_u32(opts.r, &out[4]);
+        return true;
+    }
+    case VALOND_SET_OPTIONS:
+    {
+        ValonSynth::options opts;
+        opts.low_spur = in[0] & 1;
+        opts.double_ref = in[1] & 1;
+        opts.half_ref = in[2] & 1;
+        opts.r = get_u32(&in[4]);
+        return vs.set_options(synth, opts);
+    }
+    case VALOND_GET_REF_SELECT:
+    {
+        bool e_not_i;
+        if(!vs.get_ref_select(e_not_i)) return false;
+        out[0] = e_not_i;
+        return true;
+    }
+    case VALOND_SET_REF_SELECT:
+        return vs.set_ref_select(in[0] & 1);
+    case VALOND_GET_VCO_RANGE:
+    {
+        ValonSynth::vco_range vcor;
+        if(!vs.get_vco_range(synth, vcor)) return false;
+        out[0] = (vcor.min >> 8) & 0xff;
+        out[1] = vcor.min & 0xff;
+        out[2] = (vcor.max >> 8) & 0xff;
+        out[3] = vcor.max & 0xff;
+        return true;
+    }
+    case VALOND_SET_VCO_RANGE:
+    {
+        ValonSynth::vco_range vcor;
+        vcor.min = (uint16_t(in[0]) << 8) + in[1];
+        vcor.max = (uint16_t(in[2]) << 8) + in[3];
+        return vs.set_vco_range(synth, vcor);
+    }
+    case VALOND_GET_PHASE_LOCK:
+    {
+        bool locked;
+        if(!vs.get_phase_lock(synth, locked)) return false;
+        out[0] = locked;
+        return true;
+    }
+    case VALOND_GET_LABEL:
+        return vs.get_label(synth, (char *)out);
+    case VALOND_SET_LABEL:
+        return vs.set_label(synth, (const char *)in);
+    case VALOND_FLASH:
+        return vs.flash();
+    case VALOND_REFRESH:
+        return vs.refresh();
+    }
+    return false;
+}
+
+//--------//
+// Server //
+//--------//
+static void
+on_escalation(void *port, const ValonWatchdog::incident &what)
+{
+    cerr << "Synthesizer " << (what.synth == ValonSynth::A ? 'A' : 'B')
+         << " on " << (const char *)port << " is unlocked and did not relock"
+         << " after " << what.rewrites << " register rewrites" << endl;
+}
+
+struct client
+{
+    int fd;
+    string in;
+    string out;  // Replies not yet sent
+};
+
+// Send as much of the client's queued replies as its socket will take.
+// Returns false if the client has gone.
+static bool
+flush_client(client &c)
+{
+    while(!c.out.empty())
+    {
+        ssize_t n = send(c.fd, c.out.data(), c.out.size(), MSG_NOSIGNAL);
+        if(n > 0)
+        {
+            c.out.erase(0, n);
+        }
+        else if((n < 0) && (errno == EINTR))
+        {
+            continue;
+        }
+        else
+        {
+            return (n < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK));
+        }
+    }
+    return true;
+}
+
+struct pending
+{
+    size_t client;
+    string request;
+};
+
+static int
+open_listener(const char *path)
+{
+    struct sockaddr_un addr;
+    if(strlen(path) >= sizeof(addr.sun_path))
+    {
+        cerr << "Socket path too long: " << path << endl;
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0)
+    {
+        perror("socket");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+    if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) ||
+       (listen(fd, 16) < 0))
+    {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void
+usage(const char *argv0)
+{
+    cerr << "Usage: " << argv0
+         << " [-s socket] [-m metrics-port] [-f metrics-file] [-w] port"
+         << endl
+         << "  Serve the Valon synthesizer on the serial port to clients on"
+         << endl
+         << "  the Unix domain socket (default /tmp/valond-<port>.sock)."
+         << endl
+         << "  -m serves Prometheus metrics at http://127.0.0.1:<port>/metrics;"
+         << endl
+         << "  -f rewrites them to a node_exporter textfile every 10s."
+         << endl
+         << "  -w rewrites the registers of a synthesizer that loses lock."
+         << endl;
+}
+
+int
+main(int argc, char **argv)
+{
+    string path;
+    int metrics_port = 0;
+    const char *metrics_file = NULL;
+    bool watch = false;
+    int opt;
+    while((opt = getopt(argc, argv, "s:m:f:wh")) != -1)
+    {
+        switch(opt)
+        {
+        case 's': path = optarg; break;
+        case 'm': metrics_port = atoi(optarg); break;
+        case 'f': metrics_file = optarg; break;
+        case 'w': watch = true; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if(optind != argc - 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    const char *port = argv[optind];
+    if(path.empty())
+    {
+        const char *base = strrchr(port, '/');
+        path = string("/tmp/valond-") + (base ? base + 1 : port) + ".sock";
+    }
+
+    ValonSynth vs(port);
+    if(!vs.is_open()) return 1;
+    ValonMetrics metrics;
+    metrics.attach(vs, port);
+    if((metrics_port > 0) && !metrics.serve(uint16_t(metrics_port)))
+    {
+        cerr << "Cannot serve metrics on port " << metrics_port << endl;
+        return 1;
+    }
+    if(!vs.set_exclusive(true)) return 1;
+    vs.set_caching(true);
+    if(!vs.refresh())
+    {
+        cerr << "No response from synthesizer on " << port << endl;
+    }
+
+    // From here on the watchdog, if any, is the only user of vs
+    std::unique_ptr<ValonWatchdog> watchdog;
+    if(watch)
+    {
+        watchdog.reset(new ValonWatchdog(vs, on_escalation, (void *)port));
+    }
+
+    int listener = open_listener(path.c_str());
+    if(listener < 0) return 1;
+
+    signal(SIGPIPE, SIG_IGN);
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    vector<client> clients;
+    timespec last_textfile = { 0, 0 };
+    while(!done)
+    {
+        if(metrics_file != NULL)
+        {
+            timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if((now.tv_sec - last_textfile.tv_sec) * 1000 +
+               (now.tv_nsec - last_textfile.tv_nsec) / 1000000 >=
+               TEXTFILE_INTERVAL_MS)
+            {
+                if(!metrics.write_textfile(metrics_file)) perror(metrics_file);
+                last_textfile = now;
+            }
+        }
+
+        vector<struct pollfd> fds(clients.size() + 1);
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for(size_t i = 0; i < clients.size(); ++i)
+        {
+            fds[i + 1].fd = clients[i].fd;
+            fds[i + 1].events = 0;
+            if(clients[i].out.size() < MAX_UNSENT_BYTES)
+            {
+                fds[i + 1].events |= POLLIN;
+            }
+            if(!clients[i].out.empty()) fds[i + 1].events |= POLLOUT;
+        }
+        if(poll(&fds[0], fds.size(),
+                metrics_file ? TEXTFILE_INTERVAL_MS : -1) < 0)
+        {
+            if(errno == EINTR) continue;
+            perror("poll");
+            break;
+        }
+
+        // Gather every complete request that has arrived
+        vector<pending> batch;
+        for(size_t i = 0; i < clients.size(); ++i)
+        {
+            if(!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            char buf[512];
+            ssize_t n = read(clients[i].fd, buf, sizeof(buf));
+            if((n < 0) && ((errno == EAGAIN) || (errno == EINTR))) continue;
+            if(n <= 0)
+            {
+                close(clients[i].fd);
+                clients[i].fd = -1;
+                continue;
+            }
+            clients[i].in.append(buf, n);
+            while(clients[i].in.size() >= VALOND_REQUEST_SIZE)
+            {
+                pending p;
+                p.client = i;
+                p.request = clients[i].in.substr(0, VALOND_REQUEST_SIZE);
+                clients[i].in.erase(0, VALOND_REQUEST_SIZE);
+                batch.push_back(p);
+            }
+        }
+
+        // Execute in arrival order, sharing results between identical reads
+        // until the next write
+        map<string, string> coalesced;
+        for(size_t i = 0; i < batch.size(); ++i)
+        {
+            const uint8_t *req = (const uint8_t *)batch[i].request.data();
+            string reply;
+            map<string, string>::iterator it = coalesced.find(batch[i].request);
+            if(it != coalesced.end())
+            {
+                reply = it->second;
+            }
+            else
+            {
+                metrics.set_queue_depth(vs, batch.size() - i);
+                uint8_t bytes[VALOND_REPLY_SIZE];
+                bool ok;
+                if(watchdog)
+                {
+                    ok = watchdog->call([&](ValonSynth &v)
+                    {
+                        return execute(v, req, bytes);
+                    });
+                }
+                else
+                {
+                    ok = execute(vs, req, bytes);
+                }
+                bytes[0] = ok ? 0x06 : 0x15;
+                reply.assign((const char *)bytes, VALOND_REPLY_SIZE);
+                if(valond_is_read(req[0]))
+                {
+                    coalesced[batch[i].request] = reply;
+                }
+                else
+                {
+                    coalesced.clear();
+                }
+            }
+            client &c = clients[batch[i].client];
+            if(c.fd >= 0) c.out += reply;
+        }
+
+        metrics.set_queue_depth(vs, 0);
+
+        // Send what each client's socket will take without blocking; the
+        // rest goes when poll() reports it writable
+        for(size_t i = 0; i < clients.size(); ++i)
+        {
+            if((clients[i].fd >= 0) && !flush_client(clients[i]))
+            {
+                close(clients[i].fd);
+                clients[i].fd = -1;
+            }
+        }
+
+        // Drop closed clients, then accept new ones
+        vector<client> open_clients;
+        for(size_t i = 0; i < clients.size(); ++i)
+        {
+            if(clients[i].fd >= 0) open_clients.push_back(clients[i]);
+        }
+        clients.swap(open_clients);
+        if(fds[0].revents & POLLIN)
+        {
+            int fd = accept(listener, 0, 0);
+            if((fd >= 0) && (fcntl(fd, F_SETFL, O_NONBLOCK) < 0))
+            {
+                close(fd);
+                fd = -1;
+            }
+            if(fd >= 0)
+            {
+                client c;
+                c.fd = fd;
+                clients.push_back(c);
+            }
+        }
+    }
+
+    for(size_t i = 0; i < clients.size(); ++i)
+    {
+        close(clients[i].fd);
+    }
+    close(listener);
+    unlink(path.c_str());
+    return 0;
+}
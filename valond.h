@@ -0,0 +1,108 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+#ifndef VALOND_H
+#define VALOND_H
+
+#include <stdint.h>
+
+/**
+ * \file valond.h
+ * Wire protocol spoken between valond and its clients over a Unix domain
+ * stream socket.
+ *
+ * Every request is a fixed VALOND_REQUEST_SIZE byte frame and is answered by
+ * exactly one fixed VALOND_REPLY_SIZE byte frame, in order. A client may have
+ * several requests outstanding. Multi-byte values are big-endian, as on the
+ * synthesizer's own serial link. Frequencies are exact: a frequency read
+ * is the fraction num/den Hz, and a frequency and spacing written are whole
+ * Hz, as taken by ValonSynth's integer overloads.
+ *
+ * <pre>
+ *   request: op(1) synth(1) payload(16)
+ *   reply:   status(1) payload(16)
+ * </pre>
+ *
+ * \c synth is ValonSynth::A (0x00) or ValonSynth::B (0x08) and is ignored by
+ * operations shared between the synthesizers. \c status is ACK (0x06) on
+ * success and NACK (0x15) on failure. Unused payload bytes are zero.
+ *
+ * | op                    | request payload        | reply payload          |
+ * |-----------------------|------------------------|------------------------|
+ * | VALOND_GET_FREQUENCY  |                        | u64 num, u64 den Hz    |
+ * | VALOND_SET_FREQUENCY  | u64 Hz, u32 spacing Hz |                        |
+ * | VALOND_GET_REFERENCE  |                        | u32 Hz                 |
+ * | VALOND_SET_REFERENCE  | u32 Hz                 |                        |
+ * | VALOND_GET_RF_LEVEL   |                        | i32 dBm                |
+ * | VALOND_SET_RF_LEVEL   | i32 dBm                |                        |
+ * | VALOND_GET_OPTIONS    |                        | u8 low_spur, u8 double, u8 half, u8 0, u32 r |
+ * | VALOND_SET_OPTIONS    | as GET_OPTIONS reply   |                        |
+ * | VALOND_GET_REF_SELECT |                        | u8 e_not_i             |
+ * | VALOND_SET_REF_SELECT | u8 e_not_i             |                        |
+ * | VALOND_GET_VCO_RANGE  |                        | u16 min, u16 max       |
+ * | VALOND_SET_VCO_RANGE  | u16 min, u16 max       |                        |
+ * | VALOND_GET_PHASE_LOCK |                        | u8 locked              |
+ * | VALOND_GET_LABEL      |                        | char[16]               |
+ * | VALOND_SET_LABEL      | char[16]               |                        |
+ * | VALOND_FLASH          |                        |                        |
+ * | VALOND_REFRESH        |                        |                        |
+ **/
+
+enum valond_op
+{
+    VALOND_GET_FREQUENCY  = 0x01,
+    VALOND_SET_FREQUENCY  = 0x02,
+    VALOND_GET_REFERENCE  = 0x03,
+    VALOND_SET_REFERENCE  = 0x04,
+    VALOND_GET_RF_LEVEL   = 0x05,
+    VALOND_SET_RF_LEVEL   = 0x06,
+    VALOND_GET_OPTIONS    = 0x07,
+    VALOND_SET_OPTIONS    = 0x08,
+    VALOND_GET_REF_SELECT = 0x09,
+    VALOND_SET_REF_SELECT = 0x0a,
+    VALOND_GET_VCO_RANGE  = 0x0b,
+    VALOND_SET_VCO_RANGE  = 0x0c,
+    VALOND_GET_PHASE_LOCK = 0x0d,
+    VALOND_GET_LABEL      = 0x0f,
+    VALOND_SET_LABEL      = 0x10,
+    VALOND_FLASH          = 0x12,
+    VALOND_REFRESH        = 0x14
+};
+
+enum
+{
+    VALOND_PAYLOAD_SIZE = 16,
+    VALOND_REQUEST_SIZE = 2 + VALOND_PAYLOAD_SIZE,
+    VALOND_REPLY_SIZE   = 1 + VALOND_PAYLOAD_SIZE
+};
+
+/**
+ * Reads leave the board untouched and may be coalesced with identical reads
+ * from other clients. All read opcodes are odd.
+ **/
+inline bool
+valond_is_read(uint8_t op)
+{
+    return op & 1;
+}
+
+#endif//VALOND_H
@@ -0,0 +1,143 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+// valonmap: sweeps the output range of a Valon 5007 for a choice of
+// reference, options and channel spacing, and reports the tuning error,
+// the unreachable gaps and where each output divider takes over. This is
+// done offline with FrequencyPlanner; no synthesizer is needed.
+
+#include "FrequencyPlanner.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -r ref      Reference frequency in Hz (default 10000000)\n"
+            "  -d          Double the reference\n"
+            "  -2          Halve the reference\n"
+            "  -R r        Reference divider (default 1)\n"
+            "  -v min      Minimum VCO frequency in MHz (default 2200)\n"
+            "  -V max      Maximum VCO frequency in MHz (default 4400)\n"
+            "  -c spacing  Channel spacing in Hz, 0 for the closest frequency\n"
+            "              (default 10000)\n"
+            "  -f first    First frequency in Hz (default VCO min / 16)\n"
+            "  -l last     Last frequency in Hz (default VCO max)\n"
+            "  -s step     Sweep step in Hz (default 1000)\n"
+            "  -j threads  Worker threads (default one per core)\n"
+            "  -o file     Write the error map, one \"Hz dbf error\" line per\n"
+            "              frequency\n",
+            argv0);
+}
+
+int
+main(int argc, char **argv)
+{
+    FrequencyPlanner::config cfg;
+    cfg.reference = 10000000;
+    cfg.double_ref = false;
+    cfg.half_ref = false;
+    cfg.r = 1;
+    cfg.vco_min = 2200;
+    cfg.chan_spacing = 10000;
+    cfg.mode = FrequencyPlanner::CHANNEL_SPACING;
+    unsigned long vco_max = 4400;
+    unsigned long long first = 0, last = 0, step = 1000;
+    unsigned threads = 0;
+    const char *map = NULL;
+
+    int opt;
+    while((opt = getopt(argc, argv, "r:d2R:v:V:c:f:l:s:j:o:h")) != -1)
+    {
+        switch(opt)
+        {
+        case 'r': cfg.reference = strtoul(optarg, NULL, 0); break;
+        case 'd': cfg.double_ref = true; break;
+        case '2': cfg.half_ref = true; break;
+        case 'R': cfg.r = strtoul(optarg, NULL, 0); break;
+        case 'v': cfg.vco_min = strtoul(optarg, NULL, 0); break;
+        case 'V': vco_max = strtoul(optarg, NULL, 0); break;
+        case 'c': cfg.chan_spacing = strtoul(optarg, NULL, 0); break;
+        case 'f': first = strtoull(optarg, NULL, 0); break;
+        case 'l': last = strtoull(optarg, NULL, 0); break;
+        case 's': step = strtoull(optarg, NULL, 0); break;
+        case 'j': threads = strtoul(optarg, NULL, 0); break;
+        case 'o': map = optarg; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if((optind != argc) || (cfg.reference == 0) || (step == 0) ||
+       (vco_max > 0xffff))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    if(cfg.chan_spacing == 0) cfg.mode = FrequencyPlanner::BEST_APPROXIMATION;
+    if(first == 0) first = (cfg.vco_min * 1000000ULL + 15) / 16;
+    if(last == 0) last = vco_max * 1000000ULL;
+
+    FrequencyPlanner planner(cfg);
+    FrequencyPlanner::coverage c;
+    planner.sweep(first, last, step, vco_max, threads, c);
+
+    printf("Swept %lu frequencies from %llu to %llu Hz in %llu Hz steps\n",
+           (unsigned long)c.dbf.size(), first, last, step);
+    printf("Reachable: %lu\n", (unsigned long)c.reachable);
+    printf("Max error: %.3f Hz\n", c.max_error);
+    printf("RMS error: %.3f Hz\n", c.rms_error);
+    printf("Output dividers:\n");
+    for(size_t i = 0; i < c.boundaries.size(); ++i)
+    {
+        printf("  dbf %2u: %llu - %llu Hz\n", c.boundary_dbf[i],
+               (unsigned long long)c.boundaries[i].first,
+               (unsigned long long)c.boundaries[i].last);
+    }
+    printf("Gaps:%s\n", c.gaps.empty() ? " none" : "");
+    for(size_t i = 0; i < c.gaps.size(); ++i)
+    {
+        printf("  %llu - %llu Hz\n", (unsigned long long)c.gaps[i].first,
+               (unsigned long long)c.gaps[i].last);
+    }
+
+    if(map)
+    {
+        FILE *fp = fopen(map, "w");
+        if(fp == NULL)
+        {
+            perror(map);
+            return 1;
+        }
+        for(size_t i = 0; i < c.dbf.size(); ++i)
+        {
+            fprintf(fp, "%llu %u %.3f\n",
+                    (unsigned long long)(c.start + i * c.step), c.dbf[i],
+                    c.error[i]);
+        }
+        fclose(fp);
+    }
+    return 0;
+}
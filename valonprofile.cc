@@ -0,0 +1,83 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+// valonprofile: brings Valon 5007 boards to the settings in a profile file.
+// Each board is read once, compared with its section of the profile and
+// only the settings that differ are written. All ports are handled in
+// parallel. See ValonProfile.h for the file format.
+
+#include "ValonProfile.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-n] profile port...\n"
+            "  Apply the profile to the synthesizers on the serial ports.\n"
+            "  -n  Report the settings that differ without writing them\n",
+            argv0);
+}
+
+int
+main(int argc, char **argv)
+{
+    bool dry_run = false;
+    int opt;
+    while((opt = getopt(argc, argv, "nh")) != -1)
+    {
+        switch(opt)
+        {
+        case 'n': dry_run = true; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if(argc - optind < 2)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ValonProfile profile;
+    if(!profile.load(argv[optind]))
+    {
+        fprintf(stderr, "%s: %s\n", argv[optind], profile.error().c_str());
+        return 2;
+    }
+    std::vector<std::string> ports(argv + optind + 1, argv + argc);
+    std::vector<ValonProfile::result> results;
+    bool ok = profile.apply_profile(ports, dry_run, results);
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const ValonProfile::result &r = results[i];
+        printf("%s: %s%s%d change%s%s%s\n", r.port.c_str(),
+               r.section.empty() ? "" : r.section.c_str(),
+               r.section.empty() ? "" : ", ",
+               r.changes, (r.changes == 1) ? "" : "s",
+               r.ok ? (dry_run ? " needed" : " made") : ", failed: ",
+               r.ok ? "" : r.message.c_str());
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,280 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+// valonstress: repeats one operation many times and reports the latency
+// distribution and failure rate, against a ValonEmulator injecting faults
+// or against a real board. Used to see how ValonSynth's timeouts and
+// recovery behave in the tail, not just in the common case.
+
+#include "ValonEmulator.h"
+#include "ValonRealtime.h"
+#include "ValonSynth.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [options] get|set|lock|identify\n"
+            "  Repeat an operation and report its latency percentiles.\n"
+            "  -n count     Operations to run (default 1000)\n"
+            "  -f faults    Faults for all opcodes, e.g. drop=0.01,corrupt=0.01,\n"
+            "               nack=0.01,delay=0.01:300000,stray=0.01,vanish=0.001\n"
+            "  -F op:faults Faults for one opcode, e.g. 0x80:drop=0.1\n"
+            "  -s seed      Seed for the fault generator (default 1)\n"
+            "  -l usec      Time to lock after a frequency change (default 0)\n"
+            "  -t usec      Reply timeout (default 200000)\n"
+            "  -w           Do not model time on the wire\n"
+            "  -p port      Use the board on this port instead of the emulator\n"
+            "  -r prio[:cpu] Lock memory and run at this SCHED_FIFO priority,\n"
+            "               optionally on one CPU\n",
+            argv0);
+}
+
+static double
+now_ms()
+{
+    timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static double
+percentile(const std::vector<double> &sorted, double p)
+{
+    size_t i = size_t(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(i, sorted.size() - 1)];
+}
+
+int
+main(int argc, char **argv)
+{
+    int count = 1000;
+    uint32_t seed = 1;
+    uint32_t lock_usec = 0;
+    int timeout = 200000;
+    bool wire_time = true;
+    const char *port = NULL;
+    int priority = 0;
+    int cpu = -1;
+    ValonEmulator::faults all;
+    std::vector<std::pair<uint8_t, ValonEmulator::faults> > by_opcode;
+    int opt;
+    while((opt = getopt(argc, argv, "n:f:F:s:l:t:wp:r:h")) != -1)
+    {
+        switch(opt)
+        {
+        case 'n': count = atoi(optarg); break;
+        case 's': seed = uint32_t(strtoul(optarg, NULL, 0)); break;
+        case 'l': lock_usec = uint32_t(strtoul(optarg, NULL, 0)); break;
+        case 't': timeout = atoi(optarg); break;
+        case 'w': wire_time = false; break;
+        case 'p': port = optarg; break;
+        case 'r':
+        {
+            char *rest;
+            priority = int(strtol(optarg, &rest, 0));
+            if(*rest == ':') cpu = int(strtol(rest + 1, &rest, 0));
+            if((*rest != '\0') || (priority < 1) || (priority > 99))
+            {
+                fprintf(stderr, "Bad priority: %s\n", optarg);
+                return 2;
+            }
+            break;
+        }
+        case 'f':
+            if(!all.parse(optarg))
+            {
+                fprintf(stderr, "Bad fault list: %s\n", optarg);
+                return 2;
+            }
+            break;
+        case 'F':
+        {
+            char *rest;
+            unsigned long op = strtoul(optarg, &rest, 0);
+            ValonEmulator::faults f;
+            if((*rest != ':') || (op > 0xff) || !f.parse(rest + 1))
+            {
+                fprintf(stderr, "Bad opcode fault list: %s\n", optarg);
+                return 2;
+            }
+            by_opcode.push_back(std::make_pair(uint8_t(op), f));
+            break;
+        }
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if((argc - optind != 1) || (count <= 0))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+    std::string operation = argv[optind];
+    if((operation != "get") && (operation != "set") &&
+       (operation != "lock") && (operation != "identify"))
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    ValonEmulator *emulator = NULL;
+    Serial *transport;
+    if(port != NULL)
+    {
+        transport = new Serial(port);
+    }
+    else
+    {
+        emulator = new ValonEmulator(seed);
+        emulator->set_faults(all);
+        for(size_t i = 0; i < by_opcode.size(); ++i)
+        {
+            emulator->set_faults(by_opcode[i].first, by_opcode[i].second);
+        }
+        emulator->set_lock_time(lock_usec);
+        emulator->set_wire_time(wire_time);
+        transport = emulator;
+    }
+    ValonSynth synth(transport);
+    if(!synth.is_open())
+    {
+        fprintf(stderr, "Cannot open %s\n", port ? port : "emulator");
+        return 1;
+    }
+    synth.set_timeout(timeout);
+    synth.set_force_writes(true);
+
+    // Failures are counted from the ring between operations, so the loop
+    // itself never prints or allocates
+    ValonRealtime::error_ring errors(1024);
+    errors.attach(synth);
+    int failed_by_code[ValonSynth::RESYNC_FAILED + 1] = { 0 };
+    std::vector<double> latency;
+    latency.reserve(count);
+    if(priority > 0)
+    {
+        if(!ValonRealtime::lock_memory())
+        {
+            fprintf(stderr, "Cannot lock memory\n");
+            return 1;
+        }
+        if(!ValonRealtime::set_thread_priority(pthread_self(), priority, cpu))
+        {
+            fprintf(stderr, "Cannot set real-time priority\n");
+            return 1;
+        }
+    }
+
+    float first_frequency = 0.0f;
+    if((operation == "get") &&
+       !synth.get_frequency(ValonSynth::A, first_frequency))
+    {
+        fprintf(stderr, "Cannot read the frequency\n");
+        return 1;
+    }
+
+    int failures = 0;
+    int wrong = 0;
+    int reconnects = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        double start = now_ms();
+        bool ok = false;
+        if(operation == "get")
+        {
+            // The board is never retuned, so any other answer is wrong
+            float frequency;
+            ok = synth.get_frequency(ValonSynth::A, frequency);
+            if(ok && (frequency != first_frequency)) ++wrong;
+        }
+        else if(operation == "set")
+        {
+            ok = synth.set_frequency(ValonSynth::A, (i & 1) ? 1000.0f : 1001.0f,
+                                     1.0f);
+        }
+        else if(operation == "lock")
+        {
+            ok = synth.set_frequency(ValonSynth::A, (i & 1) ? 1000.0f : 1001.0f,
+                                     1.0f);
+            bool locked = false;
+            while(ok && !locked && (now_ms() - start < 1000.0))
+            {
+                ok = synth.get_phase_lock(ValonSynth::A, locked);
+            }
+            ok = ok && locked;
+        }
+        else
+        {
+            ValonSynth::identity id;
+            ok = synth.identify(id);
+        }
+        latency.push_back(now_ms() - start);
+        if(!ok) ++failures;
+        ValonRealtime::event e;
+        while(errors.pop(e)) ++failed_by_code[e.code];
+        // Plug a vanished port back in, as an operator would
+        if(emulator && !emulator->is_open())
+        {
+            emulator->reconnect();
+            ++reconnects;
+        }
+    }
+
+    std::sort(latency.begin(), latency.end());
+    printf("%d %s: %d failed (%.3f%%)\n", count, operation.c_str(), failures,
+           100.0 * failures / count);
+    if(operation == "get") printf("%d succeeded with a wrong answer\n", wrong);
+    printf("latency ms: p50 %.3f  p90 %.3f  p99 %.3f  p99.9 %.3f  max %.3f\n",
+           percentile(latency, 0.5), percentile(latency, 0.9),
+           percentile(latency, 0.99), percentile(latency, 0.999),
+           latency.back());
+    printf("attempts failed: short write %d  timeout %d  nack %d  "
+           "checksum %d  resync %d  port %d (dropped %llu)\n",
+           failed_by_code[ValonSynth::SHORT_WRITE],
+           failed_by_code[ValonSynth::REPLY_TIMEOUT],
+           failed_by_code[ValonSynth::REPLY_NACK],
+           failed_by_code[ValonSynth::REPLY_CHECKSUM],
+           failed_by_code[ValonSynth::RESYNC_FAILED],
+           failed_by_code[ValonSynth::PORT_ERROR],
+           (unsigned long long)errors.dropped());
+    if(emulator)
+    {
+        const ValonEmulator::counters &c = emulator->injected();
+        printf("frames %u: drop %u  corrupt %u  nack %u  delay %u  "
+               "stray %u  vanish %u (reconnected %d)\n",
+               c.frames, c.drops, c.corrupts, c.nacks, c.delays, c.strays,
+               c.vanishes, reconnects);
+    }
+    return 0;
+}
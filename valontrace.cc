@@ -0,0 +1,147 @@
+//# Copyright (C) 2011 Associated Universities, Inc. Washington DC, USA.
+//# 
+//# This program is free software; you can redistribute it and/or modify
+//# it under the terms of the GNU General Public License as published by
+//# the Free Software Foundation; either version 2 of the License, or
+//# (at your option) any later version.
+//# 
+//# This program is distributed in the hope that it will be useful, but
+//# WITHOUT ANY WARRANTY; without even the implied warranty of
+//# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+//# General Public License for more details.
+//# 
+//# You should have received a copy of the GNU General Public License
+//# along with this program; if not, write to the Free Software
+//# Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.
+//# 
+//# Correspondence concerning GBT software should be addressed as follows:
+//#    GBT Operations
+//#    National Radio Astronomy Observatory
+//#    P. O. Box 2
+//#    Green Bank, WV 24944-0002 USA
+
+
+
+// valontrace: summarizes a serial trace recorded with ValonSynth::set_trace,
+// showing where the time went: draining writes, waiting for the board to
+// reply, and time spent on the host between calls. Queries that returned
+// the same reply as the previous identical query, with no write to the
+// board in between, are counted as redundant. See SerialReplay.h for the
+// file format.
+
+#include "SerialReplay.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#include <map>
+
+static void
+usage(const char *argv0)
+{
+    fprintf(stderr,
+            "Usage: %s [-v] trace\n"
+            "  Summarize a serial trace by opcode.\n"
+            "  -v  List every call as well\n",
+            argv0);
+}
+
+struct totals
+{
+    unsigned count;
+    uint64_t write_us;
+    uint64_t read_us;
+    unsigned short_reads;
+    unsigned redundant;
+};
+
+int
+main(int argc, char **argv)
+{
+    bool verbose = false;
+    int opt;
+    while((opt = getopt(argc, argv, "vh")) != -1)
+    {
+        switch(opt)
+        {
+        case 'v': verbose = true; break;
+        default: usage(argv[0]); return 2;
+        }
+    }
+    if(argc - optind != 1)
+    {
+        usage(argv[0]);
+        return 2;
+    }
+
+    std::vector<SerialReplay::record> records;
+    if(!SerialReplay::load(argv[optind], records))
+    {
+        fprintf(stderr, "%s: not a readable trace\n", argv[optind]);
+        return 2;
+    }
+
+    std::map<uint8_t, totals> ops;
+    std::map<uint8_t, std::vector<uint8_t> > last_reply;
+    uint64_t elapsed = 0, busy = 0;
+    uint8_t op = 0;
+    bool single_query = false;
+    for(size_t i = 0; i < records.size(); ++i)
+    {
+        const SerialReplay::record &r = records[i];
+        elapsed += r.start;
+        busy += r.duration;
+        if(verbose)
+        {
+            printf("%10.3f ms %c %6.3f ms %2u/%-2u", elapsed / 1e3, r.kind,
+                   r.duration / 1e3, unsigned(r.data.size()),
+                   unsigned(r.requested));
+            for(size_t k = 0; k < r.data.size(); ++k)
+            {
+                printf(" %02x", r.data[k]);
+            }
+            printf("\n");
+        }
+        if(r.kind == 'W')
+        {
+            op = r.data.empty() ? 0 : r.data[0];
+            totals &t = ops[op];
+            ++t.count;
+            t.write_us += r.duration;
+            // Commands change the board; queries are opcodes 0x80 and up
+            single_query = ((r.data.size() == 1) && (op & 0x80));
+            if(!(op & 0x80)) last_reply.clear();
+        }
+        else
+        {
+            totals &t = ops[op];
+            t.read_us += r.duration;
+            if(r.data.size() < r.requested) ++t.short_reads;
+            if(single_query && (r.data.size() == r.requested))
+            {
+                std::map<uint8_t, std::vector<uint8_t> >::iterator
+                    prev = last_reply.find(op);
+                if((prev != last_reply.end()) && (prev->second == r.data))
+                {
+                    ++t.redundant;
+                }
+                last_reply[op] = r.data;
+            }
+            single_query = false;
+        }
+    }
+    if(!records.empty()) elapsed += records.back().duration;
+
+    printf("%zu calls over %.3f ms; %.3f ms on the port, %.3f ms on the host\n",
+           records.size(), elapsed / 1e3, busy / 1e3,
+           (elapsed - busy) / 1e3);
+    printf("opcode  count   write ms    read ms  short  redundant\n");
+    for(std::map<uint8_t, totals>::const_iterator it = ops.begin();
+        it != ops.end(); ++it)
+    {
+        const totals &t = it->second;
+        printf("  0x%02x  %5u %10.3f %10.3f  %5u  %9u\n", it->first, t.count,
+               t.write_us / 1e3, t.read_us / 1e3, t.short_reads, t.redundant);
+    }
+    return 0;
+}